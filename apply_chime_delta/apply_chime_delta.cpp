@@ -0,0 +1,74 @@
+#include <iostream>
+#include <cstdlib>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Rebuilds a patched firmware file from Apple's original and a delta made by
+// inject_chime --delta.
+
+#include "../util/chime_delta.h"
+
+using namespace std;
+
+static string programName; // name of program as called
+
+[[noreturn]] static void exitPrintUsage(); // exits with a message showing how to use the program
+
+int main(int argc, char *argv[])
+{
+	programName = argv[0];
+	if (argc != 4)
+	{
+		exitPrintUsage();
+	}
+
+	int originalFd = open(argv[1], O_RDONLY);
+	if (originalFd < 0)
+	{
+		cerr << "Unable to open original firmware file \"" << argv[1] << "\": " << strerror(errno) << endl;
+		exitPrintUsage();
+	}
+	int deltaFd = open(argv[2], O_RDONLY);
+	if (deltaFd < 0)
+	{
+		cerr << "Unable to open delta file \"" << argv[2] << "\": " << strerror(errno) << endl;
+		exitPrintUsage();
+	}
+	int outputFd = open(argv[3], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (outputFd < 0)
+	{
+		cerr << "Unable to open output file \"" << argv[3] << "\": " << strerror(errno) << endl;
+		exitPrintUsage();
+	}
+
+	string error;
+	bool ok = applyDelta(originalFd, deltaFd, outputFd, error);
+	close(originalFd);
+	close(deltaFd);
+	if (close(outputFd) != 0 && ok)
+	{
+		ok = false;
+		error = "unable to write the output file";
+	}
+	if (!ok)
+	{
+		// Don't leave a half-built firmware file lying around for someone to flash
+		unlink(argv[3]);
+		cerr << "Error: " << error << "." << endl;
+		return 1;
+	}
+
+	cout << "Successfully rebuilt patched firmware." << endl;
+	return 0;
+}
+
+static void exitPrintUsage()
+{
+	cerr << "usage: " << programName << " <original firmware file> <delta file> <output firmware file>" << endl;
+	exit(1);
+}
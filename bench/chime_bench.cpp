@@ -0,0 +1,427 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Benchmarks for the codecs and the whole patch path, using synthetic inputs.
+
+#include "fixtures.h"
+#include "../util/adler32.h"
+#include "../util/ascii85.h"
+#include "../util/batch.h"
+#include "../util/chimepatch.h"
+#include "../util/cpu_dispatch.h"
+#include "../util/files.h"
+#include "../util/firmware_locator.h"
+#include "../util/ima.h"
+#include "../util/md5.h"
+#include "../util/patch_pipeline.h"
+#include "../util/pattern_search.h"
+#include "../util/sound.h"
+#include "../util/stats.h"
+
+using namespace std;
+
+static string programName; // name of program as called
+static size_t inputSize = 16 * 1024 * 1024; // bytes of input for the codec benchmarks
+static int iterations = 5; // times each benchmark is run
+static string only; // if set, only run benchmarks whose name starts with this
+
+static double runBenchmark(const string &name, size_t bytes, const function<void()> &work); // times one benchmark, returning the best time
+static bool runLatencyBenchmarks(const string &sound); // one job from files to file, step by step and pipelined
+static bool runBatchBenchmarks(const string &sound); // batch mode on each I/O backend, reading and writing real files
+static const ModelInfo *fixtureModel(const ModelInfo &model, const string &firmware); // a model that accepts a fixture as its original firmware
+static bool makeScratchDir(string &dir); // makes an empty directory in /tmp
+static bool wantBenchmark(const string &prefix); // whether --only could match a benchmark starting with prefix
+static size_t parseSize(const string &size); // parses sizes like 64K, 16M, 1G
+[[noreturn]] static void exitPrintUsage(); // exits with a message showing how to use the program
+
+// Keeps the compiler from throwing away results we never look at
+static volatile uint32_t sink;
+
+int main(int argc, char *argv[])
+{
+	programName = argv[0];
+	for (int x = 1; x < argc; x++)
+	{
+		string arg = argv[x];
+		if (arg.compare(0, 7, "--size=") == 0)
+		{
+			inputSize = parseSize(arg.substr(7));
+		}
+		else if (arg.compare(0, 13, "--iterations=") == 0)
+		{
+			iterations = atoi(arg.c_str() + 13);
+		}
+		else if (arg.compare(0, 7, "--only=") == 0)
+		{
+			only = arg.substr(7);
+		}
+		else
+		{
+			exitPrintUsage();
+		}
+	}
+	if (inputSize < 4 || iterations < 1)
+	{
+		exitPrintUsage();
+	}
+
+	// Inputs for the codec benchmarks
+	string rom;
+	makeRomFixture(1, inputSize & ~static_cast<size_t>(3), rom);
+	string encoded;
+	ec85(rom, encoded);
+	string pcm;
+	makeSoundFixture(1, (inputSize / (SAMPLES_PER_PACKET * BYTES_PER_SAMPLE)) * SAMPLES_PER_PACKET * BYTES_PER_SAMPLE, pcm);
+
+	// A ROM with a chime hidden at an odd offset in the middle, for the chime scanner
+	string chimeRom(rom);
+	{
+		string chimeSound;
+		string chime;
+		makeSoundFixture(2, SOUND_MAX_SIZE, chimeSound);
+		imaEncode(chimeSound, chime);
+		if (chimeRom.length() >= chime.length())
+		{
+			chimeRom.replace(((chimeRom.length() - chime.length()) / 2) | 1, chime.length(), chime);
+		}
+	}
+
+	// The allow-list prefixes patch_updater looks for
+	PatternSet allowListPrefixes;
+	allowListPrefixes.patterns[0] = "Apple PowerMac1,1 ";
+	allowListPrefixes.patterns[1] = "Apple iMac Open Firmware ";
+	allowListPrefixes.lengths[0] = 18;
+	allowListPrefixes.lengths[1] = 25;
+	allowListPrefixes.count = 2;
+
+	cout << left << setw(36) << "benchmark" << right << setw(12) << "bytes" << setw(12) << "ms/iter" <<
+		setw(12) << "MB/s" << setw(14) << "allocs/iter" << endl;
+
+	// Every variant of the dispatched kernels this CPU can run
+	for (int x = 0; x < NUM_KERNEL_LEVELS; x++)
+	{
+		KernelLevel level = static_cast<KernelLevel>(x);
+		if (!setKernelLevel(level))
+		{
+			continue;
+		}
+		string suffix = string("/") + kernelLevelName(level);
+		runBenchmark("adler32" + suffix, rom.length(), [&]() { sink = adler32(rom); });
+		runBenchmark("locateChime" + suffix, chimeRom.length(), [&]()
+		{
+			ChimeLocation location;
+			sink = locateChime(chimeRom, location) ? location.offset : 0;
+		});
+		runBenchmark("findPatterns" + suffix, rom.length(), [&]()
+		{
+			vector<PatternMatch> matches;
+			findPatterns(reinterpret_cast<const unsigned char *>(rom.data()), rom.length(), allowListPrefixes, matches);
+			sink = matches.size();
+		});
+	}
+	setKernelLevel(bestKernelLevel());
+	// These only have a scalar version
+	runBenchmark("dc85", rom.length(), [&]() { sink = dc85(encoded).length(); });
+	runBenchmark("ec85", rom.length(), [&]()
+	{
+		string out;
+		sink = ec85(rom, out);
+	});
+	runBenchmark("imaEncode", pcm.length(), [&]()
+	{
+		string out;
+		imaEncode(pcm, out);
+		sink = out.length();
+	});
+	runBenchmark("md5", rom.length(), [&]() { sink = md5(rom).length(); });
+
+	// The whole patch path for each model, on a synthetic firmware file. This is everything
+	// inject_chime does except reading and writing files.
+	string sound;
+	makeSoundFixture(2, SOUND_MAX_SIZE, sound);
+	for (size_t x = 0; x < NUM_MODELS; x++)
+	{
+		const ModelInfo &model = MODELS[x];
+		string firmware;
+		if (!makeFirmwareFixture(model, 1, firmware))
+		{
+			cerr << "Unable to build a fixture for " << model.layout->name << endl;
+			return 1;
+		}
+
+		string baseRom;
+		model.decodeFirmware(*model.layout, firmware, baseRom);
+		FileChecksumParts baseParts;
+		model.fileChecksumParts(*model.layout, firmware, baseParts);
+		runBenchmark(string("decode/") + model.id, firmware.length(), [&]()
+		{
+			string decoded;
+			sink = model.decodeFirmware(*model.layout, firmware, decoded);
+		});
+		runBenchmark(string("injectChime/") + model.id, firmware.length(), [&]()
+		{
+			string compressed;
+			string soundCopy(sound);
+			compressSound(soundCopy, compressed);
+			string patchedFirmware(firmware);
+			string patchedRom(baseRom);
+			string encoded;
+			model.injectChime(*model.layout, patchedFirmware, patchedRom, compressed, baseParts, encoded);
+			sink = patchedFirmware.length();
+		});
+		runBenchmark(string("endToEnd/") + model.id, firmware.length(), [&]()
+		{
+			string decoded;
+			string compressed;
+			string soundCopy(sound);
+			sink = md5(firmware).length();
+			model.decodeFirmware(*model.layout, firmware, decoded);
+			FileChecksumParts parts;
+			model.fileChecksumParts(*model.layout, firmware, parts);
+			compressSound(soundCopy, compressed);
+			string patchedFirmware(firmware);
+			string encoded;
+			model.injectChime(*model.layout, patchedFirmware, decoded, compressed, parts, encoded);
+			sink = patchedFirmware.length();
+		});
+	}
+
+	return (runLatencyBenchmarks(sound) && runBatchBenchmarks(sound)) ? 0 : 1;
+}
+
+static bool runLatencyBenchmarks(const string &sound)
+{
+	if (!wantBenchmark("latency/"))
+	{
+		return true;
+	}
+
+	string dir;
+	if (!makeScratchDir(dir))
+	{
+		return false;
+	}
+	string soundFile = dir + "/sound.raw";
+	string firmwareFile = dir + "/firmware";
+	string outputFile = dir + "/patched";
+	bool ok = writeFile(soundFile.c_str(), sound);
+	for (size_t x = 0; x < NUM_MODELS && ok; x++)
+	{
+		const ModelInfo &model = MODELS[x];
+		string firmware;
+		const ModelInfo *benchModel = NULL;
+		ok = makeFirmwareFixture(model, 1, firmware) && (benchModel = fixtureModel(model, firmware)) &&
+			writeFile(firmwareFile.c_str(), firmware);
+		if (!ok)
+		{
+			break;
+		}
+
+		// Everything inject_chime does for one file, including reading and writing files,
+		// first one step after another and then with the steps overlapped
+		runBenchmark(string("latency/") + model.id + "/sequential", firmware.length(), [&]()
+		{
+			FirmwareImage image;
+			PatchContext context(image);
+			ChimeError error = image.loadFile(firmwareFile.c_str(), benchModel);
+			if (error == CHIME_OK) error = context.loadSoundFile(soundFile.c_str());
+			if (error == CHIME_OK) error = context.openOutputFile(outputFile.c_str());
+			if (error == CHIME_OK) error = context.injectChime();
+			if (error == CHIME_OK) error = context.writeOutputFile();
+			ok = ok && error == CHIME_OK;
+		});
+		runBenchmark(string("latency/") + model.id + "/pipelined", firmware.length(), [&]()
+		{
+			FirmwareImage image;
+			PatchContext context(image);
+			PipelineStage stage;
+			ok = ok && runPatchPipeline(image, context, firmwareFile.c_str(), soundFile.c_str(),
+										outputFile.c_str(), benchModel, stage) == CHIME_OK;
+		});
+	}
+
+	unlink(soundFile.c_str());
+	unlink(firmwareFile.c_str());
+	unlink(outputFile.c_str());
+	rmdir(dir.c_str());
+	if (!ok)
+	{
+		cerr << "The latency benchmarks failed" << endl;
+	}
+	return ok;
+}
+
+static bool runBatchBenchmarks(const string &sound)
+{
+	const size_t NUM_JOBS = 64;
+	const AsyncIoBackend backends[] = {ASYNC_IO_BLOCKING, ASYNC_IO_THREADS, ASYNC_IO_URING};
+	if (!wantBenchmark("batch/"))
+	{
+		return true;
+	}
+
+	const ModelInfo &model = MODELS[0];
+	string firmware;
+	const ModelInfo *benchModel = NULL;
+	FirmwareImage image;
+	if (!makeFirmwareFixture(model, 1, firmware) || !(benchModel = fixtureModel(model, firmware)) ||
+		image.load(firmware, benchModel) != CHIME_OK)
+	{
+		cerr << "Unable to load a firmware fixture for " << model.layout->name << endl;
+		return false;
+	}
+
+	// A different sound for each job, in a scratch directory on the local disk
+	string dir;
+	if (!makeScratchDir(dir))
+	{
+		return false;
+	}
+	vector<BatchJob> jobs(NUM_JOBS);
+	bool ok = true;
+	for (size_t x = 0; x < NUM_JOBS && ok; x++)
+	{
+		string jobSound;
+		makeSoundFixture(100 + static_cast<uint32_t>(x), sound.length(), jobSound);
+		jobs[x].soundFile = dir + "/sound" + to_string(x) + ".raw";
+		jobs[x].outputFile = dir + "/patched" + to_string(x);
+		ok = writeFile(jobs[x].soundFile.c_str(), jobSound);
+	}
+
+	BatchOptions options;
+	options.quiet = true;
+	for (size_t x = 0; x < sizeof(backends) / sizeof(backends[0]) && ok; x++)
+	{
+		// io_uring quietly turns into threads where it's not available, which isn't worth timing twice
+		if (backends[x] == ASYNC_IO_URING && AsyncFileIo(ASYNC_IO_URING, 1).backend() != ASYNC_IO_URING)
+		{
+			continue;
+		}
+		options.io = backends[x];
+		string name = string("batch/") + asyncIoBackendName(backends[x]);
+		double best = runBenchmark(name, NUM_JOBS * firmware.length(), [&]()
+		{
+			sink = runBatch(image, jobs, options);
+		});
+		if (best > 0)
+		{
+			cout << left << setw(36) << "" << NUM_JOBS / best << " jobs/s" << endl;
+		}
+	}
+
+	for (size_t x = 0; x < NUM_JOBS; x++)
+	{
+		unlink(jobs[x].soundFile.c_str());
+		unlink(jobs[x].outputFile.c_str());
+	}
+	rmdir(dir.c_str());
+	if (!ok)
+	{
+		cerr << "Unable to write the batch benchmark's sound files" << endl;
+	}
+	return ok;
+}
+
+static const ModelInfo *fixtureModel(const ModelInfo &model, const string &firmware)
+{
+	// A fixture only loads as a firmware file if there's a model with its MD5, so add a copy
+	// of the model with it (once). Runtime models are put together from the container and
+	// checksum field kinds, so find the ones that give the same engine as the built-in model.
+	string firmwareMd5 = md5(firmware);
+	const ModelInfo *existing = findModelByMd5(firmwareMd5);
+	if (existing)
+	{
+		return existing;
+	}
+	ModelLayout layout = *model.layout;
+	layout.md5 = firmwareMd5.c_str();
+	layout.maskedMd5 = NULL;
+	for (int container = CONTAINER_ASCII85_LINES; container <= CONTAINER_RAW_SECTION; container++)
+	{
+		for (int field = CHECKSUM_FIELD_HEX; field <= CHECKSUM_FIELD_BIG_ENDIAN; field++)
+		{
+			ContainerKind containerKind = static_cast<ContainerKind>(container);
+			ChecksumFieldKind fieldKind = static_cast<ChecksumFieldKind>(field);
+			if (makeRuntimeModelInfo(model.id, model.layout, containerKind, fieldKind).injectChime == model.injectChime)
+			{
+				return addModel(string("bench_") + model.id, layout, containerKind, fieldKind);
+			}
+		}
+	}
+	return NULL;
+}
+
+static bool makeScratchDir(string &dir)
+{
+	char dirTemplate[] = "/tmp/chime_bench.XXXXXX";
+	if (!mkdtemp(dirTemplate))
+	{
+		cerr << "Unable to create a scratch directory" << endl;
+		return false;
+	}
+	dir = dirTemplate;
+	return true;
+}
+
+static bool wantBenchmark(const string &prefix)
+{
+	size_t len = (only.length() < prefix.length()) ? only.length() : prefix.length();
+	return only.compare(0, len, prefix, 0, len) == 0;
+}
+
+static double runBenchmark(const string &name, size_t bytes, const function<void()> &work)
+{
+	if (!only.empty() && name.compare(0, only.length(), only) != 0)
+	{
+		return 0;
+	}
+
+	// Report the best run, which is the one least disturbed by everything else going on
+	// (and the fewest allocations, which is the steady state once buffers have been reused)
+	double best = 0;
+	uint64_t fewestAllocations = 0;
+	for (int x = 0; x < iterations; x++)
+	{
+		uint64_t allocations = threadAllocationCount();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		work();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		allocations = threadAllocationCount() - allocations;
+		if (x == 0 || seconds < best) best = seconds;
+		if (x == 0 || allocations < fewestAllocations) fewestAllocations = allocations;
+	}
+
+	cout << left << setw(36) << name << right << setw(12) << bytes << fixed << setprecision(3) <<
+		setw(12) << (best * 1000.0) << setprecision(1) << setw(12) << (bytes / best / 1e6) <<
+		setw(14) << fewestAllocations << endl;
+	return best;
+}
+
+static size_t parseSize(const string &size)
+{
+	char *end;
+	size_t value = strtoul(size.c_str(), &end, 0);
+	switch (*end)
+	{
+	case 'k': case 'K': return value * 1024;
+	case 'm': case 'M': return value * 1024 * 1024;
+	case 'g': case 'G': return value * 1024 * 1024 * 1024;
+	}
+	return value;
+}
+
+static void exitPrintUsage()
+{
+	cerr << "usage: " << programName << " [--size=N[K|M|G]] [--iterations=N] [--only=benchmark]" << endl;
+	exit(1);
+}
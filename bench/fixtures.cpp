@@ -0,0 +1,202 @@
+#include "fixtures.h"
+#include <cmath>
+#include <random>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Line lengths in an Ascii85 container, including "dc85 " and the carriage return.
+// ec85 stops adding to a line once 5 more characters won't fit, so a line of 'z' or 'y'
+// only gets 96 characters, while a line of random data gets 20 groups of 5.
+#define RANDOM_LINE_BYTES		80
+#define RANDOM_LINE_CHARS		(5 + 100 + 1)
+#define FILL_LINE_BYTES			(96 * 4)
+#define FILL_LINE_CHARS			(5 + 96 + 1)
+#define LAST_LINE_MAX_CHARS		96
+
+// Random 4-byte group that Ascii85 encodes as 5 characters (not all 0x00 or all 0xFF)
+static uint32_t randomGroup(mt19937 &rng)
+{
+	uint32_t value;
+	do
+	{
+		value = rng();
+	} while (value == 0 || value == 0xFFFFFFFFUL);
+	return value;
+}
+
+static void appendGroup(string &rom, uint32_t value)
+{
+	for (int x = 3; x >= 0; x--)
+	{
+		rom.append(1, static_cast<char>((value >> (8 * x)) & 0xFF));
+	}
+}
+
+// Builds a ROM whose Ascii85 encoding is exactly span characters long
+static bool makeAscii85Rom(const ModelLayout &layout, mt19937 &rng, string &rom)
+{
+	const size_t span = layout.romEndOffset - layout.romOffset;
+	const size_t needed = layout.soundOffset + SOUND_COMPRESSED_SIZE + 1024;
+
+	// Random lines don't hold enough data, so mix in some lines of 0x00/0xFF fill.
+	// Figure out roughly how many, leaving a few spare for adjusting the length below.
+	double randomOnly = static_cast<double>(span) * RANDOM_LINE_BYTES / RANDOM_LINE_CHARS;
+	double perFillLine = FILL_LINE_BYTES - static_cast<double>(FILL_LINE_CHARS) * RANDOM_LINE_BYTES / RANDOM_LINE_CHARS;
+	long fillLines = 3;
+	if (needed > randomOnly)
+	{
+		fillLines += static_cast<long>(ceil((needed - randomOnly) / perFillLine));
+	}
+	if (static_cast<size_t>(fillLines) * FILL_LINE_CHARS + 7 > span)
+	{
+		return false;
+	}
+
+	// Whatever doesn't fit in a whole line goes in a shorter last line. Swapping a fill line
+	// for a random line shortens the last line by 4 characters.
+	long randomLines = (span - fillLines * FILL_LINE_CHARS - 7) / RANDOM_LINE_CHARS;
+	long lastLine = span - randomLines * RANDOM_LINE_CHARS - fillLines * FILL_LINE_CHARS - 6;
+	while (lastLine > LAST_LINE_MAX_CHARS && fillLines > 0)
+	{
+		fillLines--;
+		randomLines++;
+		lastLine = span - randomLines * RANDOM_LINE_CHARS - fillLines * FILL_LINE_CHARS - 6;
+	}
+	if (lastLine < 1 || lastLine > LAST_LINE_MAX_CHARS)
+	{
+		return false;
+	}
+
+	// Spread the fill lines out evenly, alternating between 0x00 and 0xFF
+	long totalLines = randomLines + fillLines;
+	long fillsDone = 0;
+	for (long line = 0; line < totalLines; line++)
+	{
+		if (fillsDone < fillLines && (line * fillLines) / totalLines >= fillsDone)
+		{
+			rom.append(FILL_LINE_BYTES, (fillsDone % 2) ? '\xFF' : '\x00');
+			fillsDone++;
+		}
+		else
+		{
+			for (int x = 0; x < RANDOM_LINE_BYTES / 4; x++)
+			{
+				appendGroup(rom, randomGroup(rng));
+			}
+		}
+	}
+
+	// The last line: some random groups, then 'z' groups to make up the odd characters
+	for (long x = 0; x < lastLine / 5; x++)
+	{
+		appendGroup(rom, randomGroup(rng));
+	}
+	rom.append(4 * (lastLine % 5), '\x00');
+
+	return (rom.length() >= needed) && (rom.length() <= layout.romChecksumLength);
+}
+
+bool makeFirmwareFixture(const ModelInfo &model, uint32_t seed, string &firmware)
+{
+	const ModelLayout &layout = *model.layout;
+	mt19937 rng(seed);
+	string rom;
+
+	if (layout.columnWidth)
+	{
+		if (layout.columnWidth != 100 || !makeAscii85Rom(layout, rng, rom))
+		{
+			return false;
+		}
+
+		// Text before and after the ROM, with room for the checksums
+		static const char text[] = "abcdefghijklmnopqrstuvwxyz0123456789 ()\\:;\r";
+		size_t length = layout.romChecksumPos + 8 + 4096 + layout.fileChecksumEndBack;
+		firmware.clear();
+		for (size_t x = 0; x < length; x++)
+		{
+			firmware.append(1, text[rng() % (sizeof(text) - 1)]);
+		}
+
+		string encoded;
+		uint32_t encodedAdler = 1;
+		Ascii85Lines::encode(layout, rom, 0, rom.length(), encoded, encodedAdler);
+		if (encoded.length() != layout.romEndOffset - layout.romOffset)
+		{
+			return false;
+		}
+		firmware.replace(layout.romOffset, encoded.length(), encoded);
+	}
+	else
+	{
+		// Raw section: random data all the way through
+		size_t length = layout.romEndOffset + 4096;
+		firmware.clear();
+		for (size_t x = 0; x < length; x++)
+		{
+			firmware.append(1, static_cast<char>(rng() & 0xFF));
+		}
+		rom = firmware.substr(layout.romOffset, layout.romEndOffset - layout.romOffset);
+	}
+
+	// "Patching" the ROM with its own chime fills in both checksums
+	string chime = rom.substr(layout.soundOffset, SOUND_COMPRESSED_SIZE);
+	FileChecksumParts parts;
+	model.fileChecksumParts(layout, firmware, parts);
+	string encoded;
+	model.injectChime(layout, firmware, rom, chime, parts, encoded);
+	return true;
+}
+
+void makeSoundFixture(uint32_t seed, size_t length, string &sound)
+{
+	// A decaying chord with a little noise, roughly like a startup chime
+	mt19937 rng(seed);
+	static const double freqs[] = {349.23, 440.0, 523.25, 698.46};
+	sound.clear();
+	for (size_t x = 0; x < length / 2; x++)
+	{
+		double t = x / 44100.0;
+		double value = 0;
+		for (size_t f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++)
+		{
+			value += sin(2 * M_PI * freqs[f] * t);
+		}
+		value = value * 6000.0 * exp(-t * 1.5) + static_cast<int>(rng() % 64) - 32;
+		int16_t sample = static_cast<int16_t>(value);
+		sound.append(1, static_cast<char>((sample >> 8) & 0xFF));
+		sound.append(1, static_cast<char>(sample & 0xFF));
+	}
+}
+
+void makeRomFixture(uint32_t seed, size_t length, string &rom)
+{
+	mt19937 rng(seed);
+	rom.clear();
+	rom.reserve(length);
+	while (rom.length() < length)
+	{
+		// Mostly random data, with the odd run of fill like a real ROM
+		uint32_t kind = rng() % 16;
+		size_t run = 64 + rng() % 4096;
+		if (kind == 0)
+		{
+			rom.append(run, '\x00');
+		}
+		else if (kind == 1)
+		{
+			rom.append(run, '\xFF');
+		}
+		else
+		{
+			for (size_t x = 0; x < run; x += 4)
+			{
+				appendGroup(rom, rng());
+			}
+		}
+	}
+	rom.erase(length);
+}
@@ -0,0 +1,26 @@
+#ifndef FIXTURES_H
+#define FIXTURES_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Synthetic firmware files for benchmarking. Apple's firmware can't be shipped, so these
+// are made up from scratch to match each model's layout: the ROM image sits exactly where
+// the model descriptor says it does, in the same container format, with valid checksums.
+// Only the MD5 differs from the real thing.
+
+#include <string>
+#include <stdint.h>
+#include "../util/models.h"
+
+// Builds a firmware file for the given model. Returns false if the layout can't be
+// reproduced (for example, the ROM container is too small to hold the chime).
+bool makeFirmwareFixture(const ModelInfo &model, uint32_t seed, std::string &firmware);
+
+// Builds a 16-bit big-endian chime of the given length in bytes
+void makeSoundFixture(uint32_t seed, size_t length, std::string &sound);
+
+// Builds length bytes of random data with some runs of 0x00 and 0xFF, roughly like a ROM
+void makeRomFixture(uint32_t seed, size_t length, std::string &rom);
+
+#endif // FIXTURES_H
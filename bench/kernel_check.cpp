@@ -0,0 +1,229 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Checks every kernel variant this CPU can run against the scalar one, on random data of
+// random lengths (including odd tails and misaligned starts). Also checks adler32Combine
+// and adler32Replace against working the checksum out from scratch. See "make check".
+
+#include "../util/adler32.h"
+#include "../util/cpu_dispatch.h"
+#include "../util/ima.h"
+#include "../util/pattern_search.h"
+
+using namespace std;
+
+static const size_t MAX_LENGTH = 70 * 1024; // longest block checked
+static const int ROUNDS = 1000; // random blocks checked for each level
+static const size_t MAX_MISALIGN = 64; // how far past an aligned address a block can start
+
+static size_t failures; // mismatches found so far
+
+static void makeBlock(mt19937 &rng, size_t len, string &block); // random data with some runs of 0x00 and 0xFF in it
+static void makePatterns(mt19937 &rng, const string &block, string &storage, PatternSet &set); // patterns picked from the block
+static size_t blockLength(mt19937 &rng, int round); // the length to check in a round
+static void checkLevel(const KernelTable &scalar, const KernelTable &level, uint32_t seed); // compares one level with scalar
+static void checkAdlerHelpers(uint32_t seed); // compares adler32Combine and adler32Replace with a recompute
+static void fail(const string &what, size_t len, size_t misalign); // reports a mismatch
+
+int main(int argc, char *argv[])
+{
+	if (argc > 2)
+	{
+		cerr << "usage: " << argv[0] << " [seed]" << endl;
+		return 1;
+	}
+	uint32_t seed = (argc == 2) ? strtoul(argv[1], NULL, 0) : 1;
+
+	setKernelLevel(KERNEL_SCALAR);
+	KernelTable scalar = kernels();
+	for (int x = 1; x < NUM_KERNEL_LEVELS; x++)
+	{
+		KernelLevel level = static_cast<KernelLevel>(x);
+		if (!setKernelLevel(level))
+		{
+			cout << kernelLevelName(level) << ": not supported here, skipped" << endl;
+			continue;
+		}
+		size_t before = failures;
+		checkLevel(scalar, kernels(), seed);
+		cout << kernelLevelName(level) << ": " << (failures == before ? "OK" : "FAILED") << endl;
+	}
+
+	setKernelLevel(bestKernelLevel());
+	size_t before = failures;
+	checkAdlerHelpers(seed);
+	cout << "adler32Combine/adler32Replace: " << (failures == before ? "OK" : "FAILED") << endl;
+
+	return failures == 0 ? 0 : 1;
+}
+
+static void makeBlock(mt19937 &rng, size_t len, string &block)
+{
+	block.resize(len);
+	for (size_t x = 0; x < len; x++)
+	{
+		block[x] = static_cast<char>(rng());
+	}
+	// Runs of 0x00 break up the IMA header runs, and runs of 0xFF push the adler32 sums
+	// as high as they go
+	size_t runs = len ? rng() % 8 : 0;
+	for (size_t x = 0; x < runs; x++)
+	{
+		size_t start = rng() % len;
+		size_t runLen = min<size_t>(rng() % 4096, len - start);
+		memset(&block[start], (rng() & 1) ? 0x00 : 0xFF, runLen);
+	}
+}
+
+static void makePatterns(mt19937 &rng, const string &block, string &storage, PatternSet &set)
+{
+	// Copies of bits of the block (so there are matches, some right at the end), plus a
+	// couple of short ones that match all over the place
+	set.count = 1 + rng() % MAX_SEARCH_PATTERNS;
+	storage.clear();
+	storage.reserve(set.count * 64);
+	for (size_t x = 0; x < set.count; x++)
+	{
+		size_t len = 1 + rng() % ((x < 2) ? 3 : 48);
+		if (block.length() >= len)
+		{
+			size_t start = (rng() & 3) == 0 ? block.length() - len : rng() % (block.length() - len + 1);
+			storage.append(block, start, len);
+		}
+		else
+		{
+			for (size_t y = 0; y < len; y++)
+			{
+				storage.append(1, static_cast<char>(rng()));
+			}
+		}
+		set.lengths[x] = len;
+	}
+	size_t offset = 0;
+	for (size_t x = 0; x < set.count; x++)
+	{
+		set.patterns[x] = storage.data() + offset;
+		offset += set.lengths[x];
+	}
+}
+
+static size_t blockLength(mt19937 &rng, int round)
+{
+	// The first rounds go through every short length, where the tails are all there is
+	if (round < 200)
+	{
+		return round;
+	}
+	return rng() % (MAX_LENGTH + 1);
+}
+
+static void checkLevel(const KernelTable &scalar, const KernelTable &level, uint32_t seed)
+{
+	string suffix = string("/") + kernelLevelName(level.level) + " doesn't match scalar";
+	mt19937 rng(seed);
+	vector<unsigned char> buffer(MAX_LENGTH + 2 * MAX_MISALIGN);
+	uintptr_t aligned = (reinterpret_cast<uintptr_t>(buffer.data()) + MAX_MISALIGN - 1) & ~(MAX_MISALIGN - 1);
+	string block;
+	string patternStorage;
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		size_t len = blockLength(rng, round);
+		size_t misalign = rng() % MAX_MISALIGN;
+		makeBlock(rng, len, block);
+		unsigned char *data = reinterpret_cast<unsigned char *>(aligned) + misalign;
+		memcpy(data, block.data(), len);
+
+		uint32_t start = (rng() & 1) ? 1 : (rng() % 65521) | ((rng() % 65521) << 16);
+		if (scalar.adler32(start, data, len) != level.adler32(start, data, len))
+		{
+			fail("adler32" + suffix, len, misalign);
+		}
+
+		ImaHeaderScan expected;
+		ImaHeaderScan actual;
+		memset(&expected, 0, sizeof(expected));
+		memset(&actual, 0, sizeof(actual));
+		scalar.imaScanHeaders(data, len, expected);
+		level.imaScanHeaders(data, len, actual);
+		// Only the first 34 lanes mean anything
+		size_t lanes = 34;
+		if (memcmp(expected.run, actual.run, lanes * sizeof(expected.run[0])) != 0 ||
+			memcmp(expected.best, actual.best, lanes * sizeof(expected.best[0])) != 0 ||
+			memcmp(expected.bestEnd, actual.bestEnd, lanes * sizeof(expected.bestEnd[0])) != 0)
+		{
+			fail("imaScanHeaders" + suffix, len, misalign);
+		}
+
+		PatternSet set;
+		makePatterns(rng, block, patternStorage, set);
+		vector<PatternMatch> expectedMatches;
+		vector<PatternMatch> actualMatches;
+		scalar.findPatterns(data, len, set, expectedMatches);
+		level.findPatterns(data, len, set, actualMatches);
+		bool same = expectedMatches.size() == actualMatches.size();
+		for (size_t x = 0; same && x < expectedMatches.size(); x++)
+		{
+			same = expectedMatches[x].offset == actualMatches[x].offset &&
+				expectedMatches[x].pattern == actualMatches[x].pattern;
+		}
+		if (!same)
+		{
+			fail("findPatterns" + suffix, len, misalign);
+		}
+	}
+}
+
+static void checkAdlerHelpers(uint32_t seed)
+{
+	mt19937 rng(seed);
+	string block;
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		size_t len = blockLength(rng, round);
+		makeBlock(rng, len, block);
+		uint32_t whole = adler32Update(1, block.data(), len);
+
+		// Split anywhere, including at either end
+		size_t split = rng() % (len + 1);
+		uint32_t first = adler32Update(1, block.data(), split);
+		uint32_t second = adler32Update(1, block.data() + split, len - split);
+		if (adler32Combine(first, second, len - split) != whole)
+		{
+			fail("adler32Combine doesn't match a recompute", len, 0);
+		}
+
+		if (len == 0)
+		{
+			continue;
+		}
+		size_t pos = rng() % len;
+		size_t count = 1 + rng() % min<size_t>(len - pos, 64);
+		string newBytes;
+		for (size_t x = 0; x < count; x++)
+		{
+			newBytes.append(1, static_cast<char>(rng()));
+		}
+		string changed(block);
+		changed.replace(pos, count, newBytes);
+		uint32_t replaced = adler32Replace(whole, len, pos, block.data() + pos, newBytes.data(), count);
+		if (replaced != adler32Update(1, changed.data(), len))
+		{
+			fail("adler32Replace doesn't match a recompute", len, 0);
+		}
+	}
+}
+
+static void fail(const string &what, size_t len, size_t misalign)
+{
+	cerr << what << " (" << len << " bytes, starting " << misalign << " bytes past alignment)" << endl;
+	failures++;
+}
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <cstdlib>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Writes a synthetic firmware file for every supported model, plus a synthetic chime,
+// into a directory. See fixtures.h.
+
+#include "fixtures.h"
+#include "../util/files.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 3)
+	{
+		cerr << "usage: " << argv[0] << " <output directory> [seed]" << endl;
+		return 1;
+	}
+	string directory = argv[1];
+	uint32_t seed = (argc == 3) ? strtoul(argv[2], NULL, 0) : 1;
+
+	for (size_t x = 0; x < NUM_MODELS; x++)
+	{
+		string firmware;
+		string filename = directory + "/" + MODELS[x].id + ".bin";
+		if (!makeFirmwareFixture(MODELS[x], seed, firmware))
+		{
+			cerr << "Unable to build a fixture for " << MODELS[x].layout->name << endl;
+			return 1;
+		}
+		if (!writeFile(filename.c_str(), firmware))
+		{
+			cerr << "Unable to write file \"" << filename << "\"" << endl;
+			return 1;
+		}
+		cout << "Wrote " << filename << endl;
+	}
+
+	string sound;
+	string filename = directory + "/chime.raw";
+	makeSoundFixture(seed, SOUND_MAX_SIZE, sound);
+	if (!writeFile(filename.c_str(), sound))
+	{
+		cerr << "Unable to write file \"" << filename << "\"" << endl;
+		return 1;
+	}
+	cout << "Wrote " << filename << endl;
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Load generator for inject_chimed. Sends the same chime over and over from several
+// connections at once and reports the request latency distribution.
+
+#include "../util/chimepatch.h"
+#include "../util/chimed_protocol.h"
+#include "../util/files.h"
+
+using namespace std;
+
+static string programName; // name of program as called
+
+static void runClient(const char *socketPath, const string &modelId, const string &sound, int numRequests,
+					  vector<double> &latencies, string &lastOutput, int &failures); // sends requests on one connection
+static double percentile(const vector<double> &sorted, double p); // picks a percentile out of sorted latencies
+[[noreturn]] static void exitPrintUsage(); // exits with a message showing how to use the program
+
+int main(int argc, char *argv[])
+{
+	programName = argv[0];
+
+	// Pull out the options, leaving the other arguments
+	int numRequests = 1000;
+	int concurrency = 1;
+	const char *outputFile = NULL;
+	vector<char *> args;
+	for (int x = 1; x < argc; x++)
+	{
+		string arg = argv[x];
+		if (arg.compare(0, 11, "--requests=") == 0)
+		{
+			numRequests = atoi(arg.c_str() + 11);
+		}
+		else if (arg.compare(0, 14, "--concurrency=") == 0)
+		{
+			concurrency = atoi(arg.c_str() + 14);
+		}
+		else if (arg.compare(0, 9, "--output=") == 0)
+		{
+			outputFile = argv[x] + 9;
+		}
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			exitPrintUsage();
+		}
+		else
+		{
+			args.push_back(argv[x]);
+		}
+	}
+	if (args.size() != 3 || numRequests <= 0 || concurrency <= 0)
+	{
+		exitPrintUsage();
+	}
+
+	string sound;
+	if (!readFile(args[2], sound))
+	{
+		cerr << "Unable to read file \"" << args[2] << "\"" << endl;
+		exitPrintUsage();
+	}
+
+	// Split the requests between the connections
+	vector<vector<double> > latencies(concurrency);
+	vector<string> outputs(concurrency);
+	vector<int> failures(concurrency, 0);
+	vector<thread> clients;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int x = 0; x < concurrency; x++)
+	{
+		int count = numRequests / concurrency + ((x < numRequests % concurrency) ? 1 : 0);
+		clients.push_back(thread(runClient, args[0], string(args[1]), cref(sound), count,
+								 ref(latencies[x]), ref(outputs[x]), ref(failures[x])));
+	}
+	for (size_t x = 0; x < clients.size(); x++)
+	{
+		clients[x].join();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	vector<double> all;
+	int totalFailures = 0;
+	for (int x = 0; x < concurrency; x++)
+	{
+		all.insert(all.end(), latencies[x].begin(), latencies[x].end());
+		totalFailures += failures[x];
+	}
+	sort(all.begin(), all.end());
+
+	cout << all.size() << " requests succeeded, " << totalFailures << " failed, in " << seconds <<
+		" s (" << (seconds > 0 ? all.size() / seconds : 0) << " requests/s)" << endl;
+	if (!all.empty())
+	{
+		cout << "latency (ms): p50 " << percentile(all, 50) << "  p90 " << percentile(all, 90) <<
+			"  p99 " << percentile(all, 99) << "  max " << all.back() << endl;
+	}
+
+	if (outputFile && !outputs[0].empty() && !writeFile(outputFile, outputs[0]))
+	{
+		cerr << "Unable to write file \"" << outputFile << "\"" << endl;
+		return 1;
+	}
+
+	return totalFailures ? 1 : 0;
+}
+
+static void runClient(const char *socketPath, const string &modelId, const string &sound, int numRequests,
+					  vector<double> &latencies, string &lastOutput, int &failures)
+{
+	int fd = connectChimeDaemon(socketPath);
+	if (fd < 0)
+	{
+		failures = numRequests;
+		return;
+	}
+
+	for (int x = 0; x < numRequests; x++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		uint32_t status;
+		string payload;
+		if (!sendChimeRequest(fd, modelId, sound) || !receiveChimeResponse(fd, status, payload))
+		{
+			failures += numRequests - x;
+			break;
+		}
+		latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+		if (status != CHIME_OK)
+		{
+			static mutex errorLock;
+			lock_guard<mutex> l(errorLock);
+			cerr << "Request failed: " << payload << endl;
+			latencies.pop_back();
+			failures++;
+			continue;
+		}
+		lastOutput.swap(payload);
+	}
+	close(fd);
+}
+
+static double percentile(const vector<double> &sorted, double p)
+{
+	size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[min(index, sorted.size() - 1)];
+}
+
+static void exitPrintUsage()
+{
+	cerr << "usage: " << programName << " [--requests=N] [--concurrency=N] [--output=file] " <<
+		"<socket path> <model id> <uncompressed 16-bit mono 44.1 kHz big-endian raw sound file>" << endl;
+	exit(1);
+}
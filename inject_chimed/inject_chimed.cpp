@@ -0,0 +1,299 @@
+#include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <errno.h>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Long-running patch daemon. Every firmware file given on the command line is loaded,
+// verified and decoded once at startup and then kept in memory, so a request only has
+// to pay for encoding the new chime and patching it into a copy of the firmware.
+
+#include "../util/chimepatch.h"
+#include "../util/chimed_protocol.h"
+
+using namespace std;
+
+static string programName; // name of program as called
+static const char *socketPath; // where we're listening
+static vector<unique_ptr<FirmwareImage> > images; // preloaded firmware, one per model
+static unique_ptr<OutputCache> cache; // previously patched firmware (optional)
+static unique_ptr<RomCache> romCache; // decoded ROM images, in the same directory (optional)
+
+// Every client holds a thread and a PatchContext per model (a few MB each), so only so many are
+// served at once. The rest wait in the listen backlog until one leaves.
+static unsigned maxClients = 16;
+static unsigned activeClients;
+static mutex clientsLock;
+static condition_variable clientLeft;
+// A client that sends nothing (or takes nothing) for this long is dropped, so that stalled
+// clients can't hold on to every slot
+static unsigned idleTimeout = 60; // seconds
+
+static void loadFirmwareFiles(const vector<char *> &filenames); // loads and decodes every firmware file
+static int listenOnSocket(const char *path); // creates the listening socket
+static void setIdleTimeout(int fd); // makes reads and writes on a client connection give up after idleTimeout
+static void serveConnection(int fd); // handles all requests on one client connection
+static void waitForClientSlot(); // blocks until fewer than maxClients are connected
+static bool acceptFailed(int error); // deals with accept failing; returns false if it's hopeless
+static const FirmwareImage *findImage(const string &modelId); // finds the preloaded firmware for a model
+static void stopServer(int signum); // removes the socket and exits
+[[noreturn]] static void exitPrintUsage(); // exits with a message showing how to use the program
+
+int main(int argc, char *argv[])
+{
+	programName = argv[0];
+
+	// Pull out the options, leaving the other arguments
+	vector<char *> args;
+	for (int x = 1; x < argc; x++)
+	{
+		string arg = argv[x];
+		if (arg.compare(0, 14, "--max-clients=") == 0)
+		{
+			maxClients = atoi(arg.c_str() + 14);
+			if (maxClients == 0)
+			{
+				exitPrintUsage();
+			}
+		}
+		else if (arg.compare(0, 15, "--idle-timeout=") == 0)
+		{
+			idleTimeout = atoi(arg.c_str() + 15);
+			if (idleTimeout == 0)
+			{
+				exitPrintUsage();
+			}
+		}
+		else if (arg.compare(0, 12, "--cache-dir=") == 0)
+		{
+			cache.reset(new OutputCache(arg.substr(12)));
+			romCache.reset(new RomCache(arg.substr(12)));
+		}
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			exitPrintUsage();
+		}
+		else
+		{
+			args.push_back(argv[x]);
+		}
+	}
+	if (args.size() < 2)
+	{
+		exitPrintUsage();
+	}
+	socketPath = args[0];
+
+	loadFirmwareFiles(vector<char *>(args.begin() + 1, args.end()));
+
+	int listenFd = listenOnSocket(socketPath);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stopServer);
+	signal(SIGTERM, stopServer);
+	cout << "Listening on " << socketPath << endl;
+
+	// Each client gets its own thread; the firmware images are shared read-only
+	while (true)
+	{
+		waitForClientSlot();
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (!acceptFailed(errno))
+			{
+				cerr << "Unable to accept connections: " << strerror(errno) << endl;
+				unlink(socketPath);
+				exit(1);
+			}
+			continue;
+		}
+		setIdleTimeout(fd);
+		{
+			lock_guard<mutex> l(clientsLock);
+			activeClients++;
+		}
+		thread(serveConnection, fd).detach();
+	}
+}
+
+static void waitForClientSlot()
+{
+	unique_lock<mutex> l(clientsLock);
+	clientLeft.wait(l, []() { return activeClients < maxClients; });
+}
+
+static bool acceptFailed(int error)
+{
+	switch (error)
+	{
+	case EINTR:
+	case ECONNABORTED:
+	case EPROTO:
+		// Just that one connection
+		return true;
+	case EMFILE:
+	case ENFILE:
+	case ENOBUFS:
+	case ENOMEM:
+		// Out of file descriptors or memory. Trying again straight away would just spin, so
+		// give the connections we have a moment to finish.
+		this_thread::sleep_for(chrono::milliseconds(100));
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void loadFirmwareFiles(const vector<char *> &filenames)
+{
+	for (size_t x = 0; x < filenames.size(); x++)
+	{
+		unique_ptr<FirmwareImage> image(new FirmwareImage);
+		image->setRomCache(romCache.get());
+		ChimeError error = image->loadFile(filenames[x]);
+		if (error != CHIME_OK)
+		{
+			cerr << "\"" << filenames[x] << "\": " << chimeErrorString(error) << "." << endl;
+			exit(1);
+		}
+		if (findImage(image->model()->id))
+		{
+			cerr << "\"" << filenames[x] << "\": a firmware file for " << image->model()->layout->name <<
+				" was already loaded." << endl;
+			exit(1);
+		}
+
+		cout << "Loaded " << image->model()->layout->firmwareName << " for " <<
+			image->model()->layout->name << " (" << image->model()->id << ")" << endl;
+		images.push_back(move(image));
+	}
+}
+
+static int listenOnSocket(const char *path)
+{
+	sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		cerr << "Socket path \"" << path << "\" is too long." << endl;
+		exit(1);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// Clean up after a previous run that didn't shut down cleanly, but don't delete anything
+	// that isn't a socket
+	struct stat st;
+	if (lstat(path, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			cerr << "Unable to listen on \"" << path << "\": there's already a file there that isn't a socket." << endl;
+			exit(1);
+		}
+		unlink(path);
+	}
+	if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0)
+	{
+		cerr << "Unable to listen on \"" << path << "\": " << strerror(errno) << endl;
+		exit(1);
+	}
+	return fd;
+}
+
+static void setIdleTimeout(int fd)
+{
+	// A read or write that times out fails like a disconnect would
+	timeval timeout;
+	timeout.tv_sec = idleTimeout;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void serveConnection(int fd)
+{
+	string modelId;
+	string sound;
+	// One context per model, reused for every request on this connection
+	map<const FirmwareImage *, unique_ptr<PatchContext> > contexts;
+	while (receiveChimeRequest(fd, modelId, sound))
+	{
+		const FirmwareImage *image = findImage(modelId);
+		if (!image)
+		{
+			if (!sendChimeResponse(fd, CHIME_ERR_UNKNOWN_FIRMWARE, "no firmware loaded for model \"" + modelId + "\""))
+			{
+				break;
+			}
+			continue;
+		}
+
+		unique_ptr<PatchContext> &slot = contexts[image];
+		if (!slot)
+		{
+			slot.reset(new PatchContext(*image));
+			slot->setCache(cache.get());
+		}
+		PatchContext &context = *slot;
+		ChimeError error = context.setSound(sound);
+		if (error == CHIME_OK)
+		{
+			error = context.injectChime();
+		}
+
+		bool sent = (error == CHIME_OK) ?
+			sendChimeResponse(fd, CHIME_OK, context.output()) :
+			sendChimeResponse(fd, error, chimeErrorString(error));
+		if (!sent)
+		{
+			break;
+		}
+	}
+	close(fd);
+
+	lock_guard<mutex> l(clientsLock);
+	activeClients--;
+	clientLeft.notify_one();
+}
+
+static const FirmwareImage *findImage(const string &modelId)
+{
+	for (size_t x = 0; x < images.size(); x++)
+	{
+		if (modelId == images[x]->model()->id)
+		{
+			return images[x].get();
+		}
+	}
+	return NULL;
+}
+
+static void stopServer(int)
+{
+	unlink(socketPath);
+	_exit(0);
+}
+
+static void exitPrintUsage()
+{
+	cerr << "usage: " << programName << " [--cache-dir=dir] [--max-clients=N] [--idle-timeout=seconds] <socket path> <firmware file> [<firmware file> ...]" << endl;
+	exit(1);
+}
@@ -0,0 +1,10 @@
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include "../util/inject_chime_main.h"
+
+int main(int argc, char *argv[])
+{
+	// No model given, so figure it out from the firmware file
+	return injectChimeMain(argc, argv, NULL);
+}
@@ -1,24 +1,217 @@
 #include "adler32.h"
+#include "cpu_dispatch.h"
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+#endif
 
 // Borrowed from Wikipedia page on Adler-32:
 // http://en.wikipedia.org/wiki/Adler-32
-// There are better algorithms, but I don't care about bad performance...
 // This code is public domain.
+//
+// The kernels below are the same algorithm, just with the modulo deferred: NMAX is the most
+// bytes that can be summed before b could overflow 32 bits (same trick as zlib). The SIMD
+// variants split each block into vector-sized chunks; within a chunk, byte i contributes
+// (chunk size - i) times to b, which is a multiply-add against a constant vector of weights.
 
-static const int MOD_ADLER = 65521;
+static const uint32_t MOD_ADLER = 65521;
+static const size_t NMAX = 5552;
 
 uint32_t adler32(const std::string &s, size_t len)
 {
-	unsigned long a = 1, b = 0;
-	int x;
 	if (len == 0) len = s.length(); // if len is 0, do the entire string
-	
-	for (x = 0; x < len; x++)
+	return adler32Update(1, s.data(), len);
+}
+
+uint32_t adler32Update(uint32_t adler, const char *data, size_t len)
+{
+	return kernels().adler32(adler, reinterpret_cast<const unsigned char *>(data), len);
+}
+
+uint32_t adler32Fill(uint32_t adler, uint8_t byte, size_t count)
+{
+	// Each of the count bytes adds byte to a, and b picks up a after every one of them:
+	// b += count * a + byte * (1 + 2 + ... + count)
+	uint64_t n = count % MOD_ADLER; // everything below only depends on count mod 65521
+	uint64_t a = adler & 0xFFFF;
+	uint64_t b = adler >> 16;
+	uint64_t triangle = (n * (n + 1) / 2) % MOD_ADLER;
+	b = (b + n * a + byte * triangle) % MOD_ADLER;
+	a = (a + n * byte) % MOD_ADLER;
+	return static_cast<uint32_t>((b << 16) | a);
+}
+
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+	// The second block's sums started from a = 1, b = 0 instead of where the first one left
+	// off, so its a is short by (a1 - 1) and its b by len2 * (a1 - 1)
+	uint64_t n = len2 % MOD_ADLER;
+	uint64_t a1 = adler1 & 0xFFFF;
+	uint64_t b1 = adler1 >> 16;
+	uint64_t a2 = adler2 & 0xFFFF;
+	uint64_t b2 = adler2 >> 16;
+	uint64_t a = (a1 + a2 + MOD_ADLER - 1) % MOD_ADLER;
+	uint64_t b = (b1 + b2 + n * a1 + MOD_ADLER - n) % MOD_ADLER;
+	return static_cast<uint32_t>((b << 16) | a);
+}
+
+uint32_t adler32Replace(uint32_t adler, size_t len, size_t pos, const char *oldBytes, const char *newBytes,
+						size_t count)
+{
+	// The byte at pos adds to a once, and to b once for itself and every byte after it
+	uint64_t a = adler & 0xFFFF;
+	uint64_t b = adler >> 16;
+	for (size_t x = 0; x < count; x++)
+	{
+		uint64_t oldByte = static_cast<unsigned char>(oldBytes[x]);
+		uint64_t newByte = static_cast<unsigned char>(newBytes[x]);
+		uint64_t weight = (len - pos - x) % MOD_ADLER;
+		a = (a + MOD_ADLER - oldByte + newByte) % MOD_ADLER;
+		b = (b + (MOD_ADLER - oldByte + newByte) * weight) % MOD_ADLER;
+	}
+	return static_cast<uint32_t>((b << 16) | a);
+}
+
+uint32_t adler32Scalar(uint32_t adler, const unsigned char *data, size_t len)
+{
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (len > 0)
 	{
-		a = (a + static_cast<unsigned char>(s[x])) % MOD_ADLER;
-		b = (b + a) % MOD_ADLER;
+		size_t blockLen = (len < NMAX) ? len : NMAX;
+		len -= blockLen;
+		while (blockLen--)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= MOD_ADLER;
+		b %= MOD_ADLER;
 	}
-	
 	return (b << 16) | a;
 }
 
+#ifdef KERNELS_X86
+
+TARGET_SSE41 uint32_t adler32Sse41(uint32_t adler, const unsigned char *data, size_t len)
+{
+	const size_t CHUNK = 16;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	while (len >= CHUNK)
+	{
+		size_t chunks = len / CHUNK;
+		if (chunks > NMAX / CHUNK) chunks = NMAX / CHUNK;
+		len -= chunks * CHUNK;
+
+		// prevA collects a at the start of every chunk; each of those adds CHUNK times to b
+		__m128i prevA = _mm_setr_epi32(a * chunks, 0, 0, 0);
+		__m128i sumA = zero;
+		__m128i sumB = _mm_setr_epi32(b, 0, 0, 0);
+		while (chunks--)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+			prevA = _mm_add_epi32(prevA, sumA);
+			sumA = _mm_add_epi32(sumA, _mm_sad_epu8(bytes, zero));
+			sumB = _mm_add_epi32(sumB, _mm_madd_epi16(_mm_maddubs_epi16(bytes, weights), ones));
+			data += CHUNK;
+		}
+		sumB = _mm_add_epi32(sumB, _mm_slli_epi32(prevA, 4));
+
+		// Add up the lanes
+		sumA = _mm_add_epi32(sumA, _mm_shuffle_epi32(sumA, _MM_SHUFFLE(1, 0, 3, 2)));
+		sumB = _mm_add_epi32(sumB, _mm_shuffle_epi32(sumB, _MM_SHUFFLE(1, 0, 3, 2)));
+		sumB = _mm_add_epi32(sumB, _mm_shuffle_epi32(sumB, _MM_SHUFFLE(2, 3, 0, 1)));
+		a = (a + static_cast<uint32_t>(_mm_cvtsi128_si32(sumA))) % MOD_ADLER;
+		b = static_cast<uint32_t>(_mm_cvtsi128_si32(sumB)) % MOD_ADLER;
+	}
+
+	return adler32Scalar((b << 16) | a, data, len);
+}
+
+TARGET_AVX2 uint32_t adler32Avx2(uint32_t adler, const unsigned char *data, size_t len)
+{
+	const size_t CHUNK = 32;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+
+	while (len >= CHUNK)
+	{
+		size_t chunks = len / CHUNK;
+		if (chunks > NMAX / CHUNK) chunks = NMAX / CHUNK;
+		len -= chunks * CHUNK;
+
+		__m256i prevA = _mm256_setr_epi32(a * chunks, 0, 0, 0, 0, 0, 0, 0);
+		__m256i sumA = zero;
+		__m256i sumB = _mm256_setr_epi32(b, 0, 0, 0, 0, 0, 0, 0);
+		while (chunks--)
+		{
+			__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+			prevA = _mm256_add_epi32(prevA, sumA);
+			sumA = _mm256_add_epi32(sumA, _mm256_sad_epu8(bytes, zero));
+			sumB = _mm256_add_epi32(sumB, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+			data += CHUNK;
+		}
+		sumB = _mm256_add_epi32(sumB, _mm256_slli_epi32(prevA, 5));
+
+		// Add up the lanes
+		__m128i a128 = _mm_add_epi32(_mm256_castsi256_si128(sumA), _mm256_extracti128_si256(sumA, 1));
+		__m128i b128 = _mm_add_epi32(_mm256_castsi256_si128(sumB), _mm256_extracti128_si256(sumB, 1));
+		a128 = _mm_add_epi32(a128, _mm_shuffle_epi32(a128, _MM_SHUFFLE(1, 0, 3, 2)));
+		b128 = _mm_add_epi32(b128, _mm_shuffle_epi32(b128, _MM_SHUFFLE(1, 0, 3, 2)));
+		b128 = _mm_add_epi32(b128, _mm_shuffle_epi32(b128, _MM_SHUFFLE(2, 3, 0, 1)));
+		a = (a + static_cast<uint32_t>(_mm_cvtsi128_si32(a128))) % MOD_ADLER;
+		b = static_cast<uint32_t>(_mm_cvtsi128_si32(b128)) % MOD_ADLER;
+	}
+
+	return adler32Scalar((b << 16) | a, data, len);
+}
+
+TARGET_AVX512 uint32_t adler32Avx512(uint32_t adler, const unsigned char *data, size_t len)
+{
+	const size_t CHUNK = 64;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	const __m512i weights = _mm512_set_epi8(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+		17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+		33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+		49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64);
+	const __m512i ones = _mm512_set1_epi16(1);
+	const __m512i zero = _mm512_setzero_si512();
+
+	while (len >= CHUNK)
+	{
+		size_t chunks = len / CHUNK;
+		if (chunks > NMAX / CHUNK) chunks = NMAX / CHUNK;
+		len -= chunks * CHUNK;
+
+		__m512i prevA = _mm512_maskz_set1_epi32(1, a * chunks);
+		__m512i sumA = zero;
+		__m512i sumB = _mm512_maskz_set1_epi32(1, b);
+		while (chunks--)
+		{
+			__m512i bytes = _mm512_loadu_si512(data);
+			prevA = _mm512_add_epi32(prevA, sumA);
+			sumA = _mm512_add_epi32(sumA, _mm512_sad_epu8(bytes, zero));
+			sumB = _mm512_add_epi32(sumB, _mm512_madd_epi16(_mm512_maddubs_epi16(bytes, weights), ones));
+			data += CHUNK;
+		}
+		sumB = _mm512_add_epi32(sumB, _mm512_slli_epi32(prevA, 6));
+
+		a = (a + static_cast<uint32_t>(_mm512_reduce_add_epi32(sumA))) % MOD_ADLER;
+		b = static_cast<uint32_t>(_mm512_reduce_add_epi32(sumB)) % MOD_ADLER;
+	}
+
+	return adler32Scalar((b << 16) | a, data, len);
+}
+
+#endif // KERNELS_X86
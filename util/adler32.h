@@ -6,11 +6,19 @@
 
 // Borrowed from Wikipedia page on Adler-32:
 // http://en.wikipedia.org/wiki/Adler-32
-// There are better algorithms, but I don't care about bad performance...
 // This code is public domain.
 
 // Calculate adler32 of a string. Optionally supply a length
 // to stop at.
 uint32_t adler32(const std::string &s, size_t len = 0);
+// Continues a running adler32 (start with 1) over len more bytes
+uint32_t adler32Update(uint32_t adler, const char *data, size_t len);
+// Continues a running adler32 over count copies of the same byte, without looping
+uint32_t adler32Fill(uint32_t adler, uint8_t byte, size_t count);
+// Combines the adler32 of one block of data with the adler32 of the len2 bytes following it
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2);
+// Adjusts the adler32 of a len byte block for count bytes at pos changing from oldBytes to newBytes
+uint32_t adler32Replace(uint32_t adler, size_t len, size_t pos, const char *oldBytes, const char *newBytes,
+						size_t count);
 
 #endif // ADLER_H
@@ -0,0 +1,97 @@
+#include "stats.h"
+#include <cstdlib>
+#include <new>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Replaces the global allocation functions so that StageTimer can count heap allocations.
+// This is deliberately not part of libchimepatch.a: a library has no business taking over the
+// allocator of every program that links it. A program that wants allocation counts (like
+// inject_chime and chime_bench) links alloc_counter.o itself. Without it, the stats report the
+// allocations as unknown.
+
+using namespace std;
+
+// Lets the stats know that allocations are being counted
+static struct AllocationCounting
+{
+	AllocationCounting() { enableAllocationCounting(); }
+} allocationCounting;
+
+static void *countedAlloc(size_t size)
+{
+	countAllocation();
+	return malloc(size ? size : 1);
+}
+
+static void *countedAlignedAlloc(size_t size, align_val_t alignment)
+{
+	countAllocation();
+	size_t align = static_cast<size_t>(alignment);
+	if (align < sizeof(void *)) align = sizeof(void *);
+	void *p;
+	return (posix_memalign(&p, align, size ? size : 1) == 0) ? p : NULL;
+}
+
+void *operator new(size_t size)
+{
+	void *p = countedAlloc(size);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	void *p = countedAlloc(size);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+	return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+	return countedAlloc(size);
+}
+
+void *operator new(size_t size, align_val_t alignment)
+{
+	void *p = countedAlignedAlloc(size, alignment);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size, align_val_t alignment)
+{
+	void *p = countedAlignedAlloc(size, alignment);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	return countedAlignedAlloc(size, alignment);
+}
+
+void *operator new[](size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	return countedAlignedAlloc(size, alignment);
+}
+
+// Everything above comes from malloc or posix_memalign, so it all goes back with free
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete(void *p, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { free(p); }
+void operator delete(void *p, align_val_t, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, align_val_t, const nothrow_t &) noexcept { free(p); }
@@ -1,5 +1,6 @@
 #include "ascii85.h"
-#include <iostream>
+#include "cpu_dispatch.h"
+#include "kernels.h"
 #include <stdint.h>
 
 // By Doug Brown
@@ -12,27 +13,54 @@ static const uint32_t pow85[] = {85U*85U*85U*85U, 85U*85U*85U, 85U*85U, 85U, 1};
 string dc85(const string &s)
 {
 	string retval;
-	
+	if (!dc85(s.data(), s.length(), retval))
+	{
+		return ""; // "" indicates invalid decode
+	}
+	return retval;
+}
+
+bool dc85(const char *s, size_t len, string &output)
+{
+	return kernels().dc85(s, len, output);
+}
+
+size_t ec85(const std::string &s, std::string &output, size_t offset, size_t maxStringLen)
+{
+	output.clear();
+	return ec85Append(s, output, offset, maxStringLen);
+}
+
+size_t ec85Append(const std::string &s, std::string &output, size_t offset, size_t maxStringLen)
+{
+	return kernels().ec85Append(s, output, offset, maxStringLen);
+}
+
+// The kernels. There's no sensible way to spread Ascii85 across vector lanes ('z' and 'y'
+// make every group a different length), so there's only a scalar version, and every level's
+// table uses it.
+bool dc85Scalar(const char *s, size_t len, string &output)
+{
 	size_t curPos = 0;
-	while (curPos < s.length())
+	while (curPos < len)
 	{
 		char c = s[curPos];
 		if (c == 'z') // a "z" represents four zero bytes
 		{
-			retval.append("\x00\x00\x00\x00", 4);
+			output.append("\x00\x00\x00\x00", 4);
 			curPos++;
 		}
 		else if (c == 'y') // a "y" represents four 0xFF bytes in Apple's version instead of the typical 0x20
 		{
-			retval.append("\xFF\xFF\xFF\xFF", 4);
+			output.append("\xFF\xFF\xFF\xFF", 4);
 			curPos++;
 		}
 		else // any other character represents the start of a 5-character string representing 4 characters
 		{
-			if ((curPos + 5) > s.length())
+			// A group cut short is invalid (the caller reports it)
+			if ((curPos + 5) > len)
 			{
-				cerr << "Invalid Ascii85 format during decode" << endl;
-				return ""; // "" indicates invalid decode
+				return false;
 			}
 			
 			// Read five characters, translate from printable range to actual range
@@ -42,31 +70,31 @@ string dc85(const string &s)
 				char b = s[curPos + x];
 				if ((b < '!') || (b > 'u'))
 				{
-					cerr << "Invalid Ascii85 format during decode" << endl;
-					return ""; // "" indicates invalid decode
+					return false;
 				}
 				val += pow85[x] * static_cast<uint32_t>(b - '!');
 			}
 			
 			// Now pull the bytes out one by one and spit them out in order, big endian
+			char bytes[4];
 			for (int x = 3; x >= 0; x--)
 			{
-				char b = (val >> (x*8)) & 0xFF;
-				retval.append(&b, 1);
+				bytes[3 - x] = (val >> (x*8)) & 0xFF;
 			}
+			output.append(bytes, 4);
 			
 			// We used 5 characters from the buffer to do this
 			curPos += 5;
 		}
 	}
 	
-	return retval;
+	return true;
 }
 
-size_t ec85(const std::string &s, std::string &output, size_t offset, size_t maxStringLen)
+size_t ec85AppendScalar(const string &s, string &output, size_t offset, size_t maxStringLen)
 {
-	output.clear();
 	if (maxStringLen == 0) maxStringLen = 0xFFFFFFFFUL; // 0 means go forever. This is close enough.
+	maxStringLen += output.length(); // only count what we append
 	size_t charsEncoded = 0;
 	while ((offset < s.length()) && (output.length() < maxStringLen))
 	{
@@ -118,10 +146,12 @@ size_t ec85(const std::string &s, std::string &output, size_t offset, size_t max
 			}
 			
 			// Now save them in reverse order
+			char reversed[5];
 			for (int x = 4; x >= 0; x--)
 			{
-				output.append(1, bytes[x]);
+				reversed[4 - x] = bytes[x];
 			}
+			output.append(reversed, 5);
 		}
 			
 		// We encoded 4 bytes successfully
@@ -132,4 +162,3 @@ size_t ec85(const std::string &s, std::string &output, size_t offset, size_t max
 	// Return number of characters encoded
 	return charsEncoded;
 }
-
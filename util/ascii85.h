@@ -8,10 +8,16 @@
 
 // Decodes provided string from Ascii85 format
 std::string dc85(const std::string &s);
+// Decodes len characters of Ascii85 starting at s, appending the result to output.
+// Returns false if the input isn't valid Ascii85.
+bool dc85(const char *s, size_t len, std::string &output);
 // Encodes provided string, starting at offset, into Ascii85. If maxStringLen > 0, only encodes
 // enough data to print that many characters in Ascii85 format. Useful for formatting the encoded
 // data at a max column width. Returns number of characters encoded (0 if problem).
 size_t ec85(const std::string &s, std::string &output, size_t offset = 0, size_t maxStringLen = 0);
+// Same as ec85, but appends to output instead of replacing it. maxStringLen only counts
+// the characters appended by this call.
+size_t ec85Append(const std::string &s, std::string &output, size_t offset = 0, size_t maxStringLen = 0);
 
 #endif // ASCII85_H
 
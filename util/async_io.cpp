@@ -0,0 +1,470 @@
+#include "async_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Biggest single read or write handed to the kernel
+static const size_t MAX_TRANSFER = 1 << 30;
+// Threads doing blocking I/O for the fallback backend
+static const unsigned MAX_IO_THREADS = 8;
+// How many times a submission the kernel is too busy for is tried (a millisecond apart)
+static const int MAX_BUSY_RETRIES = 100;
+
+static const char *const BACKEND_NAMES[] = {"auto", "io_uring", "threads", "blocking"};
+
+// One file being read or written
+struct AsyncFileIo::Request
+{
+	string path;
+	bool writing;
+	string *readBuf;
+	const string *writeBuf;
+	int fd;
+	size_t length;
+	size_t done;
+	Callback callback;
+
+	char *data() { return writing ? const_cast<char *>(writeBuf->data()) : &(*readBuf)[0]; }
+};
+
+#ifdef __linux__
+// An io_uring instance: the submission and completion rings shared with the kernel
+struct AsyncFileIo::Ring
+{
+	Ring() : fd(-1), sqMap(MAP_FAILED), cqMap(MAP_FAILED), sqes(static_cast<io_uring_sqe *>(MAP_FAILED)), broken(false) {}
+	~Ring();
+	bool setup(unsigned entries);
+	bool enqueue(const io_uring_sqe &sqe); // hands one entry to the kernel; submitLock has to be held
+
+	int fd;
+	io_uring_params params;
+	void *sqMap;
+	void *cqMap;
+	size_t sqMapSize;
+	size_t cqMapSize;
+	io_uring_sqe *sqes;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	io_uring_cqe *cqes;
+	mutex submitLock;
+	bool broken; // the kernel stopped taking or completing requests, so nothing more goes in
+	mutex requestsLock;
+	unordered_set<Request *> submitted; // requests the kernel has, that haven't completed yet
+};
+
+bool AsyncFileIo::Ring::setup(unsigned entries)
+{
+	memset(&params, 0, sizeof(params));
+	fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	// Older kernels map the two rings separately
+	sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap)
+	{
+		sqMapSize = cqMapSize = (sqMapSize > cqMapSize) ? sqMapSize : cqMapSize;
+	}
+	sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sqMap == MAP_FAILED)
+	{
+		return false;
+	}
+	cqMap = singleMap ? sqMap :
+		mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	void *sqeMap = mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (cqMap == MAP_FAILED || sqeMap == MAP_FAILED)
+	{
+		return false;
+	}
+	sqes = static_cast<io_uring_sqe *>(sqeMap);
+
+	char *sq = static_cast<char *>(sqMap);
+	char *cq = static_cast<char *>(cqMap);
+	sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+	return true;
+}
+
+bool AsyncFileIo::Ring::enqueue(const io_uring_sqe &sqe)
+{
+	unsigned tail = *sqTail;
+	unsigned index = tail & *sqMask;
+	sqes[index] = sqe;
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	int busyTries = 0;
+	while (syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0) < 0)
+	{
+		// Interrupted, or the kernel is short of something for the moment. Anything else won't
+		// get better by trying again.
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if ((errno == EAGAIN || errno == EBUSY) && ++busyTries < MAX_BUSY_RETRIES)
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+		break;
+	}
+
+	// An entry the kernel didn't take would go with the next submission, long after whoever
+	// it was for has given up on it, so it's taken back out
+	if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) != tail + 1)
+	{
+		__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+		return false;
+	}
+	return true;
+}
+
+AsyncFileIo::Ring::~Ring()
+{
+	if (sqes != MAP_FAILED) munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+	if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapSize);
+	if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+	if (fd >= 0) close(fd);
+}
+#else
+// No io_uring here; the threads backend is always used
+struct AsyncFileIo::Ring
+{
+	bool setup(unsigned) { return false; }
+};
+#endif
+
+const char *asyncIoBackendName(AsyncIoBackend backend)
+{
+	return (backend >= ASYNC_IO_AUTO && backend <= ASYNC_IO_BLOCKING) ? BACKEND_NAMES[backend] : "unknown";
+}
+
+bool parseAsyncIoBackend(const string &name, AsyncIoBackend &backend)
+{
+	for (int x = ASYNC_IO_AUTO; x <= ASYNC_IO_BLOCKING; x++)
+	{
+		if (name == BACKEND_NAMES[x])
+		{
+			backend = static_cast<AsyncIoBackend>(x);
+			return true;
+		}
+	}
+	return false;
+}
+
+AsyncFileIo::AsyncFileIo(AsyncIoBackend backend, unsigned queueDepth) :
+	activeBackend(ASYNC_IO_THREADS),
+	maxInFlight(queueDepth > 0 ? queueDepth : 1),
+	inFlight(0),
+	pending(0)
+{
+	if (backend == ASYNC_IO_AUTO || backend == ASYNC_IO_URING)
+	{
+		ring.reset(new Ring);
+		if (ring->setup(maxInFlight))
+		{
+			activeBackend = ASYNC_IO_URING;
+			reaper = thread(&AsyncFileIo::reap, this);
+			return;
+		}
+		ring.reset();
+	}
+	ioThreads.reset(new ThreadPool(maxInFlight < MAX_IO_THREADS ? maxInFlight : MAX_IO_THREADS));
+}
+
+AsyncFileIo::~AsyncFileIo()
+{
+	wait();
+#ifdef __linux__
+	if (ring)
+	{
+		// A no-op with no request attached tells the completion thread to stop (unless it
+		// already has, because the ring broke)
+		{
+			lock_guard<mutex> l(ring->submitLock);
+			if (!ring->broken)
+			{
+				io_uring_sqe sqe;
+				memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = IORING_OP_NOP;
+				ring->enqueue(sqe);
+			}
+		}
+		reaper.join();
+	}
+#endif
+}
+
+void AsyncFileIo::read(const string &path, string &buf, Callback done)
+{
+	Request *request = new Request;
+	request->path = path;
+	request->fd = -1;
+	request->writing = false;
+	request->readBuf = &buf;
+	request->writeBuf = NULL;
+	request->callback = done;
+	start(request);
+}
+
+void AsyncFileIo::write(const string &path, const string &buf, Callback done)
+{
+	Request *request = new Request;
+	request->path = path;
+	request->fd = -1;
+	request->writing = true;
+	request->readBuf = NULL;
+	request->writeBuf = &buf;
+	request->callback = done;
+	start(request);
+}
+
+void AsyncFileIo::wait()
+{
+	unique_lock<mutex> l(stateLock);
+	allDone.wait(l, [this] { return pending == 0; });
+}
+
+void AsyncFileIo::start(Request *request)
+{
+	{
+		unique_lock<mutex> l(stateLock);
+		roomAvailable.wait(l, [this] { return inFlight < maxInFlight; });
+		inFlight++;
+		pending++;
+	}
+
+	// The threads backend does the whole thing on one of its threads
+	if (ioThreads)
+	{
+		ioThreads->submit([this, request]()
+		{
+			if (!openFile(request))
+			{
+				finish(request, ASYNC_IO_OPEN_FAILED);
+				return;
+			}
+			while (request->done < request->length)
+			{
+				size_t len = request->length - request->done;
+				ssize_t result = request->writing ?
+					pwrite(request->fd, request->data() + request->done, len, request->done) :
+					pread(request->fd, request->data() + request->done, len, request->done);
+				if (result < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (result <= 0)
+				{
+					finish(request, ASYNC_IO_FAILED);
+					return;
+				}
+				request->done += result;
+			}
+			finish(request, ASYNC_IO_OK);
+		});
+		return;
+	}
+
+	// io_uring: opening is quick, so that's done right here, and only the transfer is queued
+	if (!openFile(request))
+	{
+		finish(request, ASYNC_IO_OPEN_FAILED);
+		return;
+	}
+	if (request->length == 0)
+	{
+		finish(request, ASYNC_IO_OK);
+		return;
+	}
+	submit(request);
+}
+
+bool AsyncFileIo::openFile(Request *request)
+{
+	request->done = 0;
+	request->length = 0;
+	if (request->writing)
+	{
+		request->fd = open(request->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		request->length = request->writeBuf->length();
+		return request->fd >= 0;
+	}
+
+	request->fd = open(request->path.c_str(), O_RDONLY);
+	struct stat st;
+	if (request->fd < 0 || fstat(request->fd, &st) != 0)
+	{
+		return false;
+	}
+	request->readBuf->resize(st.st_size);
+	request->length = st.st_size;
+	return true;
+}
+
+void AsyncFileIo::submit(Request *request)
+{
+#ifdef __linux__
+	io_uring_sqe sqe;
+	size_t len = request->length - request->done;
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = request->writing ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe.fd = request->fd;
+	sqe.addr = reinterpret_cast<uint64_t>(request->data() + request->done);
+	sqe.len = static_cast<uint32_t>(len < MAX_TRANSFER ? len : MAX_TRANSFER);
+	sqe.off = request->done;
+	sqe.user_data = reinterpret_cast<uint64_t>(request);
+	bool queued = false;
+	{
+		// It's noted before the kernel gets it, since it could complete straight away
+		lock_guard<mutex> l(ring->submitLock);
+		if (!ring->broken)
+		{
+			{
+				lock_guard<mutex> requestsLock(ring->requestsLock);
+				ring->submitted.insert(request);
+			}
+			queued = ring->enqueue(sqe);
+			if (!queued)
+			{
+				lock_guard<mutex> requestsLock(ring->requestsLock);
+				ring->submitted.erase(request);
+			}
+		}
+	}
+	// Nothing is coming back for a request the kernel didn't take
+	if (!queued)
+	{
+		finish(request, ASYNC_IO_FAILED);
+	}
+#else
+	(void)request;
+#endif
+}
+
+void AsyncFileIo::finish(Request *request, AsyncIoResult result)
+{
+	if (request->fd >= 0)
+	{
+		close(request->fd);
+	}
+	Callback callback;
+	callback.swap(request->callback);
+	delete request;
+
+	// Make room before calling back, in case the callback leads to more I/O
+	{
+		lock_guard<mutex> l(stateLock);
+		inFlight--;
+	}
+	roomAvailable.notify_one();
+	callback(result);
+	lock_guard<mutex> l(stateLock);
+	if (--pending == 0)
+	{
+		allDone.notify_all();
+	}
+}
+
+void AsyncFileIo::reap()
+{
+#ifdef __linux__
+	while (true)
+	{
+		// Only this thread moves the head, so it can be read without a barrier
+		unsigned head = *ring->cqHead;
+		if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+		{
+			if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+				errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				failSubmitted();
+				return;
+			}
+			continue;
+		}
+		io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+		__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+		Request *request = reinterpret_cast<Request *>(cqe.user_data);
+		if (!request)
+		{
+			return;
+		}
+		{
+			lock_guard<mutex> l(ring->requestsLock);
+			ring->submitted.erase(request);
+		}
+		if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+		{
+			submit(request);
+		}
+		else if (cqe.res <= 0)
+		{
+			// An error, or the file got shorter while we were reading it
+			finish(request, ASYNC_IO_FAILED);
+		}
+		else if ((request->done += cqe.res) < request->length)
+		{
+			// A short read or write; carry on from where it stopped
+			submit(request);
+		}
+		else
+		{
+			finish(request, ASYNC_IO_OK);
+		}
+	}
+#endif
+}
+
+void AsyncFileIo::failSubmitted()
+{
+#ifdef __linux__
+	// Once nothing else can go in, whatever the kernel still has is never coming back
+	{
+		lock_guard<mutex> l(ring->submitLock);
+		ring->broken = true;
+	}
+	unordered_set<Request *> lost;
+	{
+		lock_guard<mutex> l(ring->requestsLock);
+		lost.swap(ring->submitted);
+	}
+	for (unordered_set<Request *>::iterator it = lost.begin(); it != lost.end(); ++it)
+	{
+		finish(*it, ASYNC_IO_FAILED);
+	}
+#endif
+}
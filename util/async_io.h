@@ -0,0 +1,87 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Reads and writes whole files in the background, with lots of them in flight at once, so
+// that batch mode's file I/O overlaps with patching instead of taking turns with it. On Linux
+// this uses io_uring (through the raw system calls, so there's nothing extra to link). Where
+// io_uring isn't available (an older kernel, or a sandbox that blocks it) it falls back to a
+// few threads doing ordinary blocking I/O.
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "thread_pool.h"
+
+enum AsyncIoBackend
+{
+	ASYNC_IO_AUTO = 0, // io_uring if it works here, otherwise threads
+	ASYNC_IO_URING,
+	ASYNC_IO_THREADS,
+	ASYNC_IO_BLOCKING // no background I/O at all (only meaningful to runBatch)
+};
+
+// Name of a backend as used by --io= ("auto", "io_uring", "threads", "blocking")
+const char *asyncIoBackendName(AsyncIoBackend backend);
+// Looks up a backend by name
+bool parseAsyncIoBackend(const std::string &name, AsyncIoBackend &backend);
+
+enum AsyncIoResult
+{
+	ASYNC_IO_OK = 0,
+	ASYNC_IO_OPEN_FAILED, // the file couldn't be opened (or created)
+	ASYNC_IO_FAILED // reading or writing it failed
+};
+
+class AsyncFileIo
+{
+public:
+	// Called when a read or write finishes, on an I/O thread. It should hand anything slow off
+	// to another thread (which can start more I/O) rather than starting more I/O itself.
+	typedef std::function<void(AsyncIoResult result)> Callback;
+
+	// backend can't be ASYNC_IO_BLOCKING. Asking for io_uring when it isn't available gets
+	// threads instead; backend() says which one is in use. At most queueDepth files are in
+	// flight at once; read() and write() wait for room.
+	explicit AsyncFileIo(AsyncIoBackend backend = ASYNC_IO_AUTO, unsigned queueDepth = 64);
+	~AsyncFileIo(); // waits for everything in flight
+
+	AsyncIoBackend backend() const { return activeBackend; }
+
+	// Replaces the contents of buf with the contents of the file. buf has to stay put until
+	// done is called.
+	void read(const std::string &path, std::string &buf, Callback done);
+	// Replaces the contents of the file with buf, which has to stay put until done is called
+	void write(const std::string &path, const std::string &buf, Callback done);
+	// Blocks until nothing is in flight
+	void wait();
+
+private:
+	struct Request;
+	struct Ring;
+
+	void start(Request *request); // waits for room, then gets the request going
+	bool openFile(Request *request); // opens the file and works out how much there is to transfer
+	void submit(Request *request); // queues a read or write of whatever is left of the request
+	void finish(Request *request, AsyncIoResult result); // closes the file and calls back
+	void reap(); // the io_uring completion thread
+	void failSubmitted(); // gives up on a broken ring, failing every request still in it
+
+	AsyncIoBackend activeBackend;
+	unsigned maxInFlight;
+	std::unique_ptr<Ring> ring; // io_uring only
+	std::unique_ptr<ThreadPool> ioThreads; // threads only
+	std::thread reaper;
+	std::mutex stateLock;
+	std::condition_variable roomAvailable;
+	std::condition_variable allDone;
+	unsigned inFlight; // files being read or written
+	unsigned pending; // same, plus callbacks still running
+};
+
+#endif // ASYNC_IO_H
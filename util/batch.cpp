@@ -0,0 +1,251 @@
+#include "batch.h"
+#include "files.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+bool readBatchManifest(const char *filename, vector<BatchJob> &jobs)
+{
+	string manifest;
+	if (!readFile(filename, manifest))
+	{
+		return false;
+	}
+
+	size_t curPos = 0;
+	while (curPos < manifest.length())
+	{
+		size_t endLinePos = manifest.find('\n', curPos);
+		if (endLinePos == string::npos) endLinePos = manifest.length();
+		string line = manifest.substr(curPos, endLinePos - curPos);
+		curPos = endLinePos + 1;
+
+		// Tolerate DOS line endings
+		if (!line.empty() && line[line.length() - 1] == '\r')
+		{
+			line.erase(line.length() - 1);
+		}
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		size_t split = line.find('\t');
+		if (split == string::npos) split = line.find(' ');
+		if (split == string::npos || split == 0 || split + 1 >= line.length())
+		{
+			return false;
+		}
+
+		BatchJob job;
+		job.soundFile = line.substr(0, split);
+		job.outputFile = line.substr(split + 1);
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
+// One job working its way through the read, patch and write stages
+struct BatchSlot
+{
+	size_t job;
+	string sound;
+	string output;
+	bool cached;
+};
+
+// Runs the jobs one after another on each patching thread, reading and writing with ordinary blocking I/O
+static void runBlockingBatch(ThreadPool &pool, vector<unique_ptr<PatchContext> > &contexts, const vector<BatchJob> &jobs,
+							 bool quiet, mutex &outputLock, atomic<size_t> &failures);
+// Keeps reads and writes in flight in the background while the patching threads work on other jobs
+static void runAsyncBatch(ThreadPool &pool, vector<unique_ptr<PatchContext> > &contexts, const vector<BatchJob> &jobs,
+						  AsyncFileIo &io, bool quiet, mutex &outputLock, atomic<size_t> &failures);
+// Prints how a job went
+static void reportJob(const BatchJob &job, ChimeError error, const string &failedFile, bool cached, bool quiet,
+					  mutex &outputLock, atomic<size_t> &failures);
+
+size_t runBatch(const FirmwareImage &base, const vector<BatchJob> &jobs, const BatchOptions &options)
+{
+	mutex outputLock;
+	atomic<size_t> failures(0);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	ThreadPool pool(options.numThreads);
+
+	// Each worker gets its own context, reused for every job it runs; the firmware image is
+	// shared read-only
+	vector<unique_ptr<PatchContext> > contexts;
+	for (unsigned x = 0; x < pool.size(); x++)
+	{
+		contexts.emplace_back(new PatchContext(base));
+		contexts.back()->setCache(options.cache);
+		contexts.back()->setDeltaIndex(options.deltaIndex);
+	}
+
+	AsyncIoBackend backend = ASYNC_IO_BLOCKING;
+	if (options.io == ASYNC_IO_BLOCKING)
+	{
+		runBlockingBatch(pool, contexts, jobs, options.quiet, outputLock, failures);
+	}
+	else
+	{
+		// Enough jobs in flight that every thread has one to patch while the next ones are
+		// being read and the last ones written
+		AsyncFileIo io(options.io, pool.size() * 4);
+		backend = io.backend();
+		runAsyncBatch(pool, contexts, jobs, io, options.quiet, outputLock, failures);
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (!options.quiet)
+	{
+		cout << "Patched " << (jobs.size() - failures) << " of " << jobs.size() << " variants in " <<
+			(seconds * 1000.0) << " ms on " << pool.size() << " threads with " << asyncIoBackendName(backend) <<
+			" I/O (" << (seconds > 0 ? jobs.size() / seconds : 0) << " variants/s)." << endl;
+	}
+
+	return failures;
+}
+
+static void runBlockingBatch(ThreadPool &pool, vector<unique_ptr<PatchContext> > &contexts, const vector<BatchJob> &jobs,
+							 bool quiet, mutex &outputLock, atomic<size_t> &failures)
+{
+	for (size_t x = 0; x < jobs.size(); x++)
+	{
+		const BatchJob &job = jobs[x];
+		pool.submit([&contexts, &job, quiet, &outputLock, &failures]()
+		{
+			PatchContext &context = *contexts[ThreadPool::currentWorkerIndex()];
+			const string *failedFile = &job.soundFile;
+			ChimeError error = context.loadSoundFile(job.soundFile.c_str());
+			if (error == CHIME_OK)
+			{
+				failedFile = &job.outputFile;
+				error = context.openOutputFile(job.outputFile.c_str());
+			}
+			if (error == CHIME_OK)
+			{
+				error = context.injectChime();
+			}
+			if (error == CHIME_OK)
+			{
+				error = context.writeOutputFile();
+			}
+			reportJob(job, error, *failedFile, context.outputFromCache(), quiet, outputLock, failures);
+		});
+	}
+	pool.wait();
+}
+
+static void runAsyncBatch(ThreadPool &pool, vector<unique_ptr<PatchContext> > &contexts, const vector<BatchJob> &jobs,
+						  AsyncFileIo &io, bool quiet, mutex &outputLock, atomic<size_t> &failures)
+{
+	// A slot per job in flight, each with buffers that get reused from job to job
+	vector<unique_ptr<BatchSlot> > slots;
+	vector<BatchSlot *> freeSlots;
+	mutex slotLock;
+	condition_variable slotFreed;
+	for (unsigned x = 0; x < pool.size() * 4; x++)
+	{
+		slots.emplace_back(new BatchSlot);
+		freeSlots.push_back(slots.back().get());
+	}
+
+	function<void(BatchSlot *, ChimeError, const string &)> finish =
+		[&jobs, quiet, &outputLock, &failures, &freeSlots, &slotLock, &slotFreed]
+		(BatchSlot *slot, ChimeError error, const string &failedFile)
+	{
+		reportJob(jobs[slot->job], error, failedFile, slot->cached, quiet, outputLock, failures);
+		lock_guard<mutex> l(slotLock);
+		freeSlots.push_back(slot);
+		slotFreed.notify_one();
+	};
+
+	for (size_t x = 0; x < jobs.size(); x++)
+	{
+		BatchSlot *slot;
+		{
+			unique_lock<mutex> l(slotLock);
+			slotFreed.wait(l, [&freeSlots] { return !freeSlots.empty(); });
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		slot->job = x;
+		slot->cached = false;
+
+		// Read, then patch on a worker, then write; the I/O callbacks just pass the job along
+		const BatchJob &job = jobs[x];
+		io.read(job.soundFile, slot->sound, [&pool, &contexts, &io, &finish, &job, slot](AsyncIoResult result)
+		{
+			if (result != ASYNC_IO_OK)
+			{
+				finish(slot, CHIME_ERR_READ_SOUND, job.soundFile);
+				return;
+			}
+			pool.submit([&contexts, &io, &finish, &job, slot]()
+			{
+				PatchContext &context = *contexts[ThreadPool::currentWorkerIndex()];
+				ChimeError error = context.setSound(slot->sound);
+				if (error != CHIME_OK)
+				{
+					finish(slot, error, job.soundFile);
+					return;
+				}
+				error = context.injectChime();
+				if (error == CHIME_OK)
+				{
+					error = context.takeOutput(slot->output);
+				}
+				if (error != CHIME_OK)
+				{
+					finish(slot, error, job.outputFile);
+					return;
+				}
+				slot->cached = context.outputFromCache();
+				io.write(job.outputFile, slot->output, [&finish, &job, slot](AsyncIoResult result)
+				{
+					finish(slot, (result == ASYNC_IO_OK) ? CHIME_OK :
+						(result == ASYNC_IO_OPEN_FAILED) ? CHIME_ERR_OPEN_OUTPUT : CHIME_ERR_WRITE_OUTPUT, job.outputFile);
+				});
+			});
+		});
+	}
+
+	// Every slot comes back once its job is completely done. The callback that gave the last
+	// one back may still be on its way out, so wait for that too before everything it uses goes away.
+	{
+		unique_lock<mutex> l(slotLock);
+		slotFreed.wait(l, [&freeSlots, &slots] { return freeSlots.size() == slots.size(); });
+	}
+	io.wait();
+	pool.wait();
+}
+
+static void reportJob(const BatchJob &job, ChimeError error, const string &failedFile, bool cached, bool quiet,
+					  mutex &outputLock, atomic<size_t> &failures)
+{
+	lock_guard<mutex> l(outputLock);
+	if (error == CHIME_OK)
+	{
+		if (!quiet)
+		{
+			cout << "Wrote " << job.outputFile << (cached ? " (cached)" : "") << endl;
+		}
+	}
+	else
+	{
+		cerr << "\"" << failedFile << "\": " << chimeErrorString(error) << "." << endl;
+		failures++;
+	}
+}
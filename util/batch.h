@@ -0,0 +1,42 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+#include <vector>
+#include "async_io.h"
+#include "chimepatch.h"
+
+// One chime variant to produce from the shared firmware
+struct BatchJob
+{
+	std::string soundFile;
+	std::string outputFile;
+};
+
+// Reads a batch manifest: one "<sound file><TAB><output file>" pair per line. If a line has
+// no tab, it's split at the first space instead. Blank lines and lines starting with '#'
+// are ignored. Returns false if the manifest couldn't be read or a line is malformed.
+bool readBatchManifest(const char *filename, std::vector<BatchJob> &jobs);
+
+// How runBatch goes about it
+struct BatchOptions
+{
+	BatchOptions() : numThreads(0), cache(NULL), deltaIndex(NULL), io(ASYNC_IO_AUTO), quiet(false) {}
+
+	unsigned numThreads; // patching threads (0 = one per CPU)
+	const OutputCache *cache; // may be NULL
+	const DeltaIndex *deltaIndex; // if not NULL, deltas against the original are written instead of whole files
+	AsyncIoBackend io; // how sound files are read and output files written (see async_io.h)
+	bool quiet; // only report failures (no summary either)
+};
+
+// Patches every job into its own copy of the same verified, decoded firmware image, spread
+// across the patching threads. Unless options.io is ASYNC_IO_BLOCKING, the files are read and
+// written in the background, with the reads for upcoming jobs and the writes for finished ones
+// in flight while other jobs are being patched. Returns the number of jobs that failed.
+size_t runBatch(const FirmwareImage &base, const std::vector<BatchJob> &jobs, const BatchOptions &options);
+
+#endif // BATCH_H
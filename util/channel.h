@@ -0,0 +1,64 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// A bounded queue for handing things from one thread to another. Items are swapped in and
+// out rather than copied, so buffers passed back and forth keep their capacity. A producer
+// that gets too far ahead blocks until the consumer catches up.
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <class T>
+class BoundedChannel
+{
+public:
+	explicit BoundedChannel(size_t capacity) : maxItems(capacity > 0 ? capacity : 1), closed(false) {}
+
+	// Waits for room, then takes item's contents (leaving item with whatever a default T has)
+	void push(T &item)
+	{
+		std::unique_lock<std::mutex> l(lock);
+		roomAvailable.wait(l, [this] { return items.size() < maxItems; });
+		items.emplace_back();
+		items.back().swap(item);
+		itemAvailable.notify_one();
+	}
+
+	// Waits for an item and swaps it into item. Returns false once the channel has been
+	// closed and everything in it has been popped.
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> l(lock);
+		itemAvailable.wait(l, [this] { return !items.empty() || closed; });
+		if (items.empty())
+		{
+			return false;
+		}
+		item.swap(items.front());
+		items.pop_front();
+		roomAvailable.notify_one();
+		return true;
+	}
+
+	// No more items are coming; pop() returns false when it runs out
+	void close()
+	{
+		std::lock_guard<std::mutex> l(lock);
+		closed = true;
+		itemAvailable.notify_all();
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable roomAvailable;
+	std::condition_variable itemAvailable;
+	std::deque<T> items;
+	size_t maxItems;
+	bool closed;
+};
+
+#endif // CHANNEL_H
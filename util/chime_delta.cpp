@@ -0,0 +1,301 @@
+#include "chime_delta.h"
+#include "chimed_protocol.h"
+#include "md5.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static const char DELTA_MAGIC[4] = {'C', 'H', 'M', 'D'};
+static const uint32_t DELTA_VERSION = 1;
+static const size_t MD5_LENGTH = 32; // as hex digits
+
+// Runs shorter than this aren't worth a copy op, and are what the original is indexed by
+static const size_t BLOCK_SIZE = 32;
+static const uint32_t HASH_MULTIPLIER = 0x01000193;
+
+static const size_t IO_CHUNK_SIZE = 64 * 1024;
+
+static uint32_t hashBlock(const char *data); // hash of BLOCK_SIZE bytes
+static void appendUint32(string &buf, uint32_t value); // appends a big-endian uint32
+static void appendLiteral(string &delta, const string &output, size_t start, size_t end); // appends an insert op
+static bool readDeltaUint32(int fd, uint32_t &value); // reads a big-endian uint32 from the delta
+static bool copyRange(int originalFd, uint32_t offset, uint32_t length, int outputFd); // copies part of the original
+static bool hashFile(int fd, string &digest); // MD5 of an entire file, read in chunks
+
+DeltaIndex::DeltaIndex(const string &original) :
+	original(original)
+{
+	// Index the original's blocks at every BLOCK_SIZE boundary. Any run of at least
+	// 2 * BLOCK_SIZE bytes that the output shares with it contains one of them.
+	for (size_t pos = 0; pos + BLOCK_SIZE <= original.length(); pos += BLOCK_SIZE)
+	{
+		blocks.emplace(hashBlock(original.data() + pos), static_cast<uint32_t>(pos));
+	}
+}
+
+void DeltaIndex::makeDelta(const string &originalMd5, const string &output, string &delta) const
+{
+	delta.clear();
+	delta.append(DELTA_MAGIC, 4);
+	appendUint32(delta, DELTA_VERSION);
+	delta.append(originalMd5);
+	appendUint32(delta, static_cast<uint32_t>(output.length()));
+	delta.append(md5(output));
+
+	// The highest power of the multiplier in a block's hash, for rolling it along
+	uint32_t outgoingFactor = 1;
+	for (size_t x = 1; x < BLOCK_SIZE; x++)
+	{
+		outgoingFactor *= HASH_MULTIPLIER;
+	}
+
+	size_t literalStart = 0;
+	size_t pos = 0;
+	uint32_t hash = (output.length() >= BLOCK_SIZE) ? hashBlock(output.data()) : 0;
+	while (pos + BLOCK_SIZE <= output.length())
+	{
+		unordered_map<uint32_t, uint32_t>::const_iterator match = blocks.find(hash);
+		if (match != blocks.end() && memcmp(original.data() + match->second, output.data() + pos, BLOCK_SIZE) == 0)
+		{
+			// Grow the match in both directions as far as it goes
+			size_t origPos = match->second;
+			size_t outPos = pos;
+			while (outPos > literalStart && origPos > 0 && original[origPos - 1] == output[outPos - 1])
+			{
+				origPos--;
+				outPos--;
+			}
+			size_t end = pos + BLOCK_SIZE;
+			while (end < output.length() && origPos + (end - outPos) < original.length() &&
+				   original[origPos + (end - outPos)] == output[end])
+			{
+				end++;
+			}
+
+			appendLiteral(delta, output, literalStart, outPos);
+			delta.append(1, 'C');
+			appendUint32(delta, static_cast<uint32_t>(origPos));
+			appendUint32(delta, static_cast<uint32_t>(end - outPos));
+
+			literalStart = pos = end;
+			if (pos + BLOCK_SIZE <= output.length())
+			{
+				hash = hashBlock(output.data() + pos);
+			}
+			continue;
+		}
+
+		// Roll the hash along one byte
+		if (pos + BLOCK_SIZE < output.length())
+		{
+			hash = (hash - outgoingFactor * static_cast<unsigned char>(output[pos])) * HASH_MULTIPLIER +
+				static_cast<unsigned char>(output[pos + BLOCK_SIZE]);
+		}
+		pos++;
+	}
+
+	appendLiteral(delta, output, literalStart, output.length());
+	delta.append(1, 'E');
+}
+
+bool applyDelta(int originalFd, int deltaFd, int outputFd, string &error)
+{
+	// Header
+	char magic[4];
+	uint32_t version;
+	uint32_t outputLength;
+	char originalMd5[MD5_LENGTH];
+	char outputMd5[MD5_LENGTH];
+	if (!readFully(deltaFd, magic, 4) || memcmp(magic, DELTA_MAGIC, 4) != 0 ||
+		!readDeltaUint32(deltaFd, version) || version != DELTA_VERSION ||
+		!readFully(deltaFd, originalMd5, MD5_LENGTH) ||
+		!readDeltaUint32(deltaFd, outputLength) ||
+		!readFully(deltaFd, outputMd5, MD5_LENGTH))
+	{
+		error = "not a chime delta file";
+		return false;
+	}
+
+	// Make sure this delta is for this original before writing anything
+	string digest;
+	if (!hashFile(originalFd, digest))
+	{
+		error = "unable to read the original firmware file";
+		return false;
+	}
+	if (digest != string(originalMd5, MD5_LENGTH))
+	{
+		error = "the original firmware file isn't the one this delta was made from";
+		return false;
+	}
+
+	// Ops
+	if (ftruncate(outputFd, 0) != 0 || lseek(outputFd, 0, SEEK_SET) != 0)
+	{
+		error = "unable to write the output file";
+		return false;
+	}
+	vector<char> buf(IO_CHUNK_SIZE);
+	uint64_t written = 0;
+	while (true)
+	{
+		char op;
+		if (!readFully(deltaFd, &op, 1))
+		{
+			error = "delta file is truncated";
+			return false;
+		}
+		if (op == 'E')
+		{
+			break;
+		}
+		else if (op == 'C')
+		{
+			uint32_t offset, length;
+			if (!readDeltaUint32(deltaFd, offset) || !readDeltaUint32(deltaFd, length))
+			{
+				error = "delta file is truncated";
+				return false;
+			}
+			if (!copyRange(originalFd, offset, length, outputFd))
+			{
+				error = "unable to copy from the original firmware file";
+				return false;
+			}
+			written += length;
+		}
+		else if (op == 'I')
+		{
+			uint32_t length;
+			if (!readDeltaUint32(deltaFd, length))
+			{
+				error = "delta file is truncated";
+				return false;
+			}
+			written += length;
+			while (length > 0)
+			{
+				size_t chunk = (length < buf.size()) ? length : buf.size();
+				if (!readFully(deltaFd, buf.data(), chunk))
+				{
+					error = "delta file is truncated";
+					return false;
+				}
+				if (!writeFully(outputFd, buf.data(), chunk))
+				{
+					error = "unable to write the output file";
+					return false;
+				}
+				length -= chunk;
+			}
+		}
+		else
+		{
+			error = "delta file is corrupt";
+			return false;
+		}
+	}
+
+	// Check that we made exactly what the delta promised
+	if (written != outputLength || !hashFile(outputFd, digest) || digest != string(outputMd5, MD5_LENGTH))
+	{
+		error = "the rebuilt file doesn't match the delta's checksum";
+		return false;
+	}
+	return true;
+}
+
+static uint32_t hashBlock(const char *data)
+{
+	uint32_t hash = 0;
+	for (size_t x = 0; x < BLOCK_SIZE; x++)
+	{
+		hash = hash * HASH_MULTIPLIER + static_cast<unsigned char>(data[x]);
+	}
+	return hash;
+}
+
+static void appendUint32(string &buf, uint32_t value)
+{
+	char bytes[4] = {
+		static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+		static_cast<char>(value >> 8), static_cast<char>(value)
+	};
+	buf.append(bytes, 4);
+}
+
+static void appendLiteral(string &delta, const string &output, size_t start, size_t end)
+{
+	if (end > start)
+	{
+		delta.append(1, 'I');
+		appendUint32(delta, static_cast<uint32_t>(end - start));
+		delta.append(output, start, end - start);
+	}
+}
+
+static bool readDeltaUint32(int fd, uint32_t &value)
+{
+	unsigned char bytes[4];
+	if (!readFully(fd, bytes, 4)) return false;
+	value = (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+	return true;
+}
+
+static bool copyRange(int originalFd, uint32_t offset, uint32_t length, int outputFd)
+{
+	off_t inOffset = offset;
+#ifdef __linux__
+	// Let the kernel do it if it can (no copying through userspace, and reflinks on
+	// filesystems that support them)
+	loff_t copyOffset = inOffset;
+	while (length > 0)
+	{
+		ssize_t copied = copy_file_range(originalFd, &copyOffset, outputFd, NULL, length, 0);
+		if (copied < 0 && errno == EINTR) continue;
+		if (copied <= 0) break;
+		length -= copied;
+	}
+	inOffset = copyOffset;
+#endif
+
+	// Otherwise (old kernel, different filesystems, not Linux...) do it the old-fashioned way
+	char buf[IO_CHUNK_SIZE];
+	while (length > 0)
+	{
+		size_t chunk = (length < sizeof(buf)) ? length : sizeof(buf);
+		ssize_t numRead = pread(originalFd, buf, chunk, inOffset);
+		if (numRead < 0 && errno == EINTR) continue;
+		if (numRead <= 0 || !writeFully(outputFd, buf, numRead))
+		{
+			return false;
+		}
+		inOffset += numRead;
+		length -= numRead;
+	}
+	return true;
+}
+
+static bool hashFile(int fd, string &digest)
+{
+	MD5 hasher;
+	char buf[IO_CHUNK_SIZE];
+	off_t offset = 0;
+	while (true)
+	{
+		ssize_t numRead = pread(fd, buf, sizeof(buf), offset);
+		if (numRead < 0 && errno == EINTR) continue;
+		if (numRead < 0) return false;
+		if (numRead == 0) break;
+		hasher.update(buf, static_cast<MD5::size_type>(numRead));
+		offset += numRead;
+	}
+	digest = hasher.finalize().hexdigest();
+	return true;
+}
@@ -0,0 +1,42 @@
+#ifndef CHIME_DELTA_H
+#define CHIME_DELTA_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// A patched firmware file is almost entirely a copy of the original, so instead of the whole
+// file we can ship a delta against the original. Format (integers are big-endian uint32):
+//
+//   "CHMD", version (1), MD5 of the original file (32 hex digits),
+//   length of the output file, MD5 of the output file (32 hex digits), then a list of ops:
+//   'C' offset length   copy length bytes starting at offset in the original file
+//   'I' length data     insert length bytes of data
+//   'E'                 end of the delta
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+// Finds runs of an original file inside patched versions of it. Build one per original and
+// share it between threads; makeDelta doesn't modify it.
+class DeltaIndex
+{
+public:
+	explicit DeltaIndex(const std::string &original);
+
+	// Builds a delta that turns the original (whose MD5 is originalMd5) into output
+	void makeDelta(const std::string &originalMd5, const std::string &output, std::string &delta) const;
+
+private:
+	const std::string &original;
+	std::unordered_map<uint32_t, uint32_t> blocks; // rolling hash of a block -> its offset in the original
+};
+
+// Rebuilds an output file from an original file and a delta, reading the delta front to back
+// and copying ranges of the original with copy_file_range where Linux allows it. The
+// original's MD5 is checked before anything is written, and the output's MD5 afterwards.
+// outputFd has to be opened for reading and writing. Returns false (with a reason in error)
+// if anything goes wrong.
+bool applyDelta(int originalFd, int deltaFd, int outputFd, std::string &error);
+
+#endif // CHIME_DELTA_H
@@ -0,0 +1,167 @@
+#include "chime_preview.h"
+#include "files.h"
+#include "ima.h"
+#include "stats.h"
+#include <ctype.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// 44100 as an 80-bit IEEE extended float, which is how AIFC stores the sample rate
+static const char AIFC_SAMPLE_RATE[10] = {0x40, 0x0E, static_cast<char>(0xAC), 0x44, 0, 0, 0, 0, 0, 0};
+// The only AIFC version there is
+static const uint32_t AIFC_VERSION_1 = 0xA2805140;
+// The compression name, as a Pascal string (its length byte plus the name is even, so no padding)
+static const char IMA4_NAME[] = "\x07IMA 4:1";
+
+static void appendBigEndian(string &buf, uint32_t value, size_t bytes); // appends a big-endian integer
+static void appendLittleEndian(string &buf, uint32_t value, size_t bytes); // appends a little-endian integer
+
+bool previewFormatForFile(const string &filename, PreviewFormat &format)
+{
+	size_t dot = filename.rfind('.');
+	if (dot == string::npos || filename.find('/', dot) != string::npos)
+	{
+		return false;
+	}
+	string extension = filename.substr(dot + 1);
+	for (size_t x = 0; x < extension.length(); x++)
+	{
+		extension[x] = static_cast<char>(tolower(static_cast<unsigned char>(extension[x])));
+	}
+
+	if (extension == "aifc" || extension == "aif" || extension == "aiff")
+	{
+		format = PREVIEW_AIFC;
+		return true;
+	}
+	if (extension == "wav")
+	{
+		format = PREVIEW_WAV;
+		return true;
+	}
+	return false;
+}
+
+void buildAifcPreview(const string &compressed, string &aifc)
+{
+	// Each IMA 4:1 packet counts as one sample frame
+	const size_t commLength = 2 + 4 + 2 + sizeof(AIFC_SAMPLE_RATE) + 4 + sizeof(IMA4_NAME) - 1;
+	const size_t ssndLength = 8 + compressed.length();
+	aifc.clear();
+	aifc.reserve(12 + 12 + 8 + commLength + 8 + ssndLength);
+	aifc.append("FORM");
+	appendBigEndian(aifc, static_cast<uint32_t>(4 + 12 + 8 + commLength + 8 + ssndLength), 4);
+	aifc.append("AIFC");
+
+	aifc.append("FVER");
+	appendBigEndian(aifc, 4, 4);
+	appendBigEndian(aifc, AIFC_VERSION_1, 4);
+
+	// Channels, sample frames, sample size, sample rate, compression type and name
+	aifc.append("COMM");
+	appendBigEndian(aifc, static_cast<uint32_t>(commLength), 4);
+	appendBigEndian(aifc, 1, 2);
+	appendBigEndian(aifc, static_cast<uint32_t>(compressed.length() / BYTES_PER_PACKET), 4);
+	appendBigEndian(aifc, 16, 2);
+	aifc.append(AIFC_SAMPLE_RATE, sizeof(AIFC_SAMPLE_RATE));
+	aifc.append("ima4");
+	aifc.append(IMA4_NAME, sizeof(IMA4_NAME) - 1);
+
+	// No offset or block alignment, then the packets as-is
+	aifc.append("SSND");
+	appendBigEndian(aifc, static_cast<uint32_t>(ssndLength), 4);
+	appendBigEndian(aifc, 0, 4);
+	appendBigEndian(aifc, 0, 4);
+	aifc.append(compressed);
+	if (ssndLength & 1)
+	{
+		aifc.push_back(0);
+	}
+}
+
+void buildWavPreview(const string &compressed, string &wav)
+{
+	const size_t numPackets = compressed.length() / BYTES_PER_PACKET;
+	const size_t dataLength = numPackets * SAMPLES_PER_PACKET * BYTES_PER_SAMPLE;
+	wav.clear();
+	wav.reserve(44 + dataLength);
+	wav.append("RIFF");
+	appendLittleEndian(wav, static_cast<uint32_t>(36 + dataLength), 4);
+	wav.append("WAVE");
+
+	// PCM, mono, 44.1 kHz, 16 bits
+	wav.append("fmt ");
+	appendLittleEndian(wav, 16, 4);
+	appendLittleEndian(wav, 1, 2);
+	appendLittleEndian(wav, 1, 2);
+	appendLittleEndian(wav, 44100, 4);
+	appendLittleEndian(wav, 44100 * BYTES_PER_SAMPLE, 4);
+	appendLittleEndian(wav, BYTES_PER_SAMPLE, 2);
+	appendLittleEndian(wav, 16, 2);
+
+	// Every packet starts over from its own header, so they decode independently
+	wav.append("data");
+	appendLittleEndian(wav, static_cast<uint32_t>(dataLength), 4);
+	const unsigned char *packets = reinterpret_cast<const unsigned char *>(compressed.data());
+	int16_t samples[SAMPLES_PER_PACKET];
+	for (size_t x = 0; x < numPackets; x++)
+	{
+		int32_t predictor, index;
+		imaDecodePacket(packets + x * BYTES_PER_PACKET, samples, predictor, index);
+		for (int s = 0; s < SAMPLES_PER_PACKET; s++)
+		{
+			appendLittleEndian(wav, static_cast<uint16_t>(samples[s]), 2);
+		}
+	}
+}
+
+ChimeError writeChimePreview(const char *soundFile, const char *previewFile, PreviewFormat format)
+{
+	// A context with no firmware can still load and compress a sound
+	FirmwareImage noFirmware;
+	PatchContext context(noFirmware);
+	ChimeError error;
+	{
+		StageTimer timer("loadSoundFile");
+		error = context.loadSoundFile(soundFile);
+		if (error == CHIME_OK)
+		{
+			error = context.encodeSound();
+		}
+	}
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+
+	StageTimer timer("writePreview");
+	string preview;
+	if (format == PREVIEW_AIFC)
+	{
+		buildAifcPreview(context.compressedSound(), preview);
+	}
+	else
+	{
+		buildWavPreview(context.compressedSound(), preview);
+	}
+	return writeFile(previewFile, preview) ? CHIME_OK : CHIME_ERR_WRITE_OUTPUT;
+}
+
+static void appendBigEndian(string &buf, uint32_t value, size_t bytes)
+{
+	for (size_t x = bytes; x > 0; x--)
+	{
+		buf.push_back(static_cast<char>(value >> ((x - 1) * 8)));
+	}
+}
+
+static void appendLittleEndian(string &buf, uint32_t value, size_t bytes)
+{
+	for (size_t x = 0; x < bytes; x++)
+	{
+		buf.push_back(static_cast<char>(value >> (x * 8)));
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef CHIME_PREVIEW_H
+#define CHIME_PREVIEW_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Saves the chime exactly as it would go into the firmware, so it can be listened to without
+// patching and flashing anything. Only the sound is loaded and encoded; no firmware file is
+// involved at all.
+
+#include <string>
+#include "chimepatch.h"
+
+enum PreviewFormat
+{
+	PREVIEW_AIFC, // the IMA 4:1 packets themselves, which can be fed back in as a sound file
+	PREVIEW_WAV // the packets decoded to 16-bit PCM, for players that don't do IMA 4:1
+};
+
+// Picks the format from the file's extension (.aifc, .aif or .aiff for AIFC, .wav for WAV)
+bool previewFormatForFile(const std::string &filename, PreviewFormat &format);
+
+// Wraps a compressed chime (SOUND_COMPRESSED_SIZE bytes of packets) up as an AIFC file
+void buildAifcPreview(const std::string &compressed, std::string &aifc);
+// Decodes a compressed chime into a mono 44.1 kHz 16-bit WAV file
+void buildWavPreview(const std::string &compressed, std::string &wav);
+
+// Loads and encodes a sound file (anything loadSoundFile takes) and saves the result as a
+// preview. CHIME_ERR_WRITE_OUTPUT means the preview file couldn't be written.
+ChimeError writeChimePreview(const char *soundFile, const char *previewFile, PreviewFormat format);
+
+#endif // CHIME_PREVIEW_H
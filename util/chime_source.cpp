@@ -0,0 +1,134 @@
+#include "chime_source.h"
+#include "firmware_locator.h"
+#include "md5.h"
+#include "models.h"
+#include <string.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static uint32_t readBigEndian(const string &buf, size_t pos, size_t bytes); // reads a big-endian integer
+static double readExtended(const string &buf, size_t pos); // reads an 80-bit IEEE extended float
+
+SoundSource detectSoundSource(const string &file)
+{
+	if (file.length() >= 12 && file.compare(0, 4, "FORM") == 0 && file.compare(8, 4, "AIFC") == 0)
+	{
+		return SOUND_SOURCE_AIFC;
+	}
+	return (file.length() > SOUND_MAX_SIZE) ? SOUND_SOURCE_FIRMWARE : SOUND_SOURCE_RAW;
+}
+
+SoundResult readAifcChime(const string &aifc, string &compressed)
+{
+	// Walk the chunks looking for the format (COMM) and the data (SSND)
+	bool haveFormat = false;
+	size_t numPackets = 0;
+	size_t dataPos = 0, dataLength = 0;
+	size_t pos = 12;
+	while (pos + 8 <= aifc.length())
+	{
+		size_t chunkLength = readBigEndian(aifc, pos + 4, 4);
+		size_t chunkData = pos + 8;
+		if (chunkLength > aifc.length() - chunkData)
+		{
+			return SOUND_BAD_FORMAT;
+		}
+
+		if (aifc.compare(pos, 4, "COMM") == 0 && chunkLength >= 22)
+		{
+			// Channels, sample frames (packets, for IMA4), sample size, rate, compression type
+			if (readBigEndian(aifc, chunkData, 2) != 1 || readExtended(aifc, chunkData + 8) != 44100.0 ||
+				aifc.compare(chunkData + 18, 4, "ima4") != 0)
+			{
+				return SOUND_BAD_FORMAT;
+			}
+			numPackets = readBigEndian(aifc, chunkData + 2, 4);
+			haveFormat = true;
+		}
+		else if (aifc.compare(pos, 4, "SSND") == 0 && chunkLength >= 8)
+		{
+			// Skip the offset and block size
+			size_t offset = readBigEndian(aifc, chunkData, 4);
+			if (offset > chunkLength - 8)
+			{
+				return SOUND_BAD_FORMAT;
+			}
+			dataPos = chunkData + 8 + offset;
+			dataLength = chunkLength - 8 - offset;
+		}
+
+		// Chunks are padded to an even length
+		pos = chunkData + chunkLength + (chunkLength & 1);
+	}
+	if (!haveFormat || dataPos == 0 || numPackets * BYTES_PER_PACKET > dataLength)
+	{
+		return SOUND_BAD_FORMAT;
+	}
+	if (numPackets > NUM_SOUND_PACKETS)
+	{
+		return SOUND_TOO_LONG;
+	}
+
+	compressed.assign(aifc, dataPos, numPackets * BYTES_PER_PACKET);
+	compressed.append(SOUND_COMPRESSED_SIZE - compressed.length(), 0);
+	return SOUND_OK;
+}
+
+SoundResult readFirmwareChime(const string &firmware, string &compressed)
+{
+	// An original firmware file says exactly where its chime is
+	const ModelInfo *model = findModelByMd5(md5(firmware));
+	if (model)
+	{
+		string rom;
+		if (model->decodeFirmware(*model->layout, firmware, rom) == DECODE_OK)
+		{
+			compressed.assign(rom, model->layout->soundOffset, SOUND_COMPRESSED_SIZE);
+			return SOUND_OK;
+		}
+	}
+
+	// Otherwise go looking for it. A raw ROM section can be searched without decoding it first.
+	LocatedStructure located;
+	string rom;
+	const string *searched = &firmware;
+	if (locateFirmwareStructure(firmware, located) && located.container == CONTAINER_ASCII85_LINES)
+	{
+		uint32_t romAdler = 1;
+		if (Ascii85Lines::decode(located.layout, firmware, rom, romAdler))
+		{
+			searched = &rom;
+		}
+	}
+	ChimeLocation chime;
+	if (!locateChime(*searched, chime) || chime.offset + SOUND_COMPRESSED_SIZE > searched->length())
+	{
+		return SOUND_TOO_LONG;
+	}
+	compressed.assign(*searched, chime.offset, SOUND_COMPRESSED_SIZE);
+	return SOUND_OK;
+}
+
+static uint32_t readBigEndian(const string &buf, size_t pos, size_t bytes)
+{
+	uint32_t value = 0;
+	for (size_t x = 0; x < bytes; x++)
+	{
+		value = (value << 8) | static_cast<unsigned char>(buf[pos + x]);
+	}
+	return value;
+}
+
+static double readExtended(const string &buf, size_t pos)
+{
+	// Sign and 15-bit exponent, then a 64-bit mantissa with an explicit leading 1
+	int exponent = static_cast<int>(readBigEndian(buf, pos, 2) & 0x7FFF) - 16383;
+	uint64_t mantissa = (static_cast<uint64_t>(readBigEndian(buf, pos + 2, 4)) << 32) | readBigEndian(buf, pos + 6, 4);
+	double value = static_cast<double>(mantissa);
+	for (int x = 63; x > exponent; x--) value /= 2;
+	for (int x = 63; x < exponent; x++) value *= 2;
+	return (buf[pos] & 0x80) ? -value : value;
+}
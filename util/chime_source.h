@@ -0,0 +1,37 @@
+#ifndef CHIME_SOURCE_H
+#define CHIME_SOURCE_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Chimes that are already IMA 4:1 encoded. Every supported model stores its chime as the same
+// NUM_SOUND_PACKETS packets of BYTES_PER_PACKET bytes, so a chime from another firmware file or
+// from an IMA4 AIFC file can be copied straight in. That skips the encoder, and with it a
+// second round of quantization noise.
+
+#include <string>
+#include "sound.h"
+
+// Packets copied as-is. Like IMA_ENCODER_OPTIONS, this goes into the cache key.
+#define IMA_PACKET_COPY_OPTIONS "ima4:packets"
+
+// What kind of file a sound file is
+enum SoundSource
+{
+	SOUND_SOURCE_RAW, // raw 16-bit big-endian samples, to be encoded
+	SOUND_SOURCE_AIFC, // an AIFC file (hopefully IMA 4:1)
+	SOUND_SOURCE_FIRMWARE // too big to be a raw sound, so maybe a firmware file with a chime in it
+};
+
+SoundSource detectSoundSource(const std::string &file);
+
+// Copies the packets out of a mono 44.1 kHz IMA 4:1 AIFC file. A shorter sound is padded out
+// with all-zero packets, which decode to silence.
+SoundResult readAifcChime(const std::string &aifc, std::string &compressed);
+
+// Copies the chime out of a firmware file. An original firmware file for a known model is
+// decoded using its layout; anything else (a patched file, or a model we don't know) is
+// scanned with the firmware locator. SOUND_TOO_LONG means no chime was found in it.
+SoundResult readFirmwareChime(const std::string &firmware, std::string &compressed);
+
+#endif // CHIME_SOURCE_H
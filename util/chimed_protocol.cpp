@@ -0,0 +1,117 @@
+#include "chimed_protocol.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static const char REQUEST_MAGIC[4] = {'C', 'H', 'M', 'Q'};
+static const char RESPONSE_MAGIC[4] = {'C', 'H', 'M', 'R'};
+
+bool readFully(int fd, void *buf, size_t len)
+{
+	char *p = static_cast<char *>(buf);
+	while (len > 0)
+	{
+		ssize_t numRead = read(fd, p, len);
+		if (numRead < 0 && errno == EINTR) continue;
+		if (numRead <= 0) return false;
+		p += numRead;
+		len -= numRead;
+	}
+	return true;
+}
+
+bool writeFully(int fd, const void *buf, size_t len)
+{
+	const char *p = static_cast<const char *>(buf);
+	while (len > 0)
+	{
+		ssize_t numWritten = write(fd, p, len);
+		if (numWritten < 0 && errno == EINTR) continue;
+		if (numWritten <= 0) return false;
+		p += numWritten;
+		len -= numWritten;
+	}
+	return true;
+}
+
+static bool writeUint32(int fd, uint32_t value)
+{
+	unsigned char bytes[4] = {
+		static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+		static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)
+	};
+	return writeFully(fd, bytes, 4);
+}
+
+static bool readUint32(int fd, uint32_t &value)
+{
+	unsigned char bytes[4];
+	if (!readFully(fd, bytes, 4)) return false;
+	value = (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+	return true;
+}
+
+// Reads a length-prefixed blob, refusing anything longer than maxLength
+static bool readBlob(int fd, string &blob, uint32_t maxLength)
+{
+	uint32_t length;
+	if (!readUint32(fd, length) || length > maxLength) return false;
+	blob.resize(length);
+	return (length == 0) || readFully(fd, &blob[0], length);
+}
+
+static bool writeBlob(int fd, const string &blob)
+{
+	return writeUint32(fd, blob.length()) && writeFully(fd, blob.data(), blob.length());
+}
+
+bool sendChimeRequest(int fd, const string &modelId, const string &sound)
+{
+	return writeFully(fd, REQUEST_MAGIC, 4) && writeBlob(fd, modelId) && writeBlob(fd, sound);
+}
+
+bool receiveChimeRequest(int fd, string &modelId, string &sound)
+{
+	char magic[4];
+	return readFully(fd, magic, 4) && (memcmp(magic, REQUEST_MAGIC, 4) == 0) &&
+		readBlob(fd, modelId, CHIMED_MAX_MODEL_ID_LENGTH) &&
+		readBlob(fd, sound, CHIMED_MAX_SOUND_LENGTH);
+}
+
+bool sendChimeResponse(int fd, uint32_t status, const string &payload)
+{
+	return writeFully(fd, RESPONSE_MAGIC, 4) && writeUint32(fd, status) && writeBlob(fd, payload);
+}
+
+bool receiveChimeResponse(int fd, uint32_t &status, string &payload)
+{
+	char magic[4];
+	return readFully(fd, magic, 4) && (memcmp(magic, RESPONSE_MAGIC, 4) == 0) &&
+		readUint32(fd, status) && readBlob(fd, payload, 0xFFFFFFFFUL);
+}
+
+int connectChimeDaemon(const char *socketPath)
+{
+	sockaddr_un addr;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
@@ -0,0 +1,36 @@
+#ifndef CHIMED_PROTOCOL_H
+#define CHIMED_PROTOCOL_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Wire protocol spoken by inject_chimed over its UNIX-domain socket. A client can send
+// any number of requests on one connection; each one gets exactly one response.
+//
+// Request:  "CHMQ", model id length (uint32), model id, sound length (uint32), raw sound
+// Response: "CHMR", ChimeError status (uint32), payload length (uint32), payload
+//
+// All integers are big-endian. The model id is one of the ids in MODELS (for example
+// "g3_blue_and_white") and picks which preloaded firmware to patch. The sound is the same
+// raw 16-bit big-endian sound inject_chime takes. On success the payload is the patched
+// firmware file; otherwise it's a description of the error.
+
+#include <string>
+#include <stdint.h>
+
+#define CHIMED_MAX_MODEL_ID_LENGTH	64
+#define CHIMED_MAX_SOUND_LENGTH		(16 * 1024 * 1024)
+
+// Reads or writes exactly len bytes, retrying after short transfers and signals
+bool readFully(int fd, void *buf, size_t len);
+bool writeFully(int fd, const void *buf, size_t len);
+
+bool sendChimeRequest(int fd, const std::string &modelId, const std::string &sound);
+bool receiveChimeRequest(int fd, std::string &modelId, std::string &sound);
+bool sendChimeResponse(int fd, uint32_t status, const std::string &payload);
+bool receiveChimeResponse(int fd, uint32_t &status, std::string &payload);
+
+// Connects to a daemon listening on the given socket path (-1 on failure)
+int connectChimeDaemon(const char *socketPath);
+
+#endif // CHIMED_PROTOCOL_H
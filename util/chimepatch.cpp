@@ -0,0 +1,510 @@
+#include "chimepatch.h"
+#include "channel.h"
+#include "chime_source.h"
+#include "files.h"
+#include "md5.h"
+#include "sound.h"
+#include "stats.h"
+#include <thread>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+const char *chimeErrorString(ChimeError error)
+{
+	switch (error)
+	{
+	case CHIME_OK: return "success";
+	case CHIME_ERR_READ_FIRMWARE: return "unable to read firmware file";
+	case CHIME_ERR_UNKNOWN_FIRMWARE: return "not an original (or recognizably patched) firmware file for a supported model";
+	case CHIME_ERR_DECODE_FIRMWARE: return "unable to decode the ROM image in the firmware file";
+	case CHIME_ERR_READ_SOUND: return "unable to read sound file";
+	case CHIME_ERR_SOUND_TOO_LONG: return "sound file is too long";
+	case CHIME_ERR_SOUND_NOT_16_BIT: return "sound file does not appear to be encoded as a 16-bit sound";
+	case CHIME_ERR_SOUND_COMPRESS: return "sound file could not be compressed properly";
+	case CHIME_ERR_OPEN_OUTPUT: return "unable to open output file";
+	case CHIME_ERR_WRITE_OUTPUT: return "unable to write output file";
+	case CHIME_ERR_NOT_READY: return "patch step run out of order";
+	case CHIME_ERR_ROM_CHECKSUM: return "the decoded ROM image doesn't match the checksum stored in the firmware file";
+	case CHIME_ERR_SOUND_FORMAT: return "sound file is an AIFC file that isn't mono 44.1 kHz IMA 4:1";
+	case CHIME_ERR_WATCH: return "unable to watch the sound file for changes";
+	case CHIME_ERR_PATCHED_FIRMWARE: return "the firmware file looks like an already-patched one, which can't be patched while streaming";
+	case CHIME_ERR_WATCH_UNSUPPORTED: return "watch mode needs Linux";
+	}
+	return "unknown error";
+}
+
+FirmwareImage::FirmwareImage() :
+	romCache(NULL),
+	modelInfo(NULL),
+	imageLayout(),
+	originalFile(false)
+{
+}
+
+ChimeError FirmwareImage::loadFile(const char *filename, const ModelInfo *expectedModel)
+{
+	string firmwareFile;
+	{
+		StageTimer timer("read");
+		if (!readFile(filename, firmwareFile))
+		{
+			return CHIME_ERR_READ_FIRMWARE;
+		}
+		timer.setBytes(firmwareFile.length());
+	}
+	return load(firmwareFile, expectedModel);
+}
+
+ChimeError FirmwareImage::load(const string &firmwareFile, const ModelInfo *expectedModel)
+{
+	modelInfo = NULL;
+	firmwareFileBuf = firmwareFile;
+	romDataBuf.clear();
+	mappedRom.reset();
+
+	// Verify the md5 of the entire file matches an original firmware file we know about
+	{
+		StageTimer timer("md5", firmwareFileBuf.length());
+		firmwareMd5 = ::md5(firmwareFileBuf);
+	}
+
+	// This file may have been decoded before
+	if (romCache && (modelInfo = findCachedModel(expectedModel)) != NULL)
+	{
+		return CHIME_OK;
+	}
+
+	const ModelInfo *detected = findModelByMd5(firmwareMd5);
+	if (detected && (!expectedModel || detected == expectedModel))
+	{
+		// Extract the ROM image and decode it
+		switch (detected->decodeFirmware(*detected->layout, firmwareFileBuf, romDataBuf))
+		{
+		case DECODE_OK:
+			break;
+		case DECODE_BAD_FORMAT:
+			return CHIME_ERR_DECODE_FIRMWARE;
+		case DECODE_BAD_CHECKSUM:
+			return CHIME_ERR_ROM_CHECKSUM;
+		}
+		imageLayout = *detected->layout;
+		originalFile = true;
+	}
+	else if (!detected && (detected = findPatchedModel(expectedModel)) != NULL)
+	{
+		originalFile = false;
+	}
+	else
+	{
+		return CHIME_ERR_UNKNOWN_FIRMWARE;
+	}
+
+	// Every patch job's file checksum builds on these
+	detected->fileChecksumParts(imageLayout, firmwareFileBuf, fileChecksumParts);
+
+	modelInfo = detected;
+	if (romCache)
+	{
+		storeInCache();
+	}
+	return CHIME_OK;
+}
+
+const ModelInfo *FirmwareImage::findCachedModel(const ModelInfo *expectedModel)
+{
+	DecodedFirmwareInfo info;
+	shared_ptr<const MappedRom> rom;
+	{
+		StageTimer timer("romCache");
+		rom = romCache->lookup(firmwareMd5, info);
+	}
+	if (!rom)
+	{
+		return NULL;
+	}
+
+	// An original file has to still be one we know about (a patched one, still a model that
+	// can re-patch), and everything has to fit in the file
+	const ModelInfo *model = info.original ? findModelByMd5(firmwareMd5) : findModelById(info.modelId);
+	if (!model || model->id != info.modelId || (expectedModel && model != expectedModel) ||
+		(!info.original && !modelMaskedMd5(*model)) ||
+		info.romEndOffset < model->layout->romOffset || info.romEndOffset > firmwareFileBuf.length() ||
+		info.checksumParts.afterRomLength > firmwareFileBuf.length() - info.romEndOffset)
+	{
+		return NULL;
+	}
+	ModelLayout layout = *model->layout;
+	layout.romEndOffset = info.romEndOffset;
+	layout.romChecksumPos = info.romChecksumPos;
+
+	// The cache is just a file someone could have changed, so the ROM has to match its checksum
+	if (model->checkRom(layout, firmwareFileBuf, rom->data(), rom->length()) != DECODE_OK)
+	{
+		return NULL;
+	}
+
+	mappedRom = rom;
+	imageLayout = layout;
+	originalFile = info.original;
+	fileChecksumParts = info.checksumParts;
+	return model;
+}
+
+void FirmwareImage::storeInCache()
+{
+	DecodedFirmwareInfo info;
+	info.modelId = modelInfo->id;
+	info.original = originalFile;
+	info.romEndOffset = imageLayout.romEndOffset;
+	info.romChecksumPos = imageLayout.romChecksumPos;
+	info.checksumParts = fileChecksumParts;
+
+	// Not being able to save it just means decoding it again next time
+	StageTimer timer("romCacheStore", romDataBuf.length());
+	romCache->store(firmwareMd5, info, romDataBuf.data(), romDataBuf.length());
+}
+
+const ModelInfo *FirmwareImage::findPatchedModel(const ModelInfo *expectedModel)
+{
+	for (size_t x = 0; x < numModels(); x++)
+	{
+		const ModelInfo &model = modelAt(x);
+		const char *maskedMd5 = modelMaskedMd5(model);
+		if (!maskedMd5 || (expectedModel && &model != expectedModel))
+		{
+			continue;
+		}
+
+		// The ROM image has to decode and match its checksum where it ended up, and the rest
+		// of the file has to be untouched
+		ModelLayout actual;
+		romDataBuf.clear();
+		if (model.rebaseLayout(*model.layout, firmwareFileBuf, actual) &&
+			model.decodeFirmware(actual, firmwareFileBuf, romDataBuf) == DECODE_OK &&
+			model.maskedDigest(actual, firmwareFileBuf, romDataBuf) == maskedMd5)
+		{
+			imageLayout = actual;
+			return &model;
+		}
+	}
+	romDataBuf.clear();
+	return NULL;
+}
+
+PatchContext::PatchContext(const FirmwareImage &base) :
+	baseImage(base),
+	outputCache(NULL),
+	deltaIndex(NULL),
+	soundLoaded(false),
+	soundPrecompressed(false),
+	soundEncoded(false),
+	injected(false),
+	cacheHit(false)
+{
+	// Sounds never get any bigger than this, so a context can be reused for any number of
+	// jobs without reallocating
+	soundFileBuf.reserve(SOUND_MAX_SIZE);
+	compressedSoundBuf.reserve(SOUND_COMPRESSED_SIZE);
+}
+
+ChimeError PatchContext::loadSoundFile(const char *filename)
+{
+	soundFileBuf.clear();
+	{
+		StageTimer timer("read");
+		if (!readFile(filename, soundFileBuf))
+		{
+			soundLoaded = false;
+			return CHIME_ERR_READ_SOUND;
+		}
+		timer.setBytes(soundFileBuf.length());
+	}
+	return acceptSound();
+}
+
+static ChimeError soundError(SoundResult result)
+{
+	switch (result)
+	{
+	case SOUND_OK: return CHIME_OK;
+	case SOUND_TOO_LONG: return CHIME_ERR_SOUND_TOO_LONG;
+	case SOUND_NOT_16_BIT: return CHIME_ERR_SOUND_NOT_16_BIT;
+	case SOUND_BAD_FORMAT: return CHIME_ERR_SOUND_FORMAT;
+	case SOUND_COMPRESS_FAILED: break;
+	}
+	return CHIME_ERR_SOUND_COMPRESS;
+}
+
+ChimeError PatchContext::setSound(const string &sound)
+{
+	soundFileBuf = sound;
+	return acceptSound();
+}
+
+ChimeError PatchContext::copySound(const PatchContext &other)
+{
+	if (!other.soundLoaded)
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+	soundFileBuf = other.soundFileBuf;
+	compressedSoundBuf = other.compressedSoundBuf;
+	soundLoaded = true;
+	soundPrecompressed = other.soundPrecompressed;
+	soundEncoded = other.soundEncoded;
+	injected = false;
+	return CHIME_OK;
+}
+
+ChimeError PatchContext::acceptSound()
+{
+	compressedSoundBuf.clear();
+	injected = false;
+	soundEncoded = false;
+
+	// An already-compressed chime is copied out now. Encoding a raw sound waits until
+	// injectChime, in case the cache already has the result.
+	ChimeError error;
+	switch (detectSoundSource(soundFileBuf))
+	{
+	case SOUND_SOURCE_AIFC:
+	{
+		StageTimer timer("readAifcChime", soundFileBuf.length());
+		error = soundError(readAifcChime(soundFileBuf, compressedSoundBuf));
+		soundPrecompressed = true;
+		break;
+	}
+	case SOUND_SOURCE_FIRMWARE:
+	{
+		StageTimer timer("readFirmwareChime", soundFileBuf.length());
+		error = soundError(readFirmwareChime(soundFileBuf, compressedSoundBuf));
+		soundPrecompressed = true;
+		break;
+	}
+	default:
+		error = soundError(validateSound(soundFileBuf));
+		soundPrecompressed = false;
+		break;
+	}
+	soundLoaded = (error == CHIME_OK);
+	soundEncoded = soundLoaded && soundPrecompressed;
+	return error;
+}
+
+void PatchContext::padSound()
+{
+	if (!soundPrecompressed)
+	{
+		soundFileBuf.append(SOUND_MAX_SIZE - soundFileBuf.length(), 0);
+	}
+}
+
+ChimeError PatchContext::encodeSound()
+{
+	if (!soundLoaded)
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+	if (soundEncoded)
+	{
+		return CHIME_OK;
+	}
+
+	padSound();
+	compressedSoundBuf.clear();
+	ChimeError error;
+	{
+		StageTimer timer("imaEncode", soundFileBuf.length());
+		error = soundError(compressSound(soundFileBuf, compressedSoundBuf));
+	}
+	soundEncoded = (error == CHIME_OK);
+	return error;
+}
+
+ChimeError PatchContext::openOutputFile(const char *filename)
+{
+	// Left open if the previous job using this context failed partway through
+	if (outFile.is_open())
+	{
+		outFile.close();
+	}
+	outFile.clear();
+	outFile.open(filename, ios::out | ios::trunc | ios::binary);
+	return outFile.is_open() ? CHIME_OK : CHIME_ERR_OPEN_OUTPUT;
+}
+
+ChimeError PatchContext::injectChime()
+{
+	if (!baseImage.isLoaded() || !soundLoaded)
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+
+	// Pad the sound out with silence now so that sounds that only differ in trailing
+	// silence share a cache entry
+	padSound();
+
+	// If we've made this exact firmware before, we're already done
+	string cacheKey;
+	cacheHit = false;
+	if (outputCache)
+	{
+		StageTimer timer("cacheLookup");
+		cacheKey = soundPrecompressed ?
+			OutputCache::makeKey(baseImage.md5(), compressedSoundBuf, IMA_PACKET_COPY_OPTIONS) :
+			OutputCache::makeKey(baseImage.md5(), soundFileBuf, IMA_ENCODER_OPTIONS);
+		cacheHit = outputCache->lookup(cacheKey, firmwareFileBuf);
+		if (cacheHit)
+		{
+			injected = true;
+			return CHIME_OK;
+		}
+	}
+
+	// Compress the sound file in IMA 4:1 format, unless it already was
+	ChimeError error = encodeSound();
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+
+	// The base image is shared -- patch our own copy of it. The buffers are sized for the
+	// worst case the first time around, so reusing this context for another job doesn't
+	// allocate anything.
+	const ModelInfo &model = *baseImage.model();
+	const ModelLayout &layout = baseImage.layout();
+	size_t maxEncodedLength = model.maxEncodedLength(layout);
+	firmwareFileBuf.reserve(baseImage.firmware().length() - (layout.romEndOffset - layout.romOffset) +
+		maxEncodedLength);
+	romDataBuf.reserve(layout.romChecksumLength);
+	encodedRomBuf.reserve(maxEncodedLength);
+	{
+		StageTimer timer("copyBase", baseImage.firmware().length() + baseImage.romLength());
+		firmwareFileBuf = baseImage.firmware();
+		romDataBuf.assign(baseImage.romData(), baseImage.romLength());
+	}
+	{
+		StageTimer timer("patch", firmwareFileBuf.length());
+		model.injectChime(layout, firmwareFileBuf, romDataBuf, compressedSoundBuf, baseImage.checksumParts(),
+						  encodedRomBuf);
+	}
+	injected = true;
+
+	// Failing to save to the cache isn't fatal; we'll just make it again next time
+	if (outputCache)
+	{
+		StageTimer timer("cacheStore", firmwareFileBuf.length());
+		outputCache->store(cacheKey, firmwareFileBuf);
+	}
+	return CHIME_OK;
+}
+
+ChimeError PatchContext::writeOutputFile()
+{
+	if (!injected || !outFile.is_open())
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+
+	if (deltaIndex)
+	{
+		StageTimer timer("makeDelta", firmwareFileBuf.length());
+		deltaIndex->makeDelta(baseImage.md5(), firmwareFileBuf, deltaBuf);
+	}
+	const string &contents = deltaIndex ? deltaBuf : firmwareFileBuf;
+
+	StageTimer timer("write", contents.length());
+	outFile << contents;
+	outFile.close();
+	return outFile.fail() ? CHIME_ERR_WRITE_OUTPUT : CHIME_OK;
+}
+
+ChimeError PatchContext::takeOutput(string &contents)
+{
+	if (!injected)
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+
+	if (deltaIndex)
+	{
+		StageTimer timer("makeDelta", firmwareFileBuf.length());
+		deltaIndex->makeDelta(baseImage.md5(), firmwareFileBuf, deltaBuf);
+	}
+	contents.swap(deltaIndex ? deltaBuf : firmwareFileBuf);
+	injected = false;
+	return CHIME_OK;
+}
+
+ChimeError PatchContext::streamOutputFile()
+{
+	if (!baseImage.isLoaded() || !outFile.is_open())
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+	ChimeError error = encodeSound();
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+
+	// A writer thread takes finished pieces off one channel and hands the emptied buffers
+	// back on the other, so only a few pieces are ever in memory at once. The buffers are
+	// sized for the biggest piece the first time around and kept for the next job.
+	const ModelInfo &model = *baseImage.model();
+	size_t maxSegment = model.maxStreamSegment(baseImage.layout(), baseImage.firmware());
+	for (int x = 0; x <= STREAM_BUFFERS; x++)
+	{
+		streamBuffers[x].clear();
+		streamBuffers[x].reserve(maxSegment);
+	}
+	romDataBuf.reserve(baseImage.layout().romChecksumLength);
+	BoundedChannel<string> written(STREAM_BUFFERS);
+	BoundedChannel<string> emptied(STREAM_BUFFERS + 1);
+	for (int x = 0; x < STREAM_BUFFERS; x++)
+	{
+		emptied.push(streamBuffers[x]);
+	}
+	thread writer([this, &written, &emptied]()
+	{
+		string segment;
+		while (written.pop(segment))
+		{
+			if (!outFile.fail())
+			{
+				outFile.write(segment.data(), segment.length());
+			}
+			segment.clear();
+			emptied.push(segment);
+		}
+	});
+
+	{
+		StageTimer timer("copyBase", baseImage.romLength());
+		romDataBuf.assign(baseImage.romData(), baseImage.romLength());
+	}
+	{
+		StageTimer timer("patch", baseImage.firmware().length());
+		model.streamChime(baseImage.layout(), baseImage.firmware(), romDataBuf, compressedSoundBuf,
+						  baseImage.checksumParts(), streamBuffers[STREAM_BUFFERS], [&written, &emptied](string &segment)
+		{
+			written.push(segment);
+			emptied.pop(segment);
+		});
+	}
+	written.close();
+	writer.join();
+	for (int x = 0; x < STREAM_BUFFERS; x++)
+	{
+		emptied.pop(streamBuffers[x]);
+	}
+
+	// Nothing was put together in firmwareFileBuf, so there's nothing for output() to show
+	injected = false;
+	cacheHit = false;
+	outFile.close();
+	return outFile.fail() ? CHIME_ERR_WRITE_OUTPUT : CHIME_OK;
+}
@@ -0,0 +1,170 @@
+#ifndef CHIMEPATCH_H
+#define CHIMEPATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// libchimepatch: everything needed to patch a startup chime into a firmware file, with
+// all state kept in explicit objects so that several patch jobs can run at the same time
+// on different threads. Nothing in here prints anything or exits; every step returns a
+// ChimeError instead.
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include "chime_delta.h"
+#include "models.h"
+#include "output_cache.h"
+#include "rom_cache.h"
+
+enum ChimeError
+{
+	CHIME_OK = 0,
+	CHIME_ERR_READ_FIRMWARE, // the firmware file couldn't be read
+	CHIME_ERR_UNKNOWN_FIRMWARE, // the firmware file isn't an original firmware file we know about
+	CHIME_ERR_DECODE_FIRMWARE, // the ROM image couldn't be decoded
+	CHIME_ERR_READ_SOUND, // the sound file couldn't be read
+	CHIME_ERR_SOUND_TOO_LONG, // the sound is longer than SOUND_MAX_SIZE bytes (or is a file with no chime to copy)
+	CHIME_ERR_SOUND_NOT_16_BIT, // the sound has an odd number of bytes
+	CHIME_ERR_SOUND_COMPRESS, // the sound couldn't be compressed
+	CHIME_ERR_OPEN_OUTPUT, // the output file couldn't be opened
+	CHIME_ERR_WRITE_OUTPUT, // the output file couldn't be written
+	CHIME_ERR_NOT_READY, // a step was run before the steps it depends on
+	CHIME_ERR_ROM_CHECKSUM, // the decoded ROM image doesn't match the ROM checksum in the firmware file
+	CHIME_ERR_SOUND_FORMAT, // the sound is an AIFC file that isn't mono 44.1 kHz IMA 4:1
+	CHIME_ERR_WATCH, // the sound file couldn't be watched for changes
+	CHIME_ERR_PATCHED_FIRMWARE, // the firmware file looks like an already-patched one, which streamPatchFile can't patch
+	CHIME_ERR_WATCH_UNSUPPORTED // watching the sound file for changes isn't supported on this platform
+};
+
+// Returns a short description of an error
+const char *chimeErrorString(ChimeError error);
+
+// A verified, decoded firmware file. Once loaded it is never modified, so one FirmwareImage
+// can be shared (read-only) by any number of concurrent patch jobs.
+//
+// Usually this is an original firmware file, recognized by its MD5. A file that has already
+// been patched is accepted too if its model has a maskedMd5 and the file's masked digest
+// matches it, which means nothing but the chime (and the checksums) was changed. Patching it
+// again just swaps in the new chime, so the original file isn't needed to change a chime.
+class FirmwareImage
+{
+public:
+	FirmwareImage();
+
+	// Maps decoded ROM images from (and saves them to) the given cache instead of decoding
+	// them every time. NULL turns it off.
+	void setRomCache(const RomCache *cache) { romCache = cache; }
+
+	// Loads, verifies and decodes a firmware file (original or patched, see above). If
+	// expectedModel is NULL, the model is detected from the file; otherwise only that model's
+	// firmware is accepted.
+	ChimeError loadFile(const char *filename, const ModelInfo *expectedModel = NULL);
+	// Same as loadFile, but with the firmware file's contents already in memory
+	ChimeError load(const std::string &firmwareFile, const ModelInfo *expectedModel = NULL);
+
+	bool isLoaded() const { return modelInfo != NULL; }
+	const ModelInfo *model() const { return modelInfo; }
+	const ModelLayout &layout() const { return imageLayout; } // where everything is in this file, for ModelInfo::injectChime
+	bool isOriginal() const { return originalFile; } // false if the file has already been patched
+	const std::string &firmware() const { return firmwareFileBuf; } // the entire firmware file
+	const char *romData() const { return mappedRom ? mappedRom->data() : romDataBuf.data(); } // decoded ROM image
+	size_t romLength() const { return mappedRom ? mappedRom->length() : romDataBuf.length(); }
+	bool romFromCache() const { return mappedRom != NULL; }
+	const std::string &md5() const { return firmwareMd5; } // MD5 of the firmware file
+	const FileChecksumParts &checksumParts() const { return fileChecksumParts; } // for ModelInfo::injectChime
+
+private:
+	const ModelInfo *findPatchedModel(const ModelInfo *expectedModel); // decodes a patched file if its masked digest matches a model
+	const ModelInfo *findCachedModel(const ModelInfo *expectedModel); // maps the decoded ROM from the cache, if it's there and checks out
+	void storeInCache(); // saves the decoded ROM to the cache
+
+	const RomCache *romCache;
+	std::shared_ptr<const MappedRom> mappedRom; // the decoded ROM image, if it came from the cache
+	const ModelInfo *modelInfo;
+	ModelLayout imageLayout;
+	bool originalFile;
+	std::string firmwareMd5;
+	std::string firmwareFileBuf;
+	std::string romDataBuf;
+	FileChecksumParts fileChecksumParts;
+};
+
+// One patch job: a new chime going into a copy of a FirmwareImage. A context can be reused
+// for another job (against the same FirmwareImage) once it's done with the last one; its
+// buffers are kept, so after the first job it doesn't need to allocate any more memory.
+class PatchContext
+{
+public:
+	explicit PatchContext(const FirmwareImage &base);
+
+	// Looks up patched firmware in (and saves it to) the given cache. NULL turns caching off.
+	void setCache(const OutputCache *cache) { outputCache = cache; }
+	// Makes writeOutputFile write a delta against the original firmware (built with index)
+	// instead of the whole patched file. NULL goes back to writing the whole file.
+	void setDeltaIndex(const DeltaIndex *index) { deltaIndex = index; }
+
+	// Loads the new chime and verifies that it fits. It can be raw 16-bit big-endian samples,
+	// or an already-compressed chime to copy as-is: an IMA 4:1 AIFC file, or another firmware
+	// file (see chime_source.h).
+	ChimeError loadSoundFile(const char *filename);
+	// Same as loadSoundFile, with the sound file already in memory
+	ChimeError setSound(const std::string &sound);
+	// Takes the sound another context loaded (and maybe already encoded), so the same chime
+	// can go into several firmware files with only one encode
+	ChimeError copySound(const PatchContext &other);
+	// Prepares for saving the new firmware by opening the output file
+	ChimeError openOutputFile(const char *filename);
+	// Compresses the new chime in IMA 4:1 format now, instead of leaving it to injectChime.
+	// Nothing here depends on the firmware, so it can run while the firmware is loading.
+	ChimeError encodeSound();
+	// Encodes the new chime in IMA 4:1 format (unless encodeSound already did), sticks it in
+	// place, recalculates checksums and encodes the new firmware. If the same patch is in the
+	// cache, it's used instead.
+	ChimeError injectChime();
+	// Saves the new firmware (or a delta, see setDeltaIndex) to the output file opened with openOutputFile
+	ChimeError writeOutputFile();
+	// Instead of writeOutputFile: swaps the new firmware (or a delta) into contents, to be
+	// written out some other way. What was in contents is kept as a buffer for the next job,
+	// so handing the same strings back and forth doesn't allocate.
+	ChimeError takeOutput(std::string &contents);
+	// Instead of injectChime and writeOutputFile: patches the firmware and streams it to the
+	// output file opened with openOutputFile as it's encoded. Everything before the ROM image
+	// is written while the ROM is still being encoded, and the ROM itself goes out in pieces
+	// as they're finished (see PatchEngine::streamChime). The cache and deltas aren't used.
+	// The buffers for the pieces are kept for the next job like the others; only the writer
+	// thread and the queues feeding it are set up again each time.
+	ChimeError streamOutputFile();
+
+	const FirmwareImage &base() const { return baseImage; }
+	const std::string &sound() const { return soundFileBuf; } // the sound as loaded (raw sounds get padded when they're encoded)
+	bool precompressed() const { return soundPrecompressed; } // the chime was copied from the sound file, not encoded
+	const std::string &compressedSound() const { return compressedSoundBuf; }
+	const std::string &output() const { return firmwareFileBuf; } // the patched firmware file
+	bool outputFromCache() const { return cacheHit; }
+
+private:
+	enum { STREAM_BUFFERS = 4 }; // pieces of the firmware streamOutputFile can have in flight
+
+	ChimeError acceptSound(); // validates the sound that was just put in soundFileBuf
+	void padSound(); // pads a raw sound out to full length with silence
+
+	const FirmwareImage &baseImage;
+	const OutputCache *outputCache;
+	const DeltaIndex *deltaIndex;
+	std::string soundFileBuf; // the provided sound file
+	std::string compressedSoundBuf; // the compressed sound data
+	std::string firmwareFileBuf; // the firmware file being patched
+	std::string romDataBuf; // the ROM image being patched
+	std::string encodedRomBuf; // scratch space for re-encoding the ROM image
+	std::string deltaBuf; // the delta being written, if writing deltas
+	std::string streamBuffers[STREAM_BUFFERS + 1]; // pieces of the firmware being streamed, plus the one being put together
+	std::ofstream outFile; // file we write the patched firmware to
+	bool soundLoaded;
+	bool soundPrecompressed; // compressedSoundBuf came straight from the sound file
+	bool soundEncoded; // compressedSoundBuf is ready
+	bool injected;
+	bool cacheHit;
+};
+
+#endif // CHIMEPATCH_H
@@ -0,0 +1,104 @@
+#include "cpu_dispatch.h"
+#include "kernels.h"
+#include <atomic>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Ascii85 and IMA encoding only have a scalar version (see cpu_dispatch.h)
+static const KernelTable KERNEL_TABLES[NUM_KERNEL_LEVELS] = {
+	{KERNEL_SCALAR, adler32Scalar, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersScalar, findPatternsScalar},
+#ifdef KERNELS_X86
+	{KERNEL_SSE41, adler32Sse41, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersSse41, findPatternsSse41},
+	{KERNEL_AVX2, adler32Avx2, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersAvx2, findPatternsAvx2},
+	{KERNEL_AVX512, adler32Avx512, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersAvx512, findPatternsAvx512},
+#else
+	// Never selected -- kernelLevelSupported() says no
+	{KERNEL_SSE41, adler32Scalar, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersScalar, findPatternsScalar},
+	{KERNEL_AVX2, adler32Scalar, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersScalar, findPatternsScalar},
+	{KERNEL_AVX512, adler32Scalar, dc85Scalar, ec85AppendScalar, imaEncodeScalar, imaScanHeadersScalar, findPatternsScalar},
+#endif
+};
+
+static const char *const KERNEL_LEVEL_NAMES[NUM_KERNEL_LEVELS] = {"scalar", "sse4.1", "avx2", "avx512"};
+
+// The table in use; NULL until the first kernel call (or setKernelLevel)
+static atomic<const KernelTable *> activeTable(NULL);
+
+const char *kernelLevelName(KernelLevel level)
+{
+	return (level >= 0 && level < NUM_KERNEL_LEVELS) ? KERNEL_LEVEL_NAMES[level] : "unknown";
+}
+
+bool parseKernelLevel(const string &name, KernelLevel &level)
+{
+	if (name == "auto")
+	{
+		level = bestKernelLevel();
+		return true;
+	}
+	for (int x = 0; x < NUM_KERNEL_LEVELS; x++)
+	{
+		if (name == KERNEL_LEVEL_NAMES[x])
+		{
+			level = static_cast<KernelLevel>(x);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool kernelLevelSupported(KernelLevel level)
+{
+	switch (level)
+	{
+	case KERNEL_SCALAR: return true;
+#ifdef KERNELS_X86
+	// These also check that the OS saves the wider registers
+	case KERNEL_SSE41: return __builtin_cpu_supports("sse4.1");
+	case KERNEL_AVX2: return __builtin_cpu_supports("avx2");
+	case KERNEL_AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	default: return false;
+	}
+}
+
+KernelLevel bestKernelLevel()
+{
+	for (int x = NUM_KERNEL_LEVELS - 1; x > KERNEL_SCALAR; x--)
+	{
+		if (kernelLevelSupported(static_cast<KernelLevel>(x)))
+		{
+			return static_cast<KernelLevel>(x);
+		}
+	}
+	return KERNEL_SCALAR;
+}
+
+bool setKernelLevel(KernelLevel level)
+{
+	if (!kernelLevelSupported(level))
+	{
+		return false;
+	}
+	activeTable.store(&KERNEL_TABLES[level]);
+	return true;
+}
+
+const KernelTable &kernels()
+{
+	const KernelTable *table = activeTable.load(memory_order_relaxed);
+	if (!table)
+	{
+		// Several threads may get here at once; they all pick the same table
+		table = &KERNEL_TABLES[bestKernelLevel()];
+		const KernelTable *expected = NULL;
+		if (!activeTable.compare_exchange_strong(expected, table))
+		{
+			table = expected;
+		}
+	}
+	return *table;
+}
@@ -0,0 +1,61 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// The hot kernels go through a table with one entry per instruction set level. The best level
+// this CPU supports is picked the first time a kernel is used; setKernelLevel() can force a
+// lower one (for testing, or to compare them in the benchmarks). Every variant produces exactly
+// the same output; "make check" in bench/ checks that against the scalar versions.
+//
+// Only Adler-32, the IMA header scan (for the chime scan) and the pattern search have real
+// SSE4.1, AVX2 and AVX-512 variants. Ascii85 and IMA encoding are serial by nature, so every
+// level's table points at their scalar versions.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum KernelLevel
+{
+	KERNEL_SCALAR = 0, // plain C++, runs anywhere
+	KERNEL_SSE41, // x86 with SSE4.1
+	KERNEL_AVX2, // x86 with AVX2
+	KERNEL_AVX512, // x86 with AVX-512 (F and BW)
+	NUM_KERNEL_LEVELS
+};
+
+struct ImaHeaderScan;
+struct PatternSet;
+struct PatternMatch;
+
+// One variant of every kernel
+struct KernelTable
+{
+	KernelLevel level;
+	uint32_t (*adler32)(uint32_t adler, const unsigned char *data, size_t len);
+	bool (*dc85)(const char *s, size_t len, std::string &output);
+	size_t (*ec85Append)(const std::string &s, std::string &output, size_t offset, size_t maxStringLen);
+	void (*imaEncode)(const std::string &input, std::string &output);
+	void (*imaScanHeaders)(const unsigned char *data, size_t len, ImaHeaderScan &scan);
+	void (*findPatterns)(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+};
+
+// Name of a level as used by --kernel= ("scalar", "sse4.1", "avx2", "avx512")
+const char *kernelLevelName(KernelLevel level);
+// Looks up a level by name. Also accepts "auto", meaning the best supported level.
+bool parseKernelLevel(const std::string &name, KernelLevel &level);
+// Whether this CPU (and this build) can run a level's kernels
+bool kernelLevelSupported(KernelLevel level);
+// The best level this CPU supports
+KernelLevel bestKernelLevel();
+
+// Switches every kernel to the given level. Returns false (and changes nothing) if the
+// level isn't supported. Meant to be called before any work starts.
+bool setKernelLevel(KernelLevel level);
+// The kernels in use right now
+const KernelTable &kernels();
+
+#endif // CPU_DISPATCH_H
@@ -0,0 +1,52 @@
+#include "files.h"
+#include <fstream>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+bool readFile(const char *filename, string &buf)
+{
+	// Open the file
+	ifstream file;
+	file.open(filename, ios::in | ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Make room for the whole file up front
+	file.seekg(0, ios::end);
+	streamoff fileSize = file.tellg();
+	file.seekg(0, ios::beg);
+	if (fileSize > 0)
+	{
+		buf.reserve(buf.length() + fileSize);
+	}
+
+	// Read the entire file into "buf"
+	char tmpBuf[4096];
+	while (file.good())
+	{
+		file.read(tmpBuf, sizeof(tmpBuf));
+		buf.append(tmpBuf, file.gcount());
+	}
+
+	// Anything other than hitting the end of the file is an error
+	return file.eof();
+}
+
+bool writeFile(const char *filename, const string &buf)
+{
+	ofstream file;
+	file.open(filename, ios::out | ios::trunc | ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << buf;
+	file.close();
+	return !file.fail();
+}
@@ -0,0 +1,14 @@
+#ifndef FILES_H
+#define FILES_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+
+// Appends the complete contents of a file to buf. Returns false if it couldn't be read.
+bool readFile(const char *filename, std::string &buf);
+// Replaces the contents of a file with buf. Returns false if it couldn't be written.
+bool writeFile(const char *filename, const std::string &buf);
+
+#endif // FILES_H
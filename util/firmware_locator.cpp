@@ -0,0 +1,343 @@
+#include "firmware_locator.h"
+#include "adler32.h"
+#include "ima.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// The file checksum is looked for this far back from the end of the file...
+static const size_t FILE_CHECKSUM_SEARCH = 64;
+// ...and can leave up to this many bytes between what it covers and the checksum itself
+static const size_t MAX_CHECKSUM_GAP = 32;
+
+// How far a packet's predictor can be from where the last one left off. The header only has its
+// top 9 bits, so decoding starts up to 127 below where the encoder actually was.
+static const int32_t PREDICTOR_SLACK = 0x100;
+// The sound header that can come before a chime
+static const size_t SOUND_HEADER_SIZE = 16;
+
+// One way the ROM checksum might have been calculated
+struct RomChecksumCandidate
+{
+	uint32_t checksum;
+	size_t length;
+	uint8_t padByte;
+};
+
+static bool findAscii85Run(const string &firmware, size_t &start, size_t &end, size_t &width); // finds the longest run of "dc85 " lines
+static void locateRomChecksum(const string &firmware, const string &rom, uint32_t romAdler,
+							  LocatedStructure &located); // finds the ROM checksum field
+static bool locateFileChecksum(const string &firmware, ChecksumFieldKind kind, LocatedStructure &located); // finds the file checksum field
+static bool packetFollows(const string &rom, size_t prevPos, size_t pos); // whether a packet carries on from the one before it
+static bool isSilentPacket(const string &rom, size_t pos); // whether a packet is all zero
+static bool hasSoundHeader(const string &rom, size_t offset, size_t numPackets); // checks for a header giving the chime's length
+static bool isHexDigit(char c); // whether c can be part of a hex checksum field (they're written in uppercase)
+
+bool locateFirmwareStructure(const string &firmware, LocatedStructure &located)
+{
+	located.container = CONTAINER_RAW_SECTION;
+	located.checksumField = CHECKSUM_FIELD_BIG_ENDIAN;
+	located.layout = ModelLayout{NULL, NULL, NULL, NULL, UNKNOWN_OFFSET, UNKNOWN_OFFSET, 0, UNKNOWN_OFFSET, 0x00,
+								 UNKNOWN_OFFSET, UNKNOWN_OFFSET, UNKNOWN_OFFSET, UNKNOWN_OFFSET};
+
+	// An Ascii85 ROM image gives us everything but the chime
+	size_t romStart, romEnd, width;
+	if (findAscii85Run(firmware, romStart, romEnd, width))
+	{
+		ModelLayout &layout = located.layout;
+		layout.romOffset = romStart;
+		layout.romEndOffset = romEnd;
+		layout.columnWidth = width;
+
+		string rom;
+		uint32_t romAdler = 1;
+		if (Ascii85Lines::decode(layout, firmware, rom, romAdler))
+		{
+			located.container = CONTAINER_ASCII85_LINES;
+			located.checksumField = CHECKSUM_FIELD_HEX;
+			locateRomChecksum(firmware, rom, romAdler, located);
+			locateFileChecksum(firmware, CHECKSUM_FIELD_HEX, located);
+			ChimeLocation chime;
+			if (locateChime(rom, chime))
+			{
+				layout.soundOffset = chime.offset;
+			}
+			return true;
+		}
+		layout.romOffset = layout.romEndOffset = UNKNOWN_OFFSET;
+		layout.columnWidth = 0;
+	}
+
+	// Otherwise all we can find is the file checksum
+	return locateFileChecksum(firmware, CHECKSUM_FIELD_BIG_ENDIAN, located) ||
+		locateFileChecksum(firmware, CHECKSUM_FIELD_HEX, located);
+}
+
+bool locateChime(const string &rom, ChimeLocation &location)
+{
+	ImaHeaderScan scan;
+	imaScanHeaders(rom, scan);
+
+	bool found = false;
+	for (size_t lane = 0; lane < BYTES_PER_PACKET; lane++)
+	{
+		if (scan.best[lane] < MIN_CHIME_PACKETS)
+		{
+			continue;
+		}
+
+		// Find the longest stretch of the run where each packet follows on from the last
+		size_t runEnd = static_cast<size_t>(scan.bestEnd[lane]) * BYTES_PER_PACKET + lane;
+		size_t runStart = runEnd - static_cast<size_t>(scan.best[lane]) * BYTES_PER_PACKET;
+		size_t start = runStart, end = runStart;
+		size_t stretchStart = runStart;
+		for (size_t pos = runStart; pos < runEnd; pos += BYTES_PER_PACKET)
+		{
+			if (pos > stretchStart && !packetFollows(rom, pos - BYTES_PER_PACKET, pos))
+			{
+				stretchStart = pos;
+			}
+			if (pos + BYTES_PER_PACKET - stretchStart > end - start)
+			{
+				start = stretchStart;
+				end = pos + BYTES_PER_PACKET;
+			}
+		}
+
+		// The scan skips packets with all-zero headers, and the first packet of a chime has
+		// one (the encoder starts at zero), as does any silence at the end
+		while (start >= BYTES_PER_PACKET && !isSilentPacket(rom, start - BYTES_PER_PACKET) &&
+			   packetFollows(rom, start - BYTES_PER_PACKET, start))
+		{
+			start -= BYTES_PER_PACKET;
+		}
+		while (end + BYTES_PER_PACKET <= rom.length() && packetFollows(rom, end - BYTES_PER_PACKET, end))
+		{
+			end += BYTES_PER_PACKET;
+		}
+
+		size_t numPackets = (end - start) / BYTES_PER_PACKET;
+		bool header = hasSoundHeader(rom, start, numPackets);
+		if (numPackets >= MIN_CHIME_PACKETS &&
+			(!found || numPackets > location.numPackets ||
+			 (numPackets == location.numPackets && header && !location.hasSoundHeader)))
+		{
+			found = true;
+			location.offset = start;
+			location.numPackets = numPackets;
+			location.hasSoundHeader = header;
+		}
+	}
+	return found;
+}
+
+static bool findAscii85Run(const string &firmware, size_t &start, size_t &end, size_t &width)
+{
+	const char *data = firmware.data();
+	size_t length = firmware.length();
+	size_t bestLength = 0;
+	size_t pos = 0;
+	while ((pos = firmware.find("dc85 ", pos)) != string::npos)
+	{
+		// Follow the lines for as long as they keep going
+		size_t runStart = pos;
+		size_t runWidth = 0;
+		while (pos + 5 <= length && memcmp(data + pos, "dc85 ", 5) == 0)
+		{
+			const char *lineEnd = static_cast<const char *>(memchr(data + pos + 5, '\r', length - pos - 5));
+			if (!lineEnd)
+			{
+				break;
+			}
+			size_t lineWidth = lineEnd - (data + pos + 5);
+			if (lineWidth > runWidth) runWidth = lineWidth;
+			pos = lineEnd - data + 1;
+		}
+		if (pos == runStart)
+		{
+			// A "dc85 " with no end of line after it
+			pos += 5;
+			continue;
+		}
+
+		if (pos - runStart > bestLength)
+		{
+			bestLength = pos - runStart;
+			start = runStart;
+			end = pos;
+			width = runWidth;
+		}
+	}
+	return bestLength > 0;
+}
+
+static void locateRomChecksum(const string &firmware, const string &rom, uint32_t romAdler,
+							  LocatedStructure &located)
+{
+	// The ROM is padded out to (or to just short of) the size of a flash chip, with 0x00 or 0xFF
+	vector<RomChecksumCandidate> candidates;
+	size_t chipSize = 1;
+	while (chipSize < rom.length() + 4) chipSize <<= 1;
+	for (size_t size = chipSize; size <= chipSize * 2; size <<= 1)
+	{
+		const size_t lengths[] = {size - 4, size};
+		const uint8_t padBytes[] = {0x00, 0xFF};
+		for (size_t x = 0; x < 2; x++)
+		{
+			for (size_t y = 0; y < 2; y++)
+			{
+				RomChecksumCandidate candidate;
+				candidate.length = lengths[x];
+				candidate.padByte = padBytes[y];
+				candidate.checksum = adler32Fill(romAdler, candidate.padByte, candidate.length - rom.length());
+				candidates.push_back(candidate);
+			}
+		}
+	}
+
+	// Look at every 8 hex digits in a row outside the ROM image. Whatever is around them could be
+	// anything, so they don't have to be a word of their own.
+	const ModelLayout &layout = located.layout;
+	const char *data = firmware.data();
+	size_t run = 0;
+	for (size_t pos = 0; pos < firmware.length(); pos++)
+	{
+		if (pos == layout.romOffset)
+		{
+			pos = layout.romEndOffset - 1;
+			run = 0;
+			continue;
+		}
+		run = isHexDigit(data[pos]) ? run + 1 : 0;
+		if (run < HexChecksumField::SIZE)
+		{
+			continue;
+		}
+
+		size_t fieldPos = pos + 1 - HexChecksumField::SIZE;
+		uint32_t value;
+		HexChecksumField::read(data + fieldPos, value);
+		for (size_t x = 0; x < candidates.size(); x++)
+		{
+			if (candidates[x].checksum == value)
+			{
+				located.layout.romChecksumPos = fieldPos;
+				located.layout.romChecksumLength = candidates[x].length;
+				located.layout.romPadByte = candidates[x].padByte;
+				return;
+			}
+		}
+	}
+}
+
+static bool locateFileChecksum(const string &firmware, ChecksumFieldKind kind, LocatedStructure &located)
+{
+	size_t length = firmware.length();
+	size_t fieldSize = (kind == CHECKSUM_FIELD_HEX) ? static_cast<size_t>(HexChecksumField::SIZE) :
+		static_cast<size_t>(BigEndianChecksumField::SIZE);
+	if (length < fieldSize)
+	{
+		return false;
+	}
+
+	// Checksum everything up to the tail once, then remember the running checksum at
+	// every point within the tail
+	size_t searchStart = (length > FILE_CHECKSUM_SEARCH) ? length - FILE_CHECKSUM_SEARCH : 0;
+	size_t tailStart = (searchStart > MAX_CHECKSUM_GAP) ? searchStart - MAX_CHECKSUM_GAP : 0;
+	vector<uint32_t> prefixAdler(length - tailStart + 1);
+	prefixAdler[0] = adler32Update(1, firmware.data(), tailStart);
+	for (size_t pos = tailStart; pos < length; pos++)
+	{
+		prefixAdler[pos - tailStart + 1] = adler32Update(prefixAdler[pos - tailStart], firmware.data() + pos, 1);
+	}
+
+	// Try fields from the end backwards, each covering as much of the file as it can
+	for (size_t fieldPos = length - fieldSize + 1; fieldPos-- > searchStart; )
+	{
+		uint32_t value;
+		if (kind == CHECKSUM_FIELD_HEX)
+		{
+			const char *field = firmware.data() + fieldPos;
+			bool isField = true;
+			for (size_t x = 0; x < fieldSize; x++)
+			{
+				isField = isField && isHexDigit(field[x]);
+			}
+			if (!isField)
+			{
+				continue;
+			}
+			HexChecksumField::read(field, value);
+		}
+		else
+		{
+			BigEndianChecksumField::read(firmware.data() + fieldPos, value);
+		}
+
+		for (size_t coveredEnd = fieldPos + 1; coveredEnd-- > tailStart && fieldPos - coveredEnd <= MAX_CHECKSUM_GAP; )
+		{
+			if (prefixAdler[coveredEnd - tailStart] == value)
+			{
+				located.checksumField = kind;
+				located.layout.fileChecksumPosBack = length - fieldPos;
+				located.layout.fileChecksumEndBack = length - coveredEnd;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool packetFollows(const string &rom, size_t prevPos, size_t pos)
+{
+	int32_t predictor, index;
+	imaDecodePacket(reinterpret_cast<const unsigned char *>(rom.data()) + prevPos, NULL, predictor, index);
+	uint16_t header = (static_cast<uint16_t>(static_cast<unsigned char>(rom[pos])) << 8) |
+		static_cast<unsigned char>(rom[pos + 1]);
+	return (header & 0x7F) == index && abs(static_cast<int16_t>(header & 0xFF80) - predictor) < PREDICTOR_SLACK;
+}
+
+static bool isSilentPacket(const string &rom, size_t pos)
+{
+	return rom.find_first_not_of('\0', pos) >= pos + BYTES_PER_PACKET;
+}
+
+static bool hasSoundHeader(const string &rom, size_t offset, size_t numPackets)
+{
+	if (offset < SOUND_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	// Look for the length of the sound (with or without the header, and in case the chime is
+	// followed by silence, the standard length too) as a big-endian 16 or 32-bit value
+	const size_t lengths[] = {
+		numPackets * BYTES_PER_PACKET, numPackets * BYTES_PER_PACKET + SOUND_HEADER_SIZE,
+		SOUND_COMPRESSED_SIZE, SOUND_COMPRESSED_SIZE + SOUND_HEADER_SIZE
+	};
+	const unsigned char *header = reinterpret_cast<const unsigned char *>(rom.data()) + offset - SOUND_HEADER_SIZE;
+	for (size_t pos = 0; pos + 2 <= SOUND_HEADER_SIZE; pos++)
+	{
+		uint32_t value16 = (static_cast<uint32_t>(header[pos]) << 8) | header[pos + 1];
+		uint32_t value32 = (pos + 4 <= SOUND_HEADER_SIZE) ?
+			(static_cast<uint32_t>(header[pos]) << 24) | (header[pos + 1] << 16) | (header[pos + 2] << 8) | header[pos + 3] : 0;
+		for (size_t x = 0; x < sizeof(lengths) / sizeof(lengths[0]); x++)
+		{
+			if (value16 == lengths[x] || value32 == lengths[x])
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool isHexDigit(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F');
+}
@@ -0,0 +1,53 @@
+#ifndef FIRMWARE_LOCATOR_H
+#define FIRMWARE_LOCATOR_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Works out a firmware file's layout from its contents instead of from hard-coded offsets, so
+// that a new firmware revision can be described without recompiling (see model_descriptor.h).
+//
+// The ROM image of an Ascii85 firmware file is the longest run of "dc85 " lines. Decoding it
+// gives the ROM checksum for every likely padded length and pad byte, and the ROM checksum
+// field is the 8-hex-digit word outside the ROM image that matches one of them. The file
+// checksum is whichever field near the end of the file matches the checksum of everything
+// before some point just ahead of it. The chime is found in the decoded ROM by locateChime.
+//
+// A raw ROM section has nothing in it to find it by, so for those only the file checksum is
+// located; the rest has to come from the firmware's own section table by hand.
+
+#include <string>
+#include "model_descriptor.h"
+
+struct LocatedStructure
+{
+	ContainerKind container;
+	ChecksumFieldKind checksumField;
+	// Fields that couldn't be located are UNKNOWN_OFFSET. name and firmwareName are left
+	// NULL, and so are md5 and maskedMd5 (the caller has the file).
+	ModelLayout layout;
+};
+
+// Where locateChime found a chime
+struct ChimeLocation
+{
+	size_t offset; // of its first packet in the ROM image
+	size_t numPackets; // packets that carry on from each other (including any silence right after it)
+	bool hasSoundHeader; // whether the 16 bytes before it give its length, like the slot-loading iMac's
+};
+
+// Scans a firmware file. Each step is a single linear pass, so this takes a few milliseconds.
+// Returns false if nothing at all was found.
+bool locateFirmwareStructure(const std::string &firmware, LocatedStructure &located);
+
+// Finds the IMA 4:1 chime in a decoded ROM image of any size. A single vectorized pass scores
+// each of the 34 possible packet alignments by its longest run of plausible packet headers
+// (see imaScanHeaders). Those runs are then decoded, to check that every packet carries on
+// from the predictor and step index the one before it left off at. Returns false if no run
+// is at least MIN_CHIME_PACKETS long.
+bool locateChime(const std::string &rom, ChimeLocation &location);
+
+// Shorter runs than this could just be chance
+#define MIN_CHIME_PACKETS 64
+
+#endif // FIRMWARE_LOCATOR_H
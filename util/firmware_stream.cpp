@@ -0,0 +1,268 @@
+#include "firmware_stream.h"
+#include "adler32.h"
+#include "patch_engine.h"
+#include <string.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+FirmwareReader::FirmwareReader(size_t bufferSize) :
+	buffer(bufferSize),
+	bufStart(0),
+	bufEnd(0),
+	fileLength(0),
+	filePos(0),
+	checksumEnd(0),
+	adler(1)
+{
+}
+
+bool FirmwareReader::open(const char *filename)
+{
+	file.open(filename, ios::in | ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	file.seekg(0, ios::end);
+	streamoff size = file.tellg();
+	file.seekg(0, ios::beg);
+	if (size < 0)
+	{
+		return false;
+	}
+	fileLength = static_cast<size_t>(size);
+	return true;
+}
+
+bool FirmwareReader::fill(size_t len)
+{
+	if (bufEnd - bufStart >= len)
+	{
+		return true;
+	}
+	if (len > buffer.size() || filePos + len > fileLength)
+	{
+		return false;
+	}
+
+	// Slide what's left to the front and top the buffer up
+	memmove(buffer.data(), buffer.data() + bufStart, bufEnd - bufStart);
+	bufEnd -= bufStart;
+	bufStart = 0;
+	size_t wanted = buffer.size() - bufEnd;
+	if (wanted > fileLength - filePos - bufEnd) wanted = fileLength - filePos - bufEnd;
+	file.read(buffer.data() + bufEnd, wanted);
+	bufEnd += static_cast<size_t>(file.gcount());
+	return bufEnd - bufStart >= len;
+}
+
+void FirmwareReader::consume(size_t len)
+{
+	if (filePos < checksumEnd)
+	{
+		size_t checksummed = (filePos + len <= checksumEnd) ? len : checksumEnd - filePos;
+		adler = adler32Update(adler, buffer.data() + bufStart, checksummed);
+	}
+	bufStart += len;
+	filePos += len;
+}
+
+bool FirmwareReader::skipTo(size_t pos)
+{
+	if (pos < filePos || pos > fileLength)
+	{
+		return false;
+	}
+
+	// Nothing to checksum on the way? Then don't bother reading it.
+	if (filePos >= checksumEnd && pos > filePos + (bufEnd - bufStart))
+	{
+		file.clear();
+		file.seekg(static_cast<streamoff>(pos), ios::beg);
+		bufStart = bufEnd = 0;
+		filePos = pos;
+		return file.good();
+	}
+
+	while (filePos < pos)
+	{
+		size_t len = pos - filePos;
+		if (len > buffer.size()) len = buffer.size();
+		if (!fill(len))
+		{
+			return false;
+		}
+		consume(len);
+	}
+	return true;
+}
+
+bool FirmwareReader::read(char *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t chunk = (len > buffer.size()) ? buffer.size() : len;
+		if (!fill(chunk))
+		{
+			return false;
+		}
+		memcpy(data, buffer.data() + bufStart, chunk);
+		consume(chunk);
+		data += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+const char *FirmwareReader::peek(size_t len)
+{
+	return fill(len) ? buffer.data() + bufStart : NULL;
+}
+
+bool FirmwareReader::readLine(char terminator, string &line, size_t maxLen)
+{
+	// Grab as much as is available (up to maxLen plus the terminator) and look in that
+	size_t available = maxLen + 1;
+	if (available > fileLength - filePos) available = fileLength - filePos;
+	if (!fill(available))
+	{
+		return false;
+	}
+	const char *start = buffer.data() + bufStart;
+	const char *end = static_cast<const char *>(memchr(start, terminator, available));
+	if (!end)
+	{
+		return false;
+	}
+	line.assign(start, end - start);
+	consume(end - start + 1);
+	return true;
+}
+
+FirmwareWriter::FirmwareWriter(size_t bufferSize) :
+	buffer(bufferSize),
+	used(0),
+	checksumming(true),
+	adler(1)
+{
+}
+
+bool FirmwareWriter::open(const char *filename)
+{
+	// Everything goes through our buffer, so the stream doesn't need one of its own
+	file.rdbuf()->pubsetbuf(NULL, 0);
+	file.open(filename, ios::out | ios::trunc | ios::binary);
+	return file.is_open();
+}
+
+void FirmwareWriter::write(const char *data, size_t len)
+{
+	if (checksumming)
+	{
+		adler = adler32Update(adler, data, len);
+	}
+	while (len > 0)
+	{
+		size_t chunk = buffer.size() - used;
+		if (chunk > len) chunk = len;
+		memcpy(buffer.data() + used, data, chunk);
+		used += chunk;
+		data += chunk;
+		len -= chunk;
+		if (used == buffer.size())
+		{
+			flush();
+		}
+	}
+}
+
+void FirmwareWriter::flush()
+{
+	file.write(buffer.data(), used);
+	used = 0;
+}
+
+bool FirmwareWriter::close()
+{
+	flush();
+	file.close();
+	return !file.fail();
+}
+
+bool copyFirmware(FirmwareReader &reader, FirmwareWriter &writer, size_t end)
+{
+	while (reader.position() < end)
+	{
+		size_t len = end - reader.position();
+		if (len > reader.capacity()) len = reader.capacity();
+		const char *data = reader.peek(len);
+		if (!data)
+		{
+			return false;
+		}
+		writer.write(data, len);
+		reader.skip(len);
+	}
+	return true;
+}
+
+ChimeCapture::ChimeCapture(size_t soundOffset, string &chime) :
+	soundOffset(soundOffset),
+	romLength(0),
+	chime(chime)
+{
+	chime.clear();
+}
+
+void ChimeCapture::feed(const char *data, size_t len)
+{
+	size_t soundEnd = soundOffset + SOUND_COMPRESSED_SIZE;
+	size_t begin = (romLength > soundOffset) ? romLength : soundOffset;
+	size_t end = (romLength + len < soundEnd) ? romLength + len : soundEnd;
+	if (begin < end)
+	{
+		chime.append(data + (begin - romLength), end - begin);
+	}
+	romLength += len;
+}
+
+RomChecker::RomChecker(size_t soundOffset) :
+	soundOffset(soundOffset),
+	romLength(0),
+	adler(1),
+	badPacket(-1),
+	headerHigh(0)
+{
+}
+
+void RomChecker::feed(const char *data, size_t len)
+{
+	adler = adler32Update(adler, data, len);
+
+	// Look at the packet headers in whatever part of the chime this covers
+	size_t soundEnd = soundOffset + SOUND_COMPRESSED_SIZE;
+	size_t begin = (romLength > soundOffset) ? romLength : soundOffset;
+	size_t end = (romLength + len < soundEnd) ? romLength + len : soundEnd;
+	for (size_t pos = begin; pos < end; pos++)
+	{
+		size_t packetPos = (pos - soundOffset) % BYTES_PER_PACKET;
+		unsigned char c = static_cast<unsigned char>(data[pos - romLength]);
+		if (packetPos == 0)
+		{
+			headerHigh = c;
+		}
+		else if (packetPos == 1)
+		{
+			uint16_t header = (static_cast<uint16_t>(headerHigh) << 8) | c;
+			if ((header & 0x7F) > 88 && badPacket < 0)
+			{
+				badPacket = static_cast<long>((pos - soundOffset) / BYTES_PER_PACKET);
+			}
+		}
+	}
+
+	romLength += len;
+}
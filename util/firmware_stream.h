@@ -0,0 +1,150 @@
+#ifndef FIRMWARE_STREAM_H
+#define FIRMWARE_STREAM_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Building blocks for checking or patching a firmware file front to back without ever
+// holding more than a small window of it in memory (see PatchEngine::verifyFirmware and
+// PatchEngine::streamPatch).
+
+#include <fstream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Reads a file front to back through a fixed-size buffer, keeping a running adler32 of
+// everything read before the checksum end
+class FirmwareReader
+{
+public:
+	enum { BUFFER_SIZE = 64 * 1024 };
+
+	explicit FirmwareReader(size_t bufferSize = BUFFER_SIZE);
+
+	bool open(const char *filename);
+	size_t length() const { return fileLength; }
+	size_t position() const { return filePos; }
+	size_t capacity() const { return buffer.size(); } // the most that can be peeked at once
+
+	// Only the bytes before end are checksummed. Past it, skipTo() seeks instead of reading.
+	void setChecksumEnd(size_t end) { checksumEnd = end; }
+	// adler32 of everything read so far (up to the checksum end)
+	uint32_t checksum() const { return adler; }
+
+	// Moves forward to pos, reading (and checksumming) everything in between if needed
+	bool skipTo(size_t pos);
+	// Moves forward len bytes
+	bool skip(size_t len) { return skipTo(filePos + len); }
+	// Reads the next len bytes
+	bool read(char *data, size_t len);
+	// Returns the next len bytes (at most capacity()) without moving past them, or NULL if
+	// there aren't that many left
+	const char *peek(size_t len);
+	// Reads up to (but not including) the next terminator, then moves past the terminator.
+	// Fails if there's no terminator in the next maxLen bytes.
+	bool readLine(char terminator, std::string &line, size_t maxLen);
+
+private:
+	bool fill(size_t len); // makes sure at least len bytes are buffered
+	void consume(size_t len); // moves past len buffered bytes
+
+	std::ifstream file;
+	std::vector<char> buffer;
+	size_t bufStart; // first unread byte in buffer
+	size_t bufEnd; // end of valid data in buffer
+	size_t fileLength;
+	size_t filePos; // file position of buffer[bufStart]
+	size_t checksumEnd;
+	uint32_t adler;
+};
+
+// Writes a file front to back through a fixed-size buffer, keeping a running adler32 of
+// everything written until stopChecksum() is called
+class FirmwareWriter
+{
+public:
+	explicit FirmwareWriter(size_t bufferSize = FirmwareReader::BUFFER_SIZE);
+
+	bool open(const char *filename);
+	void write(const char *data, size_t len);
+	// Nothing written from now on is checksummed
+	void stopChecksum() { checksumming = false; }
+	uint32_t checksum() const { return adler; }
+	// Writes out whatever is still buffered. Returns false if any of the file failed to write.
+	bool close();
+
+private:
+	void flush();
+
+	std::ofstream file;
+	std::vector<char> buffer;
+	size_t used;
+	bool checksumming;
+	uint32_t adler;
+};
+
+// Copies everything from the reader's position up to end straight to the writer
+bool copyFirmware(FirmwareReader &reader, FirmwareWriter &writer, size_t end);
+
+// Follows the decoded ROM image as it goes by: its adler32 and the IMA 4:1 packet headers
+// of the chime (each packet starts with a 16-bit header whose low 7 bits are a step index)
+class RomChecker
+{
+public:
+	explicit RomChecker(size_t soundOffset);
+
+	void feed(const char *data, size_t len);
+
+	size_t length() const { return romLength; }
+	uint32_t checksum() const { return adler; }
+	// Whether every packet header in the chime seen so far has a valid step index (0-88)
+	bool soundOk() const { return badPacket < 0; }
+	// The first packet with a bad header, or -1
+	long firstBadPacket() const { return badPacket; }
+
+private:
+	size_t soundOffset;
+	size_t romLength;
+	uint32_t adler;
+	long badPacket;
+	unsigned char headerHigh; // first byte of the header being read
+};
+
+// Picks the chime out of the decoded ROM image as it goes by
+class ChimeCapture
+{
+public:
+	ChimeCapture(size_t soundOffset, std::string &chime);
+
+	void feed(const char *data, size_t len);
+
+	size_t length() const { return romLength; }
+
+private:
+	size_t soundOffset;
+	size_t romLength;
+	std::string &chime;
+};
+
+// Everything verifyFirmware found out about a file
+struct VerifyResult
+{
+	const char *error; // why the file couldn't be checked at all (NULL if it could)
+	uint32_t romChecksum; // of the decoded ROM image, padded like the original
+	uint32_t storedRomChecksum;
+	uint32_t fileChecksum;
+	uint32_t storedFileChecksum;
+	long badPacket; // first chime packet with an invalid header, or -1
+
+	VerifyResult() : error(NULL), romChecksum(0), storedRomChecksum(0), fileChecksum(0),
+		storedFileChecksum(0), badPacket(-1) {}
+
+	bool romChecksumOk() const { return !error && romChecksum == storedRomChecksum; }
+	bool fileChecksumOk() const { return !error && fileChecksum == storedFileChecksum; }
+	bool soundOk() const { return !error && badPacket < 0; }
+	bool ok() const { return romChecksumOk() && fileChecksumOk() && soundOk(); }
+};
+
+#endif // FIRMWARE_STREAM_H
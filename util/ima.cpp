@@ -1,5 +1,12 @@
 #include "ima.h"
+#include "cpu_dispatch.h"
+#include "kernels.h"
 #include <stdint.h>
+#include <string.h>
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+#endif
 
 // Index table used by encoding algorithm
 static const int ima_index_table[] = {
@@ -21,7 +28,177 @@ static const int ima_step_table[] = {
 };
 #define NUM_STEP_TABLE_ENTRIES (sizeof(ima_step_table)/sizeof(ima_step_table[0]))
 
+// Packet layout (the same as in patch_engine.h)
+#define PACKET_BYTES 34
+#define PACKET_SAMPLES 64
+#define MAX_STEP_INDEX 88
+
 void imaEncode(const std::string &input, std::string &output)
+{
+	kernels().imaEncode(input, output);
+}
+
+void imaDecodePacket(const unsigned char *packet, int16_t *samples, int32_t &predictor, int32_t &index)
+{
+	// The header has the top 9 bits of the predictor and the step index
+	uint16_t header = (static_cast<uint16_t>(packet[0]) << 8) | packet[1];
+	predictor = static_cast<int16_t>(header & 0xFF80);
+	index = header & 0x7F;
+	if (index > MAX_STEP_INDEX) index = MAX_STEP_INDEX;
+
+	// Then the samples, two to a byte, low nibble first
+	for (int x = 0; x < PACKET_SAMPLES; x++)
+	{
+		uint8_t nibble = (packet[2 + x / 2] >> ((x % 2) * 4)) & 0x0F;
+		int32_t stepsize = ima_step_table[index];
+		int32_t difference = stepsize >> 3;
+		if (nibble & (1 << 2)) difference += stepsize;
+		if (nibble & (1 << 1)) difference += stepsize >> 1;
+		if (nibble & (1 << 0)) difference += stepsize >> 2;
+		if (nibble & (1 << 3)) difference = -difference;
+
+		predictor += difference;
+		if (predictor > 32767) predictor = 32767;
+		else if (predictor < -32768) predictor = -32768;
+		index += ima_index_table[nibble];
+		if (index < 0) index = 0;
+		else if (index > MAX_STEP_INDEX) index = MAX_STEP_INDEX;
+
+		if (samples)
+		{
+			samples[x] = static_cast<int16_t>(predictor);
+		}
+	}
+}
+
+void imaScanHeaders(const std::string &data, ImaHeaderScan &scan)
+{
+	memset(&scan, 0, sizeof(scan));
+	kernels().imaScanHeaders(reinterpret_cast<const unsigned char *>(data.data()), data.length(), scan);
+}
+
+// Scans rows from firstRow to the end of the data, one lane at a time. Packets that would run
+// past the end don't count.
+static KERNEL_INLINE void imaScanHeadersTail(const unsigned char *data, size_t len, size_t firstRow,
+											 ImaHeaderScan &scan)
+{
+	for (size_t row = firstRow; row * PACKET_BYTES < len; row++)
+	{
+		for (size_t lane = 0; lane < PACKET_BYTES; lane++)
+		{
+			size_t pos = row * PACKET_BYTES + lane;
+			bool valid = pos + PACKET_BYTES <= len && (data[pos + 1] & 0x7F) <= MAX_STEP_INDEX &&
+				(data[pos] | data[pos + 1]) != 0;
+			uint16_t run = valid ? scan.run[lane] + (scan.run[lane] < 0xFFFF) : 0;
+			scan.run[lane] = run;
+			if (run > scan.best[lane])
+			{
+				scan.best[lane] = run;
+				scan.bestEnd[lane] = static_cast<uint32_t>(row + 1);
+			}
+		}
+	}
+}
+
+// Rows the vector kernels can read without running off the end (their loads reach 66 bytes
+// into a row, and every lane's packet has to fit)
+static KERNEL_INLINE size_t vectorRows(size_t len)
+{
+	return (len >= 2 * PACKET_BYTES) ? (len - 2 * PACKET_BYTES) / PACKET_BYTES + 1 : 0;
+}
+
+// Records the rows where lanes' runs got longer than their best. bits has one bit per lane,
+// or every other bit for each lane if bitsPerLane is 2, starting at firstLane.
+static KERNEL_INLINE void markImproved(ImaHeaderScan &scan, uint64_t bits, int bitsPerLane, size_t firstLane,
+									   uint32_t rowEnd)
+{
+	while (bits)
+	{
+		int bit = __builtin_ctzll(bits);
+		size_t lane = firstLane + bit / bitsPerLane;
+		if (lane < PACKET_BYTES)
+		{
+			scan.bestEnd[lane] = rowEnd;
+		}
+		bits &= ~(((1ULL << bitsPerLane) - 1) << bit);
+	}
+}
+
+// Encodes one sample, moving the predictor and step index along. This is just the standard
+// IMA encoding algorithm.
+static KERNEL_INLINE uint8_t imaEncodeSample(int16_t sample, int32_t &predictedSample, int32_t &index)
+{
+	int32_t stepsize = ima_step_table[index];
+	int32_t difference = sample - predictedSample;
+	uint8_t newSample;
+	if (difference >= 0)
+	{
+		newSample = (0 << 3); // sign bit = 0
+	}
+	else
+	{
+		newSample = (1 << 3); // sign bit = 1
+		difference = -difference;
+	}
+	
+	// Now the difference is an absolute value.
+	
+	// Following loop really computes:
+	// newSample[2:0] = 4 * (difference / stepsize)
+	uint8_t mask = (1 << 2);
+	int tempStepSize = stepsize;
+	while (mask)
+	{
+		if (difference >= tempStepSize)
+		{
+			newSample |= mask;
+			difference -= tempStepSize;
+		}
+		tempStepSize >>= 1;
+		mask >>= 1;
+	}
+	
+	// Figure out the next predictor
+	// Really computes:
+	// difference = (newSample + 0.5f) * stepsize/4
+	// without needing floating-point
+	difference = 0;
+	if (newSample & (1 << 2))
+	{
+		difference += stepsize;
+	}
+	if (newSample & (1 << 1))
+	{
+		difference += stepsize >> 1;
+	}
+	if (newSample & (1 << 0))
+	{
+		difference += stepsize >> 2;
+	}
+	difference += stepsize >> 3;
+	
+	// Sign bit, of course
+	if (newSample & (1 << 3))
+	{
+		difference = -difference;
+	}
+	
+	// Adjust the predictor and clamp it.
+	predictedSample += difference;
+	if (predictedSample > 32767) predictedSample = 32767;
+	else if (predictedSample < -32768) predictedSample = -32768;
+	
+	// Figure out next index and clamp it.
+	index += ima_index_table[newSample];
+	if (index < 0) index = 0;
+	else if (index >= NUM_STEP_TABLE_ENTRIES) index = NUM_STEP_TABLE_ENTRIES - 1;
+
+	return newSample;
+}
+
+// Every sample depends on the one before it, so there's nothing to vectorize; every level's
+// table uses this one.
+void imaEncodeScalar(const std::string &input, std::string &output)
 {
 	size_t sampleCounter = 0;
 	size_t curPos = 0;
@@ -29,7 +206,9 @@ void imaEncode(const std::string &input, std::string &output)
 	// Predictors start at zero
 	int32_t predictedSample = 0;
 	int32_t index = 0;
-	int32_t stepsize = ima_step_table[index];
+	
+	// Every 64 samples become a 2 byte header plus 32 bytes of nibbles
+	output.reserve(output.length() + ((input.length() + 127) / 128) * 34);
 	
 	// Saves samples to accumulate 2 nibbles
 	uint8_t tempNibbles = 0;
@@ -56,36 +235,8 @@ void imaEncode(const std::string &input, std::string &output)
 		//uint8_t sampleB2 = static_cast<uint8_t>(input[curPos]);
 		int16_t sample = static_cast<int16_t>((sampleB1 << 8) | sampleB2);
 
-		// This is just the standard IMA encoding algorithm at this point
-		int32_t difference = sample - predictedSample;
-		uint8_t newSample;
-		if (difference >= 0)
-		{
-			newSample = (0 << 3); // sign bit = 0
-		}
-		else
-		{
-			newSample = (1 << 3); // sign bit = 1
-			difference = -difference;
-		}
-		
-		// Now the difference is an absolute value.
-		
-		// Following loop really computes:
-		// newSample[2:0] = 4 * (difference / stepsize)
-		uint8_t mask = (1 << 2);
-		int tempStepSize = stepsize;
-		while (mask)
-		{
-			if (difference >= tempStepSize)
-			{
-				newSample |= mask;
-				difference -= tempStepSize;
-			}
-			tempStepSize >>= 1;
-			mask >>= 1;
-		}
-		
+		uint8_t newSample = imaEncodeSample(sample, predictedSample, index);
+
 		// We now have an IMA sample -- save it!
 		if ((sampleCounter % 2) == 0)
 		{
@@ -99,42 +250,6 @@ void imaEncode(const std::string &input, std::string &output)
 			output.append(1, tempNibbles);
 		}
 		
-		// Figure out the next predictor
-		// Really computes:
-		// difference = (newSample + 0.5f) * stepsize/4
-		// without needing floating-point
-		difference = 0;
-		if (newSample & (1 << 2))
-		{
-			difference += stepsize;
-		}
-		if (newSample & (1 << 1))
-		{
-			difference += stepsize >> 1;
-		}
-		if (newSample & (1 << 0))
-		{
-			difference += stepsize >> 2;
-		}
-		difference += stepsize >> 3;
-		
-		// Sign bit, of course
-		if (newSample & (1 << 3))
-		{
-			difference = -difference;
-		}
-		
-		// Adjust the predictor and clamp it.
-		predictedSample += difference;
-		if (predictedSample > 32767) predictedSample = 32767;
-		else if (predictedSample < -32768) predictedSample = -32768;
-		
-		// Figure out next index, clamp it, and grab the next step size.
-		index += ima_index_table[newSample];
-		if (index < 0) index = 0;
-		else if (index >= NUM_STEP_TABLE_ENTRIES) index = NUM_STEP_TABLE_ENTRIES - 1;
-		stepsize = ima_step_table[index];
-		
 		// Move on to the next sample -- figure out when it's time to do another header.
 		sampleCounter = (sampleCounter + 1) % 64;
 		
@@ -143,3 +258,156 @@ void imaEncode(const std::string &input, std::string &output)
 	}
 }
 
+void imaEncodePacket(const unsigned char *input, ImaEncoderState &state, unsigned char *output)
+{
+	// The same header, then the same nibbles, as imaEncodeScalar would write here
+	uint16_t header = (state.predictor & 0xFF80) | state.index;
+	output[0] = static_cast<unsigned char>(header >> 8);
+	output[1] = static_cast<unsigned char>(header & 0xFF);
+	for (int x = 0; x < PACKET_SAMPLES; x += 2)
+	{
+		int16_t first = static_cast<int16_t>((input[2 * x] << 8) | input[2 * x + 1]);
+		int16_t second = static_cast<int16_t>((input[2 * x + 2] << 8) | input[2 * x + 3]);
+		uint8_t low = imaEncodeSample(first, state.predictor, state.index);
+		uint8_t high = imaEncodeSample(second, state.predictor, state.index);
+		output[2 + x / 2] = static_cast<unsigned char>((low & 0x0F) | (high << 4));
+	}
+}
+
+void imaScanHeadersScalar(const unsigned char *data, size_t len, ImaHeaderScan &scan)
+{
+	imaScanHeadersTail(data, len, 0, scan);
+}
+
+#ifdef KERNELS_X86
+// The vector kernels do every lane of a row at once: 16-bit lanes, with the header's high
+// byte from row + lane and its low byte from row + lane + 1. Finding where a run became the
+// longest is the only scalar part, and that hardly ever happens outside of an actual chime.
+
+TARGET_SSE41 void imaScanHeadersSse41(const unsigned char *data, size_t len, ImaHeaderScan &scan)
+{
+	const int VECTORS = 5; // 40 lanes
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i indexMask = _mm_set1_epi16(0x7F);
+	const __m128i maxIndex = _mm_set1_epi16(MAX_STEP_INDEX + 1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i run[VECTORS], best[VECTORS];
+	for (int v = 0; v < VECTORS; v++)
+	{
+		run[v] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scan.run + 8 * v));
+		best[v] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scan.best + 8 * v));
+	}
+
+	size_t rows = vectorRows(len);
+	for (size_t row = 0; row < rows; row++)
+	{
+		const unsigned char *rowData = data + row * PACKET_BYTES;
+		for (int v = 0; v < VECTORS; v++)
+		{
+			__m128i high = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rowData + 8 * v)));
+			__m128i low = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rowData + 8 * v + 1)));
+			__m128i valid = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_or_si128(high, low), zero),
+											 _mm_cmpgt_epi16(maxIndex, _mm_and_si128(low, indexMask)));
+			run[v] = _mm_and_si128(_mm_adds_epu16(run[v], ones), valid);
+			__m128i newBest = _mm_max_epu16(best[v], run[v]);
+			uint32_t improved = ~_mm_movemask_epi8(_mm_cmpeq_epi16(newBest, best[v])) & 0xFFFF;
+			best[v] = newBest;
+			if (improved)
+			{
+				markImproved(scan, improved, 2, 8 * v, static_cast<uint32_t>(row + 1));
+			}
+		}
+	}
+
+	for (int v = 0; v < VECTORS; v++)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(scan.run + 8 * v), run[v]);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(scan.best + 8 * v), best[v]);
+	}
+	imaScanHeadersTail(data, len, rows, scan);
+}
+
+TARGET_AVX2 void imaScanHeadersAvx2(const unsigned char *data, size_t len, ImaHeaderScan &scan)
+{
+	const int VECTORS = 3; // 48 lanes
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i indexMask = _mm256_set1_epi16(0x7F);
+	const __m256i maxIndex = _mm256_set1_epi16(MAX_STEP_INDEX + 1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i run[VECTORS], best[VECTORS];
+	for (int v = 0; v < VECTORS; v++)
+	{
+		run[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scan.run + 16 * v));
+		best[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scan.best + 16 * v));
+	}
+
+	size_t rows = vectorRows(len);
+	for (size_t row = 0; row < rows; row++)
+	{
+		const unsigned char *rowData = data + row * PACKET_BYTES;
+		for (int v = 0; v < VECTORS; v++)
+		{
+			__m256i high = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rowData + 16 * v)));
+			__m256i low = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rowData + 16 * v + 1)));
+			__m256i valid = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_or_si256(high, low), zero),
+												_mm256_cmpgt_epi16(maxIndex, _mm256_and_si256(low, indexMask)));
+			run[v] = _mm256_and_si256(_mm256_adds_epu16(run[v], ones), valid);
+			__m256i newBest = _mm256_max_epu16(best[v], run[v]);
+			uint32_t improved = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(newBest, best[v])));
+			best[v] = newBest;
+			if (improved)
+			{
+				markImproved(scan, improved, 2, 16 * v, static_cast<uint32_t>(row + 1));
+			}
+		}
+	}
+
+	for (int v = 0; v < VECTORS; v++)
+	{
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(scan.run + 16 * v), run[v]);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(scan.best + 16 * v), best[v]);
+	}
+	imaScanHeadersTail(data, len, rows, scan);
+}
+
+TARGET_AVX512 void imaScanHeadersAvx512(const unsigned char *data, size_t len, ImaHeaderScan &scan)
+{
+	const int VECTORS = 2; // 64 lanes
+	const __m512i ones = _mm512_set1_epi16(1);
+	const __m512i indexMask = _mm512_set1_epi16(0x7F);
+	const __m512i maxIndex = _mm512_set1_epi16(MAX_STEP_INDEX);
+	__m512i run[VECTORS], best[VECTORS];
+	for (int v = 0; v < VECTORS; v++)
+	{
+		run[v] = _mm512_loadu_si512(scan.run + 32 * v);
+		best[v] = _mm512_loadu_si512(scan.best + 32 * v);
+	}
+
+	size_t rows = vectorRows(len);
+	for (size_t row = 0; row < rows; row++)
+	{
+		const unsigned char *rowData = data + row * PACKET_BYTES;
+		for (int v = 0; v < VECTORS; v++)
+		{
+			__m512i high = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(rowData + 32 * v)));
+			__m512i low = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(rowData + 32 * v + 1)));
+			__mmask32 valid = _mm512_test_epi16_mask(_mm512_or_si512(high, low), _mm512_or_si512(high, low)) &
+				_mm512_cmple_epu16_mask(_mm512_and_si512(low, indexMask), maxIndex);
+			run[v] = _mm512_maskz_adds_epu16(valid, run[v], ones);
+			__mmask32 improved = _mm512_cmpgt_epu16_mask(run[v], best[v]);
+			best[v] = _mm512_max_epu16(best[v], run[v]);
+			if (improved)
+			{
+				markImproved(scan, improved, 1, 32 * v, static_cast<uint32_t>(row + 1));
+			}
+		}
+	}
+
+	for (int v = 0; v < VECTORS; v++)
+	{
+		_mm512_storeu_si512(scan.run + 32 * v, run[v]);
+		_mm512_storeu_si512(scan.best + 32 * v, best[v]);
+	}
+	imaScanHeadersTail(data, len, rows, scan);
+}
+#endif // KERNELS_X86
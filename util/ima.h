@@ -1,10 +1,47 @@
 #ifndef IMA_H
 #define IMA_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 
 // Takes input bytes (assumed to be a multiple of 64 2-byte samples) and encodes in IMA 4:1
 void imaEncode(const std::string &input, std::string &output);
 
-#endif
+// Where the encoder is at the start of a packet. This carries over from one packet to the next,
+// and a packet's header only has part of the predictor, so picking up encoding partway through
+// a sound needs the state imaEncodePacket left behind for the packet before.
+struct ImaEncoderState
+{
+	int32_t predictor;
+	int32_t index;
+};
+
+// Encodes 64 samples (128 bytes, big-endian) into one 34-byte packet, exactly the way imaEncode
+// would if it got to those samples in state. state is left where the packet ends. imaEncode
+// starts from a predictor and index of zero.
+void imaEncodePacket(const unsigned char *input, ImaEncoderState &state, unsigned char *output);
+
+// Decodes one 34-byte packet (2-byte header, then 32 bytes of nibbles) into 64 samples.
+// samples can be NULL. predictor and index are set to where the packet leaves off, which is
+// what the next packet's header should say if the two were encoded one after the other.
+void imaDecodePacket(const unsigned char *packet, int16_t *samples, int32_t &predictor, int32_t &index);
+
+// Lanes in an ImaHeaderScan. Only the first 34 (one per possible packet alignment) mean
+// anything; the rest are scratch space for the vector kernels.
+#define IMA_SCAN_LANES 64
 
+// Runs of plausible packet headers in a block of data, for each of the 34 ways packets could
+// line up with it. A plausible header is nonzero and has a step index of 88 or less. Row k
+// of lane r is the packet starting at byte 34 * k + r.
+struct ImaHeaderScan
+{
+	uint16_t run[IMA_SCAN_LANES]; // length of the run ending at the current row (saturates)
+	uint16_t best[IMA_SCAN_LANES]; // length of the longest run so far
+	uint32_t bestEnd[IMA_SCAN_LANES]; // the row just past the longest run
+};
+
+// Scans data for runs of plausible packet headers, in a single pass
+void imaScanHeaders(const std::string &data, ImaHeaderScan &scan);
+
+#endif
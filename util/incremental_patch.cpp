@@ -0,0 +1,119 @@
+#include "incremental_patch.h"
+#include "stats.h"
+#include <string.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Raw sound bytes that go into one packet
+static const size_t RAW_BYTES_PER_PACKET = SAMPLES_PER_PACKET * BYTES_PER_SAMPLE;
+
+IncrementalPatcher::IncrementalPatcher(const FirmwareImage &base) :
+	baseImage(base),
+	soundContext(base),
+	patched(false),
+	encodedPackets(0)
+{
+}
+
+ChimeError IncrementalPatcher::loadSoundFile(const char *filename)
+{
+	if (!baseImage.isLoaded())
+	{
+		return CHIME_ERR_NOT_READY;
+	}
+	ChimeError error = soundContext.loadSoundFile(filename);
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+
+	// An already-compressed chime is used as-is. It can't be compared with a raw sound, so
+	// the next raw sound gets encoded from scratch.
+	encodedPackets = 0;
+	if (soundContext.precompressed())
+	{
+		nextChime = soundContext.compressedSound();
+		rawSound.clear();
+	}
+	else
+	{
+		StageTimer timer("imaEncode", SOUND_MAX_SIZE);
+		encodeChanges(soundContext.sound());
+	}
+
+	const ModelInfo &model = *baseImage.model();
+	if (!patched)
+	{
+		StageTimer timer("patch", baseImage.firmware().length());
+		model.patchIncremental(baseImage.layout(), baseImage.firmware(), baseImage.romData(), baseImage.romLength(),
+							   nextChime, baseImage.checksumParts(), patch);
+		patched = true;
+	}
+	else
+	{
+		// Only the part of the chime from the first packet that's different to the last one is swapped in
+		size_t start = 0;
+		while (start < SOUND_COMPRESSED_SIZE && nextChime[start] == compressedSound[start])
+		{
+			start++;
+		}
+		size_t end = SOUND_COMPRESSED_SIZE;
+		while (end > start && nextChime[end - 1] == compressedSound[end - 1])
+		{
+			end--;
+		}
+		if (start < end)
+		{
+			StageTimer timer("repatch", end - start);
+			model.repatchIncremental(patch, nextChime, start, end);
+		}
+		else
+		{
+			patch.changed.clear();
+		}
+	}
+	compressedSound.swap(nextChime);
+	return CHIME_OK;
+}
+
+void IncrementalPatcher::encodeChanges(const string &sound)
+{
+	paddedSound.assign(sound);
+	paddedSound.append(SOUND_MAX_SIZE - paddedSound.length(), '\0');
+	bool fresh = rawSound.empty();
+	if (fresh)
+	{
+		ImaEncoderState silence = {0, 0};
+		packetStates.assign(NUM_SOUND_PACKETS + 1, silence);
+		nextChime.assign(SOUND_COMPRESSED_SIZE, '\0');
+	}
+	else
+	{
+		nextChime = compressedSound;
+	}
+
+	// A packet comes out the same if its samples and the state the encoder starts it in are
+	// the same as last time. The state that packetStates has for the next packet is still the
+	// old one, to compare against.
+	ImaEncoderState state = packetStates[0];
+	for (size_t x = 0; x < NUM_SOUND_PACKETS; x++)
+	{
+		const char *input = paddedSound.data() + x * RAW_BYTES_PER_PACKET;
+		ImaEncoderState &start = packetStates[x];
+		if (!fresh && state.predictor == start.predictor && state.index == start.index &&
+			memcmp(input, rawSound.data() + x * RAW_BYTES_PER_PACKET, RAW_BYTES_PER_PACKET) == 0)
+		{
+			state = packetStates[x + 1];
+			continue;
+		}
+		start = state;
+		imaEncodePacket(reinterpret_cast<const unsigned char *>(input), state,
+						reinterpret_cast<unsigned char *>(&nextChime[x * BYTES_PER_PACKET]));
+		encodedPackets++;
+	}
+	packetStates[NUM_SOUND_PACKETS] = state;
+	rawSound.swap(paddedSound);
+}
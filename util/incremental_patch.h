@@ -0,0 +1,49 @@
+#ifndef INCREMENTAL_PATCH_H
+#define INCREMENTAL_PATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Keeps a patched firmware file in memory and updates it as the sound changes, redoing only
+// what the change touches. The IMA encoder's state is saved at the start of every packet, so
+// encoding can pick up at the first packet whose samples changed, and stops as soon as it's
+// back in step with the last encode. Only the pieces of the ROM image those packets are in are
+// re-encoded, and the checksums are adjusted instead of being recalculated (see
+// PatchEngine::repatchIncremental). Made for a sound that's being tweaked over and over, where
+// each edit only changes part of it.
+
+#include <string>
+#include <vector>
+#include "chimepatch.h"
+#include "ima.h"
+
+class IncrementalPatcher
+{
+public:
+	explicit IncrementalPatcher(const FirmwareImage &base);
+
+	// Loads a sound file (anything PatchContext::loadSoundFile takes) and puts it into the
+	// patched firmware. The first time, the whole file is patched. After that, only what's
+	// different from the last sound is redone. If this fails, the last patch is left alone.
+	ChimeError loadSoundFile(const char *filename);
+
+	const std::string &output() const { return patch.firmware; } // the patched firmware file
+	const std::vector<FirmwareRange> &changed() const { return patch.changed; } // what the last sound changed in output()
+	size_t packetsEncoded() const { return encodedPackets; } // IMA packets the last sound needed encoded
+
+private:
+	void encodeChanges(const std::string &sound); // encodes the packets of a raw sound that have changed into nextChime
+
+	const FirmwareImage &baseImage;
+	PatchContext soundContext; // loads and checks sound files
+	IncrementalPatch patch;
+	bool patched;
+	std::string rawSound; // the last raw sound, padded out (empty if the last sound wasn't raw)
+	std::string paddedSound; // the new raw sound, padded out
+	std::vector<ImaEncoderState> packetStates; // the encoder's state at the start of each packet of rawSound (and the end)
+	std::string compressedSound; // the chime in patch
+	std::string nextChime; // the chime being put together
+	size_t encodedPackets;
+};
+
+#endif // INCREMENTAL_PATCH_H
@@ -0,0 +1,806 @@
+#include <iostream>
+#include <chrono>
+#include <iomanip>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this. I wrote all the code, borrowing a few
+// algorithms from different sources. Only thing I didn't write was md5.c and md5.h -- see
+// those files for the terms and conditions of using the MD5 code.
+
+#include "inject_chime_main.h"
+#include "batch.h"
+#include "chime_preview.h"
+#include "chimepatch.h"
+#include "cpu_dispatch.h"
+#include "files.h"
+#include "firmware_locator.h"
+#include "md5.h"
+#include "multi_target.h"
+#include "patch_pipeline.h"
+#include "stats.h"
+#include "stream_patch.h"
+#include "updater_patch.h"
+#include "verify.h"
+#include "watch.h"
+
+// TODO: Allow big or little endian raw data sound files (configured with a flag)
+// TODO: Allow reading of .AIFF or .WAV files
+
+// Note: to convert 16-bit little endian to big endian sound file, do this:
+// dd conv=swab < little_endian_file > big_endian_file
+
+using namespace std;
+
+static string programName; // name of program as called
+static const ModelInfo *fixedModel; // the only model this program supports (NULL for all)
+
+// Declarations of functions
+static void checkFirmwareFile(ChimeError error, const ModelInfo *detected, bool original, const char *filename); // makes sure the firmware file loaded, verified and decoded
+static void checkSoundFile(ChimeError error, const char *filename); // makes sure the new sound chime (raw, AIFC or from another firmware file) loaded
+static void checkOutputFile(ChimeError error, const char *filename); // makes sure the output file could be opened
+static void checkPatched(ChimeError error); // makes sure the new sound went in and the new firmware was saved
+static void runSequentialPatch(PatchContext &context, const char *soundFile, const char *outputFile); // patches one step at a time (for the cache and deltas)
+static int runBoundedPatch(const vector<char *> &args, uint64_t maxMemory, const StatsCollector *stats,
+						   const string &statsDestination); // patches with a fixed amount of memory
+static int runBatchMode(const vector<char *> &args, BatchOptions options, const RomCache *romCache,
+						bool deltaOutput); // patches many sounds into one firmware
+static int runMultiTargetMode(const vector<char *> &args, MultiTargetOptions options); // patches one sound into many firmware files
+static int runPreviewMode(const vector<char *> &args, const string &previewFile); // saves the encoded chime to listen to
+static int runWatchMode(const vector<char *> &args, const RomCache *romCache); // rebuilds the output every time the sound file changes
+static int runVerifyMode(const vector<char *> &args, unsigned numThreads, const ModelInfo *model); // checks patched firmware files
+static int runLocateMode(const vector<char *> &args); // prints a descriptor for each firmware file
+static int runPatchUpdaterMode(const vector<char *> &args, const ModelInfo *model); // lets firmware updaters install patched firmware
+static void loadDescriptor(const char *filename); // adds the model described by a descriptor file
+static void writeStats(const StatsCollector &stats, const string &destination, const ModelInfo *model); // reports stats as JSON
+static void selectKernels(const string &name); // forces the kernels to a particular instruction set level
+static uint64_t parseSize(const string &size); // parses sizes like 512K, 16M, 1G (0 if it isn't one)
+[[noreturn]] static void exitPrintUsage(); // exits with a message showing how to use the program
+
+int injectChimeMain(int argc, char *argv[], const ModelInfo *model)
+{
+	programName = argv[0];
+	fixedModel = model;
+
+	// Pull out the options, leaving the file arguments
+	bool batchMode = false;
+	bool multiTargetMode = false;
+	bool verifyMode = false;
+	bool locateMode = false;
+	bool patchUpdaterMode = false;
+	bool watchMode = false;
+	bool deltaOutput = false;
+	const ModelInfo *selectedModel = fixedModel;
+	unsigned numThreads = 0;
+	AsyncIoBackend ioBackend = ASYNC_IO_AUTO;
+	unique_ptr<OutputCache> cache;
+	unique_ptr<RomCache> romCache;
+	uint64_t maxMemory = 0;
+	string previewFile;
+	bool statsEnabled = false;
+	string statsDestination;
+	vector<char *> args;
+	for (int x = 1; x < argc; x++)
+	{
+		string arg = argv[x];
+		if (arg == "--batch")
+		{
+			batchMode = true;
+		}
+		else if (arg == "--multi-target")
+		{
+			multiTargetMode = true;
+		}
+		else if (arg == "--watch")
+		{
+			watchMode = true;
+		}
+		else if (arg == "--delta")
+		{
+			deltaOutput = true;
+		}
+		else if (arg == "--verify")
+		{
+			verifyMode = true;
+		}
+		else if (arg == "--locate")
+		{
+			locateMode = true;
+		}
+		else if (arg == "--patch-updater")
+		{
+			patchUpdaterMode = true;
+		}
+		else if (arg.compare(0, 13, "--descriptor=") == 0 && !fixedModel)
+		{
+			loadDescriptor(argv[x] + 13);
+		}
+		else if (arg.compare(0, 8, "--model=") == 0)
+		{
+			selectedModel = findModelById(arg.substr(8));
+			if (!selectedModel || (fixedModel && selectedModel != fixedModel))
+			{
+				exitPrintUsage();
+			}
+		}
+		else if (arg.compare(0, 7, "--jobs=") == 0)
+		{
+			numThreads = atoi(arg.c_str() + 7);
+		}
+		else if (arg.compare(0, 5, "--io=") == 0)
+		{
+			if (!parseAsyncIoBackend(arg.substr(5), ioBackend))
+			{
+				exitPrintUsage();
+			}
+		}
+		else if (arg.compare(0, 13, "--max-memory=") == 0)
+		{
+			maxMemory = parseSize(arg.substr(13));
+			if (maxMemory == 0)
+			{
+				exitPrintUsage();
+			}
+		}
+		else if (arg.compare(0, 10, "--preview=") == 0 && arg.length() > 10)
+		{
+			previewFile = arg.substr(10);
+		}
+		else if (arg.compare(0, 12, "--cache-dir=") == 0)
+		{
+			cache.reset(new OutputCache(arg.substr(12)));
+			romCache.reset(new RomCache(arg.substr(12)));
+		}
+		else if (arg == "--stats=json" || arg.compare(0, 13, "--stats=json:") == 0)
+		{
+			statsEnabled = true;
+			statsDestination = arg.substr(arg.length() > 12 ? 13 : 12);
+		}
+		else if (arg.compare(0, 9, "--kernel=") == 0)
+		{
+			selectKernels(arg.substr(9));
+		}
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			exitPrintUsage();
+		}
+		else
+		{
+			args.push_back(argv[x]);
+		}
+	}
+
+	// Whole files have to be in memory to cache them or make deltas of them
+	if (maxMemory && (batchMode || multiTargetMode || watchMode || cache || deltaOutput))
+	{
+		cerr << "Error: --max-memory can't be used with --batch, --multi-target, --watch, --cache-dir or --delta." << endl;
+		exit(1);
+	}
+
+	// Collect per-stage stats on this thread if asked to
+	StatsCollector stats;
+	ScopedStats scopedStats(statsEnabled ? &stats : NULL);
+
+	if (locateMode)
+	{
+		return runLocateMode(args);
+	}
+
+	if (!previewFile.empty())
+	{
+		int result = runPreviewMode(args, previewFile);
+		if (statsEnabled)
+		{
+			writeStats(stats, statsDestination, NULL);
+		}
+		return result;
+	}
+
+	if (patchUpdaterMode)
+	{
+		return runPatchUpdaterMode(args, selectedModel);
+	}
+
+	if (verifyMode)
+	{
+		return runVerifyMode(args, numThreads, selectedModel);
+	}
+
+	if (batchMode)
+	{
+		BatchOptions options;
+		options.numThreads = numThreads;
+		options.cache = cache.get();
+		options.io = ioBackend;
+		int result = runBatchMode(args, options, romCache.get(), deltaOutput);
+		if (statsEnabled)
+		{
+			writeStats(stats, statsDestination, NULL);
+		}
+		return result;
+	}
+
+	if (multiTargetMode)
+	{
+		MultiTargetOptions options;
+		options.numThreads = numThreads;
+		options.expectedModel = fixedModel;
+		options.cache = cache.get();
+		options.romCache = romCache.get();
+		options.deltaOutput = deltaOutput;
+		int result = runMultiTargetMode(args, options);
+		if (statsEnabled)
+		{
+			writeStats(stats, statsDestination, NULL);
+		}
+		return result;
+	}
+
+	if (watchMode)
+	{
+		return runWatchMode(args, romCache.get());
+	}
+
+	// Need an exact number of arguments
+	if (args.size() != 3)
+	{
+		exitPrintUsage();
+	}
+
+	// Stream the firmware through small buffers if memory is tight
+	if (maxMemory)
+	{
+		return runBoundedPatch(args, maxMemory, statsEnabled ? &stats : NULL, statsDestination);
+	}
+
+	FirmwareImage image;
+	image.setRomCache(romCache.get());
+	PatchContext context(image);
+	context.setCache(cache.get());
+	unique_ptr<DeltaIndex> deltaIndex;
+	if (cache || deltaOutput)
+	{
+		// Make sure that the first file is an original firmware file we know
+		// about, and if it is, load it and decode it
+		{
+			StageTimer timer("loadFirmwareFile");
+			ChimeError error = image.loadFile(args[0], fixedModel);
+			checkFirmwareFile(error, image.model(), image.isOriginal(), args[0]);
+		}
+		if (deltaOutput)
+		{
+			deltaIndex.reset(new DeltaIndex(image.firmware()));
+			context.setDeltaIndex(deltaIndex.get());
+		}
+		runSequentialPatch(context, args[1], args[2]);
+	}
+	else
+	{
+		// Nothing needs the whole patched file in memory, so load the sound while the
+		// firmware loads, and write the new firmware while it's being encoded
+		PipelineStage stage;
+		ChimeError error = runPatchPipeline(image, context, args[0], args[1], args[2], fixedModel, stage);
+		checkFirmwareFile((stage == PIPELINE_LOAD_FIRMWARE) ? error : CHIME_OK, image.model(), image.isOriginal(), args[0]);
+		if (stage == PIPELINE_LOAD_SOUND) checkSoundFile(error, args[1]);
+		if (stage == PIPELINE_OPEN_OUTPUT) checkOutputFile(error, args[2]);
+		if (stage == PIPELINE_PATCH) checkPatched(error);
+	}
+
+	// Success!
+	cout << "Successfully injected new startup chime" << (context.outputFromCache() ? " (cached)." : ".") << endl;
+
+	if (statsEnabled)
+	{
+		writeStats(stats, statsDestination, image.model());
+	}
+
+	return 0;
+}
+
+static int runBoundedPatch(const vector<char *> &args, uint64_t maxMemory, const StatsCollector *stats,
+						   const string &statsDestination)
+{
+	// The budget is for the whole process, so whatever it's already using counts
+	uint64_t startRss = currentRssBytes();
+	size_t bufferSize = streamBufferSize(maxMemory, startRss);
+	if (bufferSize == 0)
+	{
+		cerr << "Error: --max-memory is too small; this process is already using " << (startRss / 1024) <<
+			" KB." << endl;
+		exit(1);
+	}
+
+	const ModelInfo *detected;
+	ChimeError error = streamPatchFile(args[0], args[1], args[2], fixedModel, bufferSize, detected);
+	if (error == CHIME_ERR_PATCHED_FIRMWARE)
+	{
+		cerr << "Error: \"" << args[0] << "\" isn't an original " << detected->layout->firmwareName <<
+			" file. --max-memory only works with original files; leave it out to re-patch an already-patched one." << endl;
+		exit(1);
+	}
+	bool firmwareError = error == CHIME_ERR_READ_FIRMWARE || error == CHIME_ERR_UNKNOWN_FIRMWARE ||
+		error == CHIME_ERR_DECODE_FIRMWARE;
+	checkFirmwareFile(firmwareError ? error : CHIME_OK, detected, true, args[0]);
+	if (error == CHIME_ERR_OPEN_OUTPUT)
+	{
+		checkOutputFile(error, args[2]);
+	}
+	else if (error == CHIME_ERR_WRITE_OUTPUT)
+	{
+		checkPatched(error);
+	}
+	else
+	{
+		checkSoundFile(error, args[1]);
+	}
+
+	uint64_t peakRss = peakRssBytes();
+	cout << "Successfully injected new startup chime." << endl;
+	cout << "Peak memory: " << (peakRss / 1024) << " KB of " << (maxMemory / 1024) << " KB allowed (" <<
+		(bufferSize / 1024) << " KB buffers)." << endl;
+	if (peakRss > maxMemory)
+	{
+		cerr << "Warning: went over the --max-memory budget." << endl;
+	}
+
+	if (stats)
+	{
+		writeStats(*stats, statsDestination, detected);
+	}
+	return 0;
+}
+
+static int runMultiTargetMode(const vector<char *> &args, MultiTargetOptions options)
+{
+	// The sound, then firmware/output pairs
+	if (args.size() < 3 || (args.size() % 2) != 1)
+	{
+		exitPrintUsage();
+	}
+	vector<TargetJob> targets;
+	for (size_t x = 1; x < args.size(); x += 2)
+	{
+		TargetJob target;
+		target.firmwareFile = args[x];
+		target.outputFile = args[x + 1];
+		targets.push_back(target);
+	}
+
+	size_t failures;
+	ChimeError error;
+	{
+		StageTimer timer("multiTarget", targets.size());
+		error = runMultiTarget(args[0], targets, options, failures);
+	}
+	checkSoundFile(error, args[0]);
+	return failures ? 1 : 0;
+}
+
+static int runPreviewMode(const vector<char *> &args, const string &previewFile)
+{
+	PreviewFormat format;
+	if (args.size() != 1 || !previewFormatForFile(previewFile, format))
+	{
+		exitPrintUsage();
+	}
+
+	// Only the sound is involved, so this is quick enough to run after every edit
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ChimeError error = writeChimePreview(args[0], previewFile.c_str(), format);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (error == CHIME_ERR_WRITE_OUTPUT)
+	{
+		checkOutputFile(error, previewFile.c_str());
+	}
+	checkSoundFile(error, args[0]);
+
+	cout << "Saved the encoded chime to \"" << previewFile << "\" in " << (seconds * 1000.0) << " ms." << endl;
+	return 0;
+}
+
+static int runWatchMode(const vector<char *> &args, const RomCache *romCache)
+{
+	if (args.size() != 3)
+	{
+		exitPrintUsage();
+	}
+
+	// The firmware is loaded, checked and decoded once, and then kept for every rebuild
+	FirmwareImage image;
+	image.setRomCache(romCache);
+	ChimeError error = image.loadFile(args[0], fixedModel);
+	checkFirmwareFile(error, image.model(), image.isOriginal(), args[0]);
+
+	error = runWatch(image, args[1], args[2]);
+	if (error == CHIME_ERR_OPEN_OUTPUT)
+	{
+		checkOutputFile(error, args[2]);
+	}
+	else if (error == CHIME_ERR_WATCH || error == CHIME_ERR_WATCH_UNSUPPORTED)
+	{
+		checkPatched(error);
+	}
+	checkSoundFile(error, args[1]);
+	return 0;
+}
+
+static int runVerifyMode(const vector<char *> &args, unsigned numThreads, const ModelInfo *model)
+{
+	if (args.empty())
+	{
+		exitPrintUsage();
+	}
+	vector<string> files(args.begin(), args.end());
+	return (runVerify(files, model, numThreads) == 0) ? 0 : 1;
+}
+
+static int runLocateMode(const vector<char *> &args)
+{
+	if (args.empty())
+	{
+		exitPrintUsage();
+	}
+
+	int result = 0;
+	for (size_t x = 0; x < args.size(); x++)
+	{
+		string firmware;
+		if (!readFile(args[x], firmware))
+		{
+			cerr << "Unable to read file \"" << args[x] << "\"" << endl;
+			result = 1;
+			continue;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		LocatedStructure located;
+		bool found = locateFirmwareStructure(firmware, located);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (!found)
+		{
+			cerr << "Unable to find a ROM image or file checksum in \"" << args[x] << "\"" << endl;
+			result = 1;
+			continue;
+		}
+
+		// The descriptor goes to stdout so it can be saved and filled in
+		string md5 = ::md5(firmware);
+		string firmwareName = args[x];
+		size_t slash = firmwareName.rfind('/');
+		if (slash != string::npos) firmwareName.erase(0, slash + 1);
+		located.layout.md5 = md5.c_str();
+		located.layout.firmwareName = firmwareName.c_str();
+
+		// The masked MD5 lets files patched from this one be re-patched. A known model's own
+		// layout is used if it's an original file; otherwise everything has to have been located.
+		string maskedMd5;
+		const ModelLayout &layout = located.layout;
+		const ModelInfo *existing = findModelByMd5(md5);
+		const ModelInfo *known = existing;
+		ModelInfo engine = makeRuntimeModelInfo("?", &layout, located.container, located.checksumField);
+		if (!known && layout.romOffset != UNKNOWN_OFFSET && layout.romChecksumPos != UNKNOWN_OFFSET &&
+			layout.fileChecksumPosBack != UNKNOWN_OFFSET && layout.soundOffset != UNKNOWN_OFFSET)
+		{
+			known = &engine;
+		}
+		string rom;
+		if (known && known->decodeFirmware(*known->layout, firmware, rom) == DECODE_OK)
+		{
+			maskedMd5 = known->maskedDigest(*known->layout, firmware, rom);
+			located.layout.maskedMd5 = maskedMd5.c_str();
+		}
+
+		// A known model gets its own descriptor in full. Passing that back with --descriptor=
+		// gives the model the masked MD5.
+		const char *id = "?";
+		if (existing)
+		{
+			id = existing->id;
+			located.layout = *existing->layout;
+			located.layout.maskedMd5 = maskedMd5.empty() ? NULL : maskedMd5.c_str();
+		}
+
+		cout << (x > 0 ? "\n" : "") <<
+			formatModelDescriptor(id, located.layout, located.container, located.checksumField);
+		cerr << "Located the structure of \"" << args[x] << "\" in " << (seconds * 1000.0) << " ms." << endl;
+	}
+	return result;
+}
+
+static int runPatchUpdaterMode(const vector<char *> &args, const ModelInfo *model)
+{
+	if (args.empty())
+	{
+		exitPrintUsage();
+	}
+
+	int result = 0;
+	for (size_t x = 0; x < args.size(); x++)
+	{
+		UpdaterPatch patch;
+		patchUpdater(args[x], model, patch);
+		switch (patch.result)
+		{
+		case UPDATER_PATCHED:
+			cout << "Patched \"" << patch.fork << "\" at 0x" << hex << uppercase << patch.offset << dec << ": ";
+			if (patch.edit->allowListEntry)
+			{
+				cout << "\"" << patch.before << "\" -> \"" << patch.edit->allowListEntry << "\"" << endl;
+			}
+			else
+			{
+				cout << hex << setfill('0') << setw(2) << static_cast<unsigned>(static_cast<unsigned char>(patch.before[0])) <<
+					" -> " << setw(2) << static_cast<unsigned>(patch.edit->newVersion) << dec << setfill(' ') << endl;
+			}
+			break;
+		case UPDATER_ALREADY_PATCHED:
+			cout << "\"" << args[x] << "\" is already patched." << endl;
+			break;
+		case UPDATER_NOT_FOUND:
+			cerr << "Unable to find anything to patch in \"" << args[x] << "\"";
+			if (!model)
+			{
+				cerr << " (for the slot-loading iMac's updater, use --model=imac_slot_loading)";
+			}
+			cerr << endl;
+			result = 1;
+			break;
+		case UPDATER_ERROR:
+			cerr << "Error: " << patch.error << "." << endl;
+			result = 1;
+			break;
+		}
+	}
+	return result;
+}
+
+static int runBatchMode(const vector<char *> &args, BatchOptions options, const RomCache *romCache, bool deltaOutput)
+{
+	// Either a manifest, or sound/output pairs
+	vector<BatchJob> jobs;
+	if (args.size() == 2)
+	{
+		if (!readBatchManifest(args[1], jobs))
+		{
+			cerr << "Unable to read batch manifest \"" << args[1] << "\"" << endl;
+			exitPrintUsage();
+		}
+	}
+	else if ((args.size() >= 3) && (args.size() % 2) == 1)
+	{
+		for (size_t x = 1; x < args.size(); x += 2)
+		{
+			BatchJob job;
+			job.soundFile = args[x];
+			job.outputFile = args[x + 1];
+			jobs.push_back(job);
+		}
+	}
+	else
+	{
+		exitPrintUsage();
+	}
+
+	// Verify and decode the firmware once; every variant shares it
+	FirmwareImage image;
+	image.setRomCache(romCache);
+	{
+		StageTimer timer("loadFirmwareFile");
+		ChimeError error = image.loadFile(args[0], fixedModel);
+		checkFirmwareFile(error, image.model(), image.isOriginal(), args[0]);
+	}
+
+	// All of the deltas are against the same original
+	unique_ptr<DeltaIndex> deltaIndex;
+	if (deltaOutput)
+	{
+		deltaIndex.reset(new DeltaIndex(image.firmware()));
+		options.deltaIndex = deltaIndex.get();
+	}
+
+	// The jobs themselves run on the pool's threads, so only the batch as a whole is timed
+	StageTimer timer("batch", jobs.size());
+	return runBatch(image, jobs, options) ? 1 : 0;
+}
+
+static void writeStats(const StatsCollector &stats, const string &destination, const ModelInfo *model)
+{
+	// The top level stages add up to the whole run
+	uint64_t totalNs = 0;
+	for (size_t x = 0; x < stats.stages().size(); x++)
+	{
+		if (stats.stages()[x].depth == 0) totalNs += stats.stages()[x].wallNs;
+	}
+
+	ostringstream extraFields;
+	extraFields << "\"tool\":\"inject_chime\",\"total_wall_ns\":" << totalNs <<
+		",\"kernel\":\"" << kernelLevelName(kernels().level) << "\"";
+	if (model)
+	{
+		extraFields << ",\"model\":\"" << model->id << "\"";
+	}
+	string json = stats.toJson(extraFields.str()) + "\n";
+
+	// Stats go to stderr unless a file was given, so they don't mix with the normal output
+	if (destination.empty())
+	{
+		cerr << json;
+	}
+	else if (!writeFile(destination.c_str(), json))
+	{
+		cerr << "Unable to write stats to \"" << destination << "\"" << endl;
+	}
+}
+
+static void loadDescriptor(const char *filename)
+{
+	string error;
+	if (!loadModelDescriptor(filename, error))
+	{
+		cerr << "Error: descriptor file \"" << filename << "\": " << error << "." << endl;
+		exit(1);
+	}
+}
+
+static void selectKernels(const string &name)
+{
+	KernelLevel level;
+	if (!parseKernelLevel(name, level))
+	{
+		exitPrintUsage();
+	}
+	if (!setKernelLevel(level))
+	{
+		cerr << "Error: this CPU can't run the " << kernelLevelName(level) << " kernels." << endl;
+		exit(1);
+	}
+}
+
+static void checkFirmwareFile(ChimeError error, const ModelInfo *detected, bool original, const char *filename)
+{
+	switch (error)
+	{
+	case CHIME_OK:
+		break;
+	case CHIME_ERR_READ_FIRMWARE:
+		cerr << "Unable to read file \"" << filename << "\"" << endl;
+		exitPrintUsage();
+	case CHIME_ERR_UNKNOWN_FIRMWARE:
+		if (fixedModel)
+		{
+			cerr << "Error: " << fixedModel->layout->firmwareName << " file supplied is not the original " <<
+				fixedModel->layout->firmwareName << " file." << endl;
+		}
+		else
+		{
+			cerr << "Error: firmware file supplied is not an original firmware file for any supported model." << endl;
+		}
+		exit(1);
+	default:
+		cerr << "Error: " << chimeErrorString(error) << "." << endl;
+		exit(1);
+	}
+
+	if (!fixedModel)
+	{
+		cout << "Detected " << (original ? "" : "patched ") << detected->layout->firmwareName <<
+			" file for " << detected->layout->name << "." << endl;
+	}
+}
+
+static void checkSoundFile(ChimeError error, const char *filename)
+{
+	switch (error)
+	{
+	case CHIME_OK:
+		break;
+	case CHIME_ERR_READ_SOUND:
+		cerr << "Unable to read file \"" << filename << "\"" << endl;
+		exitPrintUsage();
+	case CHIME_ERR_SOUND_TOO_LONG:
+		cerr << "Sound file \"" << filename << "\" is too long. Maximum size: " <<
+			SOUND_MAX_SIZE << " bytes" << endl;
+		exit(1);
+	case CHIME_ERR_SOUND_FORMAT:
+		cerr << "Sound file \"" << filename << "\" is an AIFC file, but not mono 44.1 kHz IMA 4:1." << endl;
+		exit(1);
+	case CHIME_ERR_SOUND_NOT_16_BIT:
+		// Not a multiple of 2 (which it has to be for it to be 16-bit sound)
+		cerr << "Sound file \"" << filename << "\" does not appear to be encoded" <<
+			" as a 16-bit sound." << endl;
+		exit(1);
+	default:
+		cerr << "Sound file \"" << filename << "\" could not be compressed properly." << endl;
+		exit(1);
+	}
+}
+
+static void checkOutputFile(ChimeError error, const char *filename)
+{
+	if (error != CHIME_OK)
+	{
+		cerr << "Unable to open file \"" << filename << "\" for output." << endl;
+		exitPrintUsage();
+	}
+}
+
+static void checkPatched(ChimeError error)
+{
+	if (error != CHIME_OK)
+	{
+		cerr << "Error: " << chimeErrorString(error) << "." << endl;
+		exit(1);
+	}
+}
+
+static void runSequentialPatch(PatchContext &context, const char *soundFile, const char *outputFile)
+{
+	// Make sure the second file (raw audio) is not too big, and
+	// convert it to IMA 4:1
+	{
+		StageTimer timer("loadSoundFile");
+		checkSoundFile(context.loadSoundFile(soundFile), soundFile);
+	}
+
+	// Open output file and make sure we're good to go
+	{
+		StageTimer timer("openOutputFile");
+		checkOutputFile(context.openOutputFile(outputFile), outputFile);
+	}
+
+	// Do the work -- inject sound, encode, fix checksums, save
+	{
+		StageTimer timer("injectChime");
+		ChimeError error = context.injectChime();
+		if (error == CHIME_OK)
+		{
+			error = context.writeOutputFile();
+		}
+		checkPatched(error);
+	}
+}
+
+static uint64_t parseSize(const string &size)
+{
+	char *end;
+	uint64_t value = strtoull(size.c_str(), &end, 10);
+	if (end == size.c_str())
+	{
+		return 0;
+	}
+	switch (*end)
+	{
+	case 'k': case 'K': value *= 1024; end++; break;
+	case 'm': case 'M': value *= 1024 * 1024; end++; break;
+	case 'g': case 'G': value *= 1024 * 1024 * 1024; end++; break;
+	}
+	return (*end == '\0') ? value : 0;
+}
+
+static void exitPrintUsage()
+{
+	const char *firmwareName = fixedModel ? fixedModel->layout->firmwareName : "firmware";
+	const char *descriptorOption = fixedModel ? "" : " [--descriptor=file ...]";
+	cerr << "usage: " << programName << descriptorOption << " [--cache-dir=dir] [--stats=json[:file]] [--kernel=level] [--delta] <" << firmwareName <<
+		" file> <sound file> <output firmware update file>" << endl;
+	cerr << "       " << programName << descriptorOption << " --max-memory=size[K|M|G] [--stats=json[:file]] [--kernel=level] <original " <<
+		firmwareName << " file> <sound file> <output firmware update file>" << endl;
+	cerr << "       " << programName << descriptorOption << " --batch [--jobs=N] [--io=backend] [--cache-dir=dir] [--delta] <" << firmwareName <<
+		" file> <manifest file | <sound file> <output file> ...>" << endl;
+	cerr << "       " << programName << descriptorOption << " --multi-target [--jobs=N] [--cache-dir=dir] [--delta] <sound file> <" <<
+		firmwareName << " file> <output file> ..." << endl;
+	cerr << "       " << programName << descriptorOption << " --watch [--cache-dir=dir] <" << firmwareName <<
+		" file> <sound file> <output firmware update file>" << endl;
+	cerr << "       " << programName << descriptorOption << " --verify [--jobs=N]" << (fixedModel ? "" : " [--model=id]") <<
+		" <firmware file> ..." << endl;
+	cerr << "       " << programName << descriptorOption << " --preview=<file.aifc | file.wav> [--stats=json[:file]] [--kernel=level] <sound file>" << endl;
+	cerr << "       " << programName << " --locate <firmware file> ..." << endl;
+	cerr << "       " << programName << " --patch-updater" << (fixedModel ? "" : " [--model=id]") <<
+		" <firmware updater> ..." << endl;
+	cerr << "sound files: uncompressed 16-bit mono 44.1 kHz big-endian raw, IMA 4:1 AIFC, or a firmware file to copy the chime from" << endl;
+	cerr << "kernel levels: auto, scalar, sse4.1, avx2, avx512" << endl;
+	exit(1);
+}
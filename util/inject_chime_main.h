@@ -0,0 +1,13 @@
+#ifndef INJECT_CHIME_MAIN_H
+#define INJECT_CHIME_MAIN_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include "models.h"
+
+// Runs the inject_chime command line tool. If model is NULL, the model is detected
+// from the firmware file, otherwise only that model's firmware file is accepted.
+int injectChimeMain(int argc, char *argv[], const ModelInfo *model);
+
+#endif // INJECT_CHIME_MAIN_H
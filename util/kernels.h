@@ -0,0 +1,49 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Internal to util/: every variant of every hot kernel, one per instruction set level.
+// Only cpu_dispatch.cpp should need these; everyone else calls adler32(), dc85() and so on,
+// which go through the table picked at startup.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ima.h"
+#include "pattern_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86 1
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#endif
+
+// Lets one kernel body be compiled separately into each variant
+#define KERNEL_INLINE inline __attribute__((always_inline))
+
+uint32_t adler32Scalar(uint32_t adler, const unsigned char *data, size_t len);
+bool dc85Scalar(const char *s, size_t len, std::string &output);
+size_t ec85AppendScalar(const std::string &s, std::string &output, size_t offset, size_t maxStringLen);
+void imaEncodeScalar(const std::string &input, std::string &output);
+void imaScanHeadersScalar(const unsigned char *data, size_t len, ImaHeaderScan &scan);
+void findPatternsScalar(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+
+#ifdef KERNELS_X86
+uint32_t adler32Sse41(uint32_t adler, const unsigned char *data, size_t len);
+void imaScanHeadersSse41(const unsigned char *data, size_t len, ImaHeaderScan &scan);
+void findPatternsSse41(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+
+uint32_t adler32Avx2(uint32_t adler, const unsigned char *data, size_t len);
+void imaScanHeadersAvx2(const unsigned char *data, size_t len, ImaHeaderScan &scan);
+void findPatternsAvx2(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+
+uint32_t adler32Avx512(uint32_t adler, const unsigned char *data, size_t len);
+void imaScanHeadersAvx512(const unsigned char *data, size_t len, ImaHeaderScan &scan);
+void findPatternsAvx512(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+#endif
+
+#endif // KERNELS_H
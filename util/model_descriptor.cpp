@@ -0,0 +1,265 @@
+#include "model_descriptor.h"
+#include "files.h"
+#include <stdlib.h>
+#include <map>
+#include <sstream>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static const char *const NUMBER_KEYS[] = {
+	"rom_offset", "rom_end_offset", "column_width", "rom_checksum_length", "rom_pad_byte",
+	"rom_checksum_pos", "file_checksum_pos_back", "file_checksum_end_back", "sound_offset"
+};
+static const size_t NUM_NUMBER_KEYS = sizeof(NUMBER_KEYS) / sizeof(NUMBER_KEYS[0]);
+
+static string trim(const string &s); // strips spaces and tabs (and a trailing carriage return) from both ends
+static bool parseNumber(const string &s, size_t &value); // parses a decimal or 0x hex number
+static bool isMd5(const string &s); // whether s is an MD5 as 32 lowercase hex digits
+static void appendNumber(ostringstream &out, const char *key, size_t value, bool asHex); // writes a number field
+static bool sameLayout(const ModelLayout &a, const ModelLayout &b); // whether two layouts put everything in the same place
+
+const ModelInfo *loadModelDescriptor(const char *filename, string &error)
+{
+	string contents;
+	if (!readFile(filename, contents))
+	{
+		error = "unable to read the descriptor file";
+		return NULL;
+	}
+
+	// Split it up into keys and values
+	map<string, string> fields;
+	istringstream lines(contents);
+	string line;
+	while (getline(lines, line))
+	{
+		line = trim(line);
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		size_t equals = line.find('=');
+		if (equals == string::npos)
+		{
+			error = "\"" + line + "\" isn't a key = value line";
+			return NULL;
+		}
+		fields[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+	}
+
+	const char *const stringKeys[] = {"id", "name", "firmware_name", "md5", "container", "checksum_field"};
+	for (size_t x = 0; x < sizeof(stringKeys) / sizeof(stringKeys[0]); x++)
+	{
+		if (fields[stringKeys[x]].empty() || fields[stringKeys[x]] == "?")
+		{
+			error = string(stringKeys[x]) + " isn't filled in";
+			return NULL;
+		}
+	}
+	// masked_md5 is the only optional key
+	bool hasMaskedMd5 = fields.count("masked_md5") && fields["masked_md5"] != "?";
+	if (fields.size() != sizeof(stringKeys) / sizeof(stringKeys[0]) + NUM_NUMBER_KEYS + fields.count("masked_md5"))
+	{
+		error = "unknown key in the descriptor file";
+		return NULL;
+	}
+
+	size_t numbers[NUM_NUMBER_KEYS];
+	for (size_t x = 0; x < NUM_NUMBER_KEYS; x++)
+	{
+		const string &value = fields[NUMBER_KEYS[x]];
+		if (value.empty() || value == "?")
+		{
+			error = string(NUMBER_KEYS[x]) + " isn't filled in";
+			return NULL;
+		}
+		if (!parseNumber(value, numbers[x]))
+		{
+			error = string(NUMBER_KEYS[x]) + " isn't a number";
+			return NULL;
+		}
+	}
+
+	ContainerKind container;
+	if (fields["container"] == "ascii85") container = CONTAINER_ASCII85_LINES;
+	else if (fields["container"] == "raw") container = CONTAINER_RAW_SECTION;
+	else
+	{
+		error = "container has to be ascii85 or raw";
+		return NULL;
+	}
+	ChecksumFieldKind checksumField;
+	if (fields["checksum_field"] == "hex") checksumField = CHECKSUM_FIELD_HEX;
+	else if (fields["checksum_field"] == "big_endian") checksumField = CHECKSUM_FIELD_BIG_ENDIAN;
+	else
+	{
+		error = "checksum_field has to be hex or big_endian";
+		return NULL;
+	}
+	if (!isMd5(fields["md5"]))
+	{
+		error = "md5 has to be 32 lowercase hex digits";
+		return NULL;
+	}
+	if (hasMaskedMd5 && !isMd5(fields["masked_md5"]))
+	{
+		error = "masked_md5 has to be 32 lowercase hex digits";
+		return NULL;
+	}
+
+	ModelLayout layout = {
+		fields["name"].c_str(),
+		fields["firmware_name"].c_str(),
+		fields["md5"].c_str(),
+		hasMaskedMd5 ? fields["masked_md5"].c_str() : NULL,
+		numbers[0],	// romOffset
+		numbers[1],	// romEndOffset
+		numbers[2],	// columnWidth
+		numbers[3],	// romChecksumLength
+		static_cast<uint8_t>(numbers[4]),	// romPadByte
+		numbers[5],	// romChecksumPos
+		numbers[6],	// fileChecksumPosBack
+		numbers[7],	// fileChecksumEndBack
+		numbers[8],	// soundOffset
+	};
+
+	// Catch the mistakes that would otherwise only show up as a broken patch
+	if (layout.romEndOffset <= layout.romOffset)
+	{
+		error = "rom_end_offset has to be after rom_offset";
+		return NULL;
+	}
+	if (container == CONTAINER_ASCII85_LINES && layout.columnWidth < 5)
+	{
+		error = "column_width has to be at least 5 for an ascii85 container";
+		return NULL;
+	}
+	if (numbers[4] > 0xFF)
+	{
+		error = "rom_pad_byte has to fit in a byte";
+		return NULL;
+	}
+	if (layout.soundOffset + SOUND_COMPRESSED_SIZE > layout.romChecksumLength)
+	{
+		error = "the chime at sound_offset doesn't fit inside rom_checksum_length";
+		return NULL;
+	}
+	if (layout.romChecksumPos >= layout.romOffset && layout.romChecksumPos < layout.romEndOffset)
+	{
+		error = "rom_checksum_pos is inside the ROM image";
+		return NULL;
+	}
+
+	// A model we already know about can only be given its masked MD5 (a built-in one doesn't
+	// come with one), and only by a descriptor that otherwise says the same thing about it
+	const ModelInfo *existing = findModelByMd5(layout.md5);
+	if (existing)
+	{
+		ModelInfo engine = makeRuntimeModelInfo(existing->id, &layout, container, checksumField);
+		if (fields["id"] != existing->id || !sameLayout(layout, *existing->layout) ||
+			engine.decodeFirmware != existing->decodeFirmware || engine.fileChecksumParts != existing->fileChecksumParts)
+		{
+			error = "md5 is " + string(existing->id) + "'s, but the rest doesn't match it";
+			return NULL;
+		}
+		if (!hasMaskedMd5)
+		{
+			error = string(existing->id) + " is already known, and there's no masked_md5 to add to it";
+			return NULL;
+		}
+		if (!setModelMaskedMd5(existing, layout.maskedMd5))
+		{
+			error = string(existing->id) + " already has a different masked_md5";
+			return NULL;
+		}
+		return existing;
+	}
+
+	const ModelInfo *model = addModel(fields["id"], layout, container, checksumField);
+	if (!model)
+	{
+		error = "a model with the same id already exists";
+	}
+	return model;
+}
+
+string formatModelDescriptor(const string &id, const ModelLayout &layout, ContainerKind container,
+							 ChecksumFieldKind checksumField)
+{
+	ostringstream out;
+	out << "# inject_chime model descriptor" << endl;
+	out << "id = " << id << endl;
+	out << "name = " << (layout.name ? layout.name : "?") << endl;
+	out << "firmware_name = " << (layout.firmwareName ? layout.firmwareName : "?") << endl;
+	out << "md5 = " << (layout.md5 ? layout.md5 : "?") << endl;
+	out << "masked_md5 = " << (layout.maskedMd5 ? layout.maskedMd5 : "?") << endl;
+	out << "container = " << ((container == CONTAINER_ASCII85_LINES) ? "ascii85" : "raw") << endl;
+	out << "checksum_field = " << ((checksumField == CHECKSUM_FIELD_HEX) ? "hex" : "big_endian") << endl;
+	appendNumber(out, "rom_offset", layout.romOffset, true);
+	appendNumber(out, "rom_end_offset", layout.romEndOffset, true);
+	appendNumber(out, "column_width", layout.columnWidth, false);
+	appendNumber(out, "rom_checksum_length", layout.romChecksumLength, true);
+	appendNumber(out, "rom_pad_byte", layout.romPadByte, true);
+	appendNumber(out, "rom_checksum_pos", layout.romChecksumPos, true);
+	appendNumber(out, "file_checksum_pos_back", layout.fileChecksumPosBack, false);
+	appendNumber(out, "file_checksum_end_back", layout.fileChecksumEndBack, false);
+	appendNumber(out, "sound_offset", layout.soundOffset, true);
+	return out.str();
+}
+
+static string trim(const string &s)
+{
+	size_t start = s.find_first_not_of(" \t\r");
+	if (start == string::npos)
+	{
+		return string();
+	}
+	size_t end = s.find_last_not_of(" \t\r");
+	return s.substr(start, end - start + 1);
+}
+
+static bool parseNumber(const string &s, size_t &value)
+{
+	char *end;
+	unsigned long long parsed = strtoull(s.c_str(), &end, 0);
+	if (s.empty() || s[0] == '-' || *end != '\0')
+	{
+		return false;
+	}
+	value = static_cast<size_t>(parsed);
+	return true;
+}
+
+static bool isMd5(const string &s)
+{
+	return s.length() == 32 && s.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+static void appendNumber(ostringstream &out, const char *key, size_t value, bool asHex)
+{
+	out << key << " = ";
+	if (value == UNKNOWN_OFFSET)
+	{
+		out << "?";
+	}
+	else if (asHex)
+	{
+		out << "0x" << hex << uppercase << value << dec;
+	}
+	else
+	{
+		out << value;
+	}
+	out << endl;
+}
+
+static bool sameLayout(const ModelLayout &a, const ModelLayout &b)
+{
+	return a.romOffset == b.romOffset && a.romEndOffset == b.romEndOffset && a.columnWidth == b.columnWidth &&
+		a.romChecksumLength == b.romChecksumLength && a.romPadByte == b.romPadByte &&
+		a.romChecksumPos == b.romChecksumPos && a.fileChecksumPosBack == b.fileChecksumPosBack &&
+		a.fileChecksumEndBack == b.fileChecksumEndBack && a.soundOffset == b.soundOffset;
+}
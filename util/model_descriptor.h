@@ -0,0 +1,49 @@
+#ifndef MODEL_DESCRIPTOR_H
+#define MODEL_DESCRIPTOR_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// A model descriptor file describes a firmware revision that isn't built in, so it can be
+// patched without recompiling. It's plain text, one "key = value" per line, with '#' starting
+// a comment line. Numbers can be decimal or 0x hex. Every key but masked_md5 is required:
+//
+//   id = g3_blue_and_white               (what --model= calls it)
+//   name = Power Macintosh G3 (Blue and White)
+//   firmware_name = G3 Firmware
+//   md5 = bbbced8344f8839a5903805729b801ab
+//   masked_md5 = ?                       (lets already-patched files be re-patched)
+//   container = ascii85                  (or raw)
+//   checksum_field = hex                 (or big_endian)
+//   rom_offset = 0x591D3
+//   rom_end_offset = 0xAEBCA
+//   column_width = 100                   (0 for raw containers)
+//   rom_checksum_length = 0x7FFFC
+//   rom_pad_byte = 0x00
+//   rom_checksum_pos = 0xAEC28
+//   file_checksum_pos_back = 9
+//   file_checksum_end_back = 14
+//   sound_offset = 0x325F0
+//
+// The meaning of each field is the same as in ModelLayout. inject_chime --locate writes most
+// of a descriptor for a firmware file, with "?" for anything it couldn't work out. For a model
+// that's already known (a built-in one), it writes that model's descriptor in full, with the
+// masked_md5 worked out from the file. Loading that just gives the model its masked MD5.
+
+#include <string>
+#include "models.h"
+
+// A layout field that isn't known yet ("?" in a descriptor file)
+static const size_t UNKNOWN_OFFSET = static_cast<size_t>(-1);
+
+// Reads a descriptor file and adds the model it describes (see addModel). If its md5 is a known
+// model's, the rest has to match that model, and its masked_md5 is given to it (see
+// setModelMaskedMd5). Returns NULL, with a reason in error, if the file can't be read, is
+// incomplete, or clashes with a known model.
+const ModelInfo *loadModelDescriptor(const char *filename, std::string &error);
+
+// Formats a descriptor. Layout fields that are UNKNOWN_OFFSET or NULL are written as "?".
+std::string formatModelDescriptor(const std::string &id, const ModelLayout &layout, ContainerKind container,
+								  ChecksumFieldKind checksumField);
+
+#endif // MODEL_DESCRIPTOR_H
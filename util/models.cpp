@@ -0,0 +1,173 @@
+#include "models.h"
+#include <deque>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+template <class Engine>
+static constexpr ModelInfo makeEngineInfo(const char *id, const ModelLayout *layout)
+{
+	return ModelInfo{id, layout,
+					 &Engine::decodeFirmware,
+					 &Engine::checkRom,
+					 &Engine::fileChecksumParts,
+					 &Engine::maxEncodedLength,
+					 &Engine::injectChime,
+					 &Engine::patchIncremental,
+					 &Engine::repatchIncremental,
+					 &Engine::maxStreamSegment,
+					 &Engine::streamChime,
+					 &Engine::streamReadChime,
+					 &Engine::streamPatch,
+					 &Engine::looksLike,
+					 &Engine::verifyFirmware,
+					 &Engine::rebaseLayout,
+					 &Engine::maskedDigest};
+}
+
+template <class Descriptor>
+static constexpr ModelInfo makeModelInfo(const char *id, const Descriptor &descriptor)
+{
+	return makeEngineInfo<typename Descriptor::Engine>(id, &descriptor.layout);
+}
+
+const ModelInfo MODELS[] = {
+	makeModelInfo("g3_blue_and_white", G3_BLUE_AND_WHITE),
+	makeModelInfo("imac_original", IMAC_ORIGINAL),
+	makeModelInfo("imac_slot_loading", IMAC_SLOT_LOADING),
+};
+const size_t NUM_MODELS = sizeof(MODELS) / sizeof(MODELS[0]);
+
+// A model added at runtime, along with the storage for everything its ModelInfo points at.
+// They live in a deque so that adding another one doesn't move the existing ones.
+struct RuntimeModel
+{
+	string id;
+	string name;
+	string firmwareName;
+	string md5;
+	string maskedMd5;
+	ModelLayout layout;
+	ModelInfo info;
+};
+static deque<RuntimeModel> runtimeModels;
+
+// Masked MD5s given to the built-in models at runtime (empty if none)
+static string builtInMaskedMd5s[NUM_MODELS];
+
+ModelInfo makeRuntimeModelInfo(const char *id, const ModelLayout *layout, ContainerKind container,
+							   ChecksumFieldKind checksumField)
+{
+	// Every combination of policies is instantiated up front, so no recompiling is needed
+	if (container == CONTAINER_ASCII85_LINES && checksumField == CHECKSUM_FIELD_HEX)
+	{
+		return makeEngineInfo<PatchEngine<Ascii85Lines, HexChecksumField> >(id, layout);
+	}
+	else if (container == CONTAINER_ASCII85_LINES)
+	{
+		return makeEngineInfo<PatchEngine<Ascii85Lines, BigEndianChecksumField> >(id, layout);
+	}
+	else if (checksumField == CHECKSUM_FIELD_HEX)
+	{
+		return makeEngineInfo<PatchEngine<RawSection, HexChecksumField> >(id, layout);
+	}
+	return makeEngineInfo<PatchEngine<RawSection, BigEndianChecksumField> >(id, layout);
+}
+
+const ModelInfo *addModel(const string &id, const ModelLayout &layout, ContainerKind container,
+						  ChecksumFieldKind checksumField)
+{
+	if (findModelById(id) || findModelByMd5(layout.md5))
+	{
+		return NULL;
+	}
+
+	runtimeModels.push_back(RuntimeModel());
+	RuntimeModel &model = runtimeModels.back();
+	model.id = id;
+	model.name = layout.name;
+	model.firmwareName = layout.firmwareName;
+	model.md5 = layout.md5;
+	model.layout = layout;
+	model.layout.name = model.name.c_str();
+	model.layout.firmwareName = model.firmwareName.c_str();
+	model.layout.md5 = model.md5.c_str();
+	if (layout.maskedMd5)
+	{
+		model.maskedMd5 = layout.maskedMd5;
+		model.layout.maskedMd5 = model.maskedMd5.c_str();
+	}
+
+	model.info = makeRuntimeModelInfo(model.id.c_str(), &model.layout, container, checksumField);
+	return &model.info;
+}
+
+bool setModelMaskedMd5(const ModelInfo *model, const string &maskedMd5)
+{
+	const char *existing = modelMaskedMd5(*model);
+	if (existing)
+	{
+		return maskedMd5 == existing;
+	}
+	if (model >= MODELS && model < MODELS + NUM_MODELS)
+	{
+		builtInMaskedMd5s[model - MODELS] = maskedMd5;
+		return true;
+	}
+	for (size_t x = 0; x < runtimeModels.size(); x++)
+	{
+		RuntimeModel &runtimeModel = runtimeModels[x];
+		if (&runtimeModel.info == model)
+		{
+			runtimeModel.maskedMd5 = maskedMd5;
+			runtimeModel.layout.maskedMd5 = runtimeModel.maskedMd5.c_str();
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *modelMaskedMd5(const ModelInfo &model)
+{
+	if (&model >= MODELS && &model < MODELS + NUM_MODELS && !builtInMaskedMd5s[&model - MODELS].empty())
+	{
+		return builtInMaskedMd5s[&model - MODELS].c_str();
+	}
+	return model.layout->maskedMd5;
+}
+
+size_t numModels()
+{
+	return NUM_MODELS + runtimeModels.size();
+}
+
+const ModelInfo &modelAt(size_t index)
+{
+	return (index < NUM_MODELS) ? MODELS[index] : runtimeModels[index - NUM_MODELS].info;
+}
+
+const ModelInfo *findModelByMd5(const string &md5)
+{
+	for (size_t x = 0; x < numModels(); x++)
+	{
+		if (md5 == modelAt(x).layout->md5)
+		{
+			return &modelAt(x);
+		}
+	}
+	return NULL;
+}
+
+const ModelInfo *findModelById(const string &id)
+{
+	for (size_t x = 0; x < numModels(); x++)
+	{
+		if (id == modelAt(x).id)
+		{
+			return &modelAt(x);
+		}
+	}
+	return NULL;
+}
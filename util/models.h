@@ -0,0 +1,152 @@
+#ifndef MODELS_H
+#define MODELS_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+#include "patch_engine.h"
+
+// A model descriptor ties a layout to the container codec and checksum field policies
+// that the engine should be instantiated with for that model.
+template <class ContainerCodec, class ChecksumFieldFormat>
+struct ModelDescriptor
+{
+	typedef ContainerCodec Container;
+	typedef ChecksumFieldFormat ChecksumField;
+	typedef PatchEngine<ContainerCodec, ChecksumFieldFormat> Engine;
+	ModelLayout layout;
+};
+
+// Power Macintosh G3 (Blue and White): "G3 Firmware" from Firmware Update 1.1
+constexpr ModelDescriptor<Ascii85Lines, HexChecksumField> G3_BLUE_AND_WHITE = {{
+	"Power Macintosh G3 (Blue and White)",
+	"G3 Firmware",
+	"bbbced8344f8839a5903805729b801ab",
+	NULL,		// maskedMd5 (not known yet; inject_chime --locate works it out from the original file)
+	0x591D3,	// romOffset
+	0xAEBCA,	// romEndOffset
+	100,		// columnWidth
+	0x7FFFC,	// romChecksumLength
+	0x00,		// romPadByte
+	0xAEC28,	// romChecksumPos
+	9,			// fileChecksumPosBack
+	14,			// fileChecksumEndBack
+	0x325F0,	// soundOffset
+}};
+
+// iMac (Original): "iMac Firmware 3.0" from iMac Firmware Update 1.2
+constexpr ModelDescriptor<Ascii85Lines, HexChecksumField> IMAC_ORIGINAL = {{
+	"iMac (Original)",
+	"iMac Firmware 3.0",
+	"702c51c05f59fb751e5dcfb5b194fba3",
+	NULL,		// maskedMd5 (not known yet)
+	0x70192,	// romOffset
+	0xDCC6F,	// romEndOffset
+	100,		// columnWidth
+	0x7FFFC,	// romChecksumLength
+	0x00,		// romPadByte
+	0xDCCCD,	// romChecksumPos
+	9,			// fileChecksumPosBack
+	14,			// fileChecksumEndBack
+	0x43C50,	// soundOffset
+}};
+
+// iMac (Slot Loading): "iMac Firmware" from iMac Firmware Update 4.1.9.
+// The ROM image is the raw "sboot" section starting at 0x6E07C. Its checksum is in a table
+// near the start of the firmware data and covers the section padded with 0xFF up to 0x80000
+// bytes, minus the last 4 bytes (I believe that's where the checksum goes in the actual flash
+// chip). The checksum of the whole file is stored big-endian in its last 4 bytes.
+// Note that there seems to be a 16-byte sound header, so the table in the firmware actually
+// says that the sound is 0xE4C4 bytes and starts at 0x63DA0 instead. I'm just going with
+// what I find convenient.
+constexpr ModelDescriptor<RawSection, BigEndianChecksumField> IMAC_SLOT_LOADING = {{
+	"iMac (Slot Loading)",
+	"iMac Firmware",
+	"9df1737e52474ca77d682603a66b3c91",
+	NULL,						// maskedMd5 (not known yet)
+	0x6E07C,				// romOffset
+	0x6E07C + 0x72280,		// romEndOffset
+	0,						// columnWidth
+	0x80000 - 4,			// romChecksumLength
+	0xFF,					// romPadByte
+	0x6890,					// romChecksumPos
+	4,						// fileChecksumPosBack
+	4,						// fileChecksumEndBack
+	0x63DB0,				// soundOffset
+}};
+
+// Runtime entry for a supported model. Dispatching through here happens once per patch job;
+// everything below it is the model's own instantiation of the engine.
+struct ModelInfo
+{
+	const char *id; // short name used on the command line
+	const ModelLayout *layout;
+	DecodeResult (*decodeFirmware)(const ModelLayout &layout, const std::string &firmware, std::string &rom);
+	DecodeResult (*checkRom)(const ModelLayout &layout, const std::string &firmware, const char *rom, size_t romLength);
+	void (*fileChecksumParts)(const ModelLayout &layout, const std::string &firmware, FileChecksumParts &parts);
+	size_t (*maxEncodedLength)(const ModelLayout &layout);
+	void (*injectChime)(const ModelLayout &layout, std::string &firmware, std::string &rom,
+						const std::string &compressedSound, const FileChecksumParts &parts,
+						std::string &encodedROMImage);
+	void (*patchIncremental)(const ModelLayout &layout, const std::string &firmware, const char *rom, size_t romLength,
+							 const std::string &compressedSound, const FileChecksumParts &parts, IncrementalPatch &patch);
+	void (*repatchIncremental)(IncrementalPatch &patch, const std::string &compressedSound, size_t start, size_t end);
+	size_t (*maxStreamSegment)(const ModelLayout &layout, const std::string &firmware);
+	void (*streamChime)(const ModelLayout &layout, const std::string &firmware, std::string &rom,
+						const std::string &compressedSound, const FileChecksumParts &parts, std::string &segment,
+						const SegmentSink &sink);
+	bool (*streamReadChime)(const ModelLayout &layout, FirmwareReader &reader, uint32_t &romChecksum, std::string &chime);
+	bool (*streamPatch)(const ModelLayout &layout, FirmwareReader &reader, const std::string &compressedSound,
+						uint32_t romChecksum, FirmwareWriter &writer);
+	bool (*looksLike)(const ModelLayout &layout, FirmwareReader &reader);
+	void (*verifyFirmware)(const ModelLayout &layout, FirmwareReader &reader, VerifyResult &result);
+	bool (*rebaseLayout)(const ModelLayout &layout, const std::string &firmware, ModelLayout &actual);
+	std::string (*maskedDigest)(const ModelLayout &layout, const std::string &firmware, const std::string &rom);
+};
+
+// All built-in models
+extern const ModelInfo MODELS[];
+extern const size_t NUM_MODELS;
+
+// How a model added at runtime stores its ROM image and checksums (see addModel)
+enum ContainerKind
+{
+	CONTAINER_ASCII85_LINES = 0,
+	CONTAINER_RAW_SECTION
+};
+enum ChecksumFieldKind
+{
+	CHECKSUM_FIELD_HEX = 0,
+	CHECKSUM_FIELD_BIG_ENDIAN
+};
+
+// Instantiates the engine for a layout that isn't a model yet (one that was just located, say).
+// The returned info points at layout, so layout has to outlive it.
+ModelInfo makeRuntimeModelInfo(const char *id, const ModelLayout *layout, ContainerKind container,
+							   ChecksumFieldKind checksumField);
+
+// Adds a model that isn't built in (one read from a descriptor file, say). The id, layout and
+// the layout's strings are copied. This isn't thread-safe, so add models at startup before
+// anything looks them up. Returns NULL if a model with that id or MD5 already exists.
+const ModelInfo *addModel(const std::string &id, const ModelLayout &layout, ContainerKind container,
+						  ChecksumFieldKind checksumField);
+
+// Gives a model a masked MD5 at runtime, so files patched from its original can be re-patched.
+// This is how a descriptor file adds one to a built-in model. The string is copied. Like
+// addModel, this isn't thread-safe. Returns false if the model already has a different one.
+bool setModelMaskedMd5(const ModelInfo *model, const std::string &maskedMd5);
+// The model's masked MD5, whether it came with the layout or from setModelMaskedMd5 (NULL if
+// it doesn't have one). Use this instead of layout->maskedMd5.
+const char *modelMaskedMd5(const ModelInfo &model);
+
+// Every model, built-in ones first, then the ones added at runtime
+size_t numModels();
+const ModelInfo &modelAt(size_t index);
+
+// Finds the model whose original firmware file has the given MD5 (NULL if none)
+const ModelInfo *findModelByMd5(const std::string &md5);
+// Finds the model with the given id (NULL if none)
+const ModelInfo *findModelById(const std::string &id);
+
+#endif // MODELS_H
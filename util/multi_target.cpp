@@ -0,0 +1,124 @@
+#include "multi_target.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// One target's firmware and patch job
+struct TargetSlot
+{
+	FirmwareImage image;
+	ChimeError error;
+	const string *failedFile;
+};
+
+// Prints how a target went, and counts it if it failed
+static void reportTarget(const TargetJob &target, const TargetSlot &slot, bool cached, mutex &outputLock,
+						 size_t &failures);
+
+ChimeError runMultiTarget(const char *soundFile, const vector<TargetJob> &targets, const MultiTargetOptions &options,
+						  size_t &failures)
+{
+	failures = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ThreadPool pool(options.numThreads);
+	mutex outputLock;
+
+	// The sound is encoded while the firmware files load, since it doesn't depend on any of them
+	FirmwareImage noFirmware;
+	PatchContext sound(noFirmware);
+	ChimeError soundError = CHIME_OK;
+	pool.submit([&sound, &soundError, soundFile]()
+	{
+		soundError = sound.loadSoundFile(soundFile);
+		if (soundError == CHIME_OK)
+		{
+			soundError = sound.encodeSound();
+		}
+	});
+	vector<unique_ptr<TargetSlot> > slots;
+	for (size_t x = 0; x < targets.size(); x++)
+	{
+		slots.emplace_back(new TargetSlot);
+		TargetSlot *slot = slots.back().get();
+		const TargetJob &target = targets[x];
+		pool.submit([slot, &target, &options]()
+		{
+			slot->image.setRomCache(options.romCache);
+			slot->error = slot->image.loadFile(target.firmwareFile.c_str(), options.expectedModel);
+			slot->failedFile = &target.firmwareFile;
+		});
+	}
+	pool.wait();
+	if (soundError != CHIME_OK)
+	{
+		return soundError;
+	}
+
+	// Then every firmware file gets its own copy of the encoded chime, and they're all patched at once
+	for (size_t x = 0; x < targets.size(); x++)
+	{
+		TargetSlot *slot = slots[x].get();
+		const TargetJob &target = targets[x];
+		if (slot->error != CHIME_OK)
+		{
+			reportTarget(target, *slot, false, outputLock, failures);
+			continue;
+		}
+		pool.submit([slot, &target, &sound, &options, &outputLock, &failures]()
+		{
+			PatchContext context(slot->image);
+			context.setCache(options.cache);
+			unique_ptr<DeltaIndex> deltaIndex;
+			if (options.deltaOutput)
+			{
+				deltaIndex.reset(new DeltaIndex(slot->image.firmware()));
+				context.setDeltaIndex(deltaIndex.get());
+			}
+
+			slot->failedFile = &target.outputFile;
+			slot->error = context.copySound(sound);
+			if (slot->error == CHIME_OK)
+			{
+				slot->error = context.openOutputFile(target.outputFile.c_str());
+			}
+			if (slot->error == CHIME_OK)
+			{
+				slot->error = context.injectChime();
+			}
+			if (slot->error == CHIME_OK)
+			{
+				slot->error = context.writeOutputFile();
+			}
+			reportTarget(target, *slot, context.outputFromCache(), outputLock, failures);
+		});
+	}
+	pool.wait();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Patched " << (targets.size() - failures) << " of " << targets.size() << " firmware files with one encode in " <<
+		(seconds * 1000.0) << " ms on " << pool.size() << " threads." << endl;
+	return CHIME_OK;
+}
+
+static void reportTarget(const TargetJob &target, const TargetSlot &slot, bool cached, mutex &outputLock,
+						 size_t &failures)
+{
+	lock_guard<mutex> l(outputLock);
+	if (slot.error == CHIME_OK)
+	{
+		cout << "Wrote " << target.outputFile << " for " << slot.image.model()->layout->name <<
+			(cached ? " (cached)" : "") << endl;
+	}
+	else
+	{
+		cerr << "\"" << *slot.failedFile << "\": " << chimeErrorString(slot.error) << "." << endl;
+		failures++;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef MULTI_TARGET_H
+#define MULTI_TARGET_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// The other way around from batch mode: one chime going into several firmware files, usually
+// one for each model. Every model stores the same IMA 4:1 chime, so the sound is encoded just
+// once, while the firmware files are loading. Then each firmware file is patched (its ROM
+// image re-encoded into whatever container the model uses) on its own thread.
+
+#include <string>
+#include <vector>
+#include "chimepatch.h"
+
+// One firmware file to patch, and where to put the result
+struct TargetJob
+{
+	std::string firmwareFile;
+	std::string outputFile;
+};
+
+// How runMultiTarget goes about it
+struct MultiTargetOptions
+{
+	MultiTargetOptions() : numThreads(0), expectedModel(NULL), cache(NULL), romCache(NULL), deltaOutput(false) {}
+
+	unsigned numThreads; // 0 = one per CPU
+	const ModelInfo *expectedModel; // if not NULL, every firmware file has to be for this model
+	const OutputCache *cache; // may be NULL
+	const RomCache *romCache; // may be NULL
+	bool deltaOutput; // write deltas against each original instead of whole files
+};
+
+// Patches the sound into every target. A problem with the sound is returned (and nothing is
+// patched); a problem with a target is printed, and the others carry on. failures is set to the
+// number of targets that failed.
+ChimeError runMultiTarget(const char *soundFile, const std::vector<TargetJob> &targets,
+						  const MultiTargetOptions &options, size_t &failures);
+
+#endif // MULTI_TARGET_H
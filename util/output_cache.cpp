@@ -0,0 +1,106 @@
+#include "output_cache.h"
+#include "files.h"
+#include "md5.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Bump this if anything changes the patched output for the same inputs
+static const char CACHE_VERSION[] = "chimepatch-cache-1";
+
+// Bump the number if the entry format changes
+static const char OUTPUT_CACHE_MAGIC[16] = "chimepatch-out1";
+
+// The start of every entry, followed by the patched file
+struct OutputCacheHeader
+{
+	char magic[16];
+	char outputMd5[33];
+	char reserved[7];
+	uint64_t outputLength;
+};
+
+OutputCache::OutputCache(const string &directory) :
+	cacheDirectory(directory)
+{
+}
+
+string OutputCache::makeKey(const string &firmwareMd5, const string &sound, const string &encoderOptions)
+{
+	string keyData(CACHE_VERSION);
+	keyData.append(1, '\0');
+	keyData.append(firmwareMd5);
+	keyData.append(1, '\0');
+	keyData.append(md5(sound));
+	keyData.append(1, '\0');
+	keyData.append(encoderOptions);
+	return md5(keyData);
+}
+
+string OutputCache::pathFor(const string &key) const
+{
+	return cacheDirectory + "/" + key + ".out";
+}
+
+bool OutputCache::lookup(const string &key, string &output) const
+{
+	output.clear();
+	string entry;
+	if (!readFile(pathFor(key).c_str(), entry) || entry.length() <= sizeof(OutputCacheHeader))
+	{
+		return false;
+	}
+
+	// Anything that doesn't add up is treated as a miss (and gets replaced)
+	OutputCacheHeader header;
+	memcpy(&header, entry.data(), sizeof(header));
+	header.outputMd5[sizeof(header.outputMd5) - 1] = '\0';
+	if (memcmp(header.magic, OUTPUT_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.outputLength != entry.length() - sizeof(header))
+	{
+		return false;
+	}
+	entry.erase(0, sizeof(header));
+	if (md5(entry) != header.outputMd5)
+	{
+		return false;
+	}
+	output.swap(entry);
+	return true;
+}
+
+bool OutputCache::store(const string &key, const string &output) const
+{
+	OutputCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OUTPUT_CACHE_MAGIC, sizeof(header.magic));
+	string outputMd5 = md5(output);
+	outputMd5.copy(header.outputMd5, sizeof(header.outputMd5) - 1);
+	header.outputLength = output.length();
+
+	string entry(reinterpret_cast<const char *>(&header), sizeof(header));
+	entry.append(output);
+
+	// Write to a unique temporary file first so nobody ever sees a partial entry
+	string tmpPath = pathFor(key) + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if (fd < 0)
+	{
+		return false;
+	}
+	close(fd);
+
+	if (!writeFile(tmpPath.c_str(), entry) || rename(tmpPath.c_str(), pathFor(key).c_str()) != 0)
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,33 @@
+#ifndef OUTPUT_CACHE_H
+#define OUTPUT_CACHE_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+
+// A directory of previously patched firmware files, named by a hash of everything that
+// goes into producing them: the MD5 of the verified original firmware, the MD5 of the
+// sound, and the encoder settings. Patching is deterministic, so a cached file is
+// byte-for-byte what a fresh run would produce. Entries are written to a temporary file
+// and renamed into place, so several processes can share one cache directory. Each entry
+// starts with a header holding the MD5 of the patched file, and an entry that doesn't
+// match it is treated as a miss.
+class OutputCache
+{
+public:
+	explicit OutputCache(const std::string &directory);
+
+	static std::string makeKey(const std::string &firmwareMd5, const std::string &sound,
+							   const std::string &encoderOptions);
+
+	bool lookup(const std::string &key, std::string &output) const;
+	bool store(const std::string &key, const std::string &output) const;
+
+private:
+	std::string pathFor(const std::string &key) const;
+
+	std::string cacheDirectory;
+};
+
+#endif // OUTPUT_CACHE_H
@@ -0,0 +1,1068 @@
+#ifndef PATCH_ENGINE_H
+#define PATCH_ENGINE_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// The patching process is identical for every supported machine: decode the ROM image
+// out of the firmware file, drop the new chime into it, recalculate the ROM checksum,
+// encode the ROM back into the firmware file, and recalculate the checksum of the whole
+// file. The only things that differ are where everything lives (a ModelLayout), how the
+// ROM is stored inside the file (a container codec policy) and how the checksums are
+// written out (a checksum field policy). The policies are template parameters so each
+// model gets its own fully inlined copy of the engine.
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "adler32.h"
+#include "ascii85.h"
+#include "firmware_stream.h"
+#include "md5.h"
+#include "stats.h"
+
+// Info about the sound stored in the ROM image (the same for all supported models)
+#define NUM_SOUND_PACKETS		1722
+#define BYTES_PER_PACKET		34
+#define SAMPLES_PER_PACKET		64
+#define BYTES_PER_SAMPLE		2 /* 16 bits */
+#define SOUND_SAMPLES_MAX		(NUM_SOUND_PACKETS * SAMPLES_PER_PACKET)
+#define SOUND_MAX_SIZE			(SOUND_SAMPLES_MAX * BYTES_PER_SAMPLE)
+#define SOUND_COMPRESSED_SIZE	(NUM_SOUND_PACKETS * BYTES_PER_PACKET)
+
+// Where everything lives inside one model's firmware update file
+struct ModelLayout
+{
+	const char *name; // name of the machine
+	const char *firmwareName; // name of the firmware file Apple shipped
+	const char *md5; // MD5 of the original firmware file
+	const char *maskedMd5; // MD5 of the parts of the firmware that patching leaves alone (see maskedDigest), or NULL if not known
+	size_t romOffset; // start of the ROM image inside the firmware file
+	size_t romEndOffset; // end of the ROM image inside the firmware file
+	size_t columnWidth; // Ascii85 characters per line (Ascii85 containers only)
+	size_t romChecksumLength; // the ROM is padded to this length when calculating its checksum
+	uint8_t romPadByte; // the byte the ROM is padded with
+	size_t romChecksumPos; // location of the ROM checksum inside the original firmware file
+	size_t fileChecksumPosBack; // location of the file checksum, counted back from the end of the file
+	size_t fileChecksumEndBack; // the file checksum covers everything except this many bytes at the end
+	size_t soundOffset; // location of the chime inside the decoded ROM image
+};
+
+// Adler-32s of the two parts of an original firmware file that patching leaves alone (apart
+// from the ROM checksum field, which is adjusted for): everything before the ROM image, and
+// everything after it up to the file checksum. With these, the checksum of a patched file
+// only needs the newly encoded ROM image to be checksummed.
+struct FileChecksumParts
+{
+	uint32_t beforeRomAdler;
+	uint32_t afterRomAdler;
+	size_t afterRomLength;
+};
+
+// Takes a finished piece of a firmware file from PatchEngine::streamChime, leaving an empty
+// buffer in segment for the next piece (one with capacity to spare, ideally, so that
+// streaming doesn't have to allocate)
+typedef std::function<void(std::string &segment)> SegmentSink;
+
+// A part of a firmware file that has changed
+struct FirmwareRange
+{
+	size_t offset;
+	size_t length;
+};
+
+// One piece of the encoded ROM image in an IncrementalPatch
+struct EncodedRomChunk
+{
+	size_t romPos; // where it starts in the decoded ROM
+	size_t length; // length of the encoded text
+	uint32_t adler; // adler32 of the encoded text
+};
+
+// A patched firmware file, kept along with everything needed to swap a slightly different
+// chime into it without re-encoding or re-checksumming the whole thing (see
+// PatchEngine::patchIncremental)
+struct IncrementalPatch
+{
+	std::string firmware; // the patched firmware file
+	std::string rom; // its decoded ROM image
+	ModelLayout layout; // where everything is in firmware now
+	std::vector<EncodedRomChunk> chunks; // the encoded ROM image, in pieces that can be redone separately
+	uint32_t romChecksum;
+	uint32_t beforeRomAdler; // like FileChecksumParts, but with the current ROM checksum field
+	uint32_t afterRomAdler;
+	size_t afterRomLength;
+	std::vector<FirmwareRange> changed; // what the last update changed in firmware
+};
+
+// What decodeFirmware found
+enum DecodeResult
+{
+	DECODE_OK = 0,
+	DECODE_BAD_FORMAT, // the ROM image couldn't be decoded, or isn't the size it should be
+	DECODE_BAD_CHECKSUM // the decoded ROM doesn't match the ROM checksum stored in the file
+};
+
+// Container codec: the ROM image is stored as Ascii85 text, one "dc85 " Forth word per line,
+// with each line terminated by a carriage return.
+struct Ascii85Lines
+{
+	// Decodes the ROM image onto the end of rom, continuing the running adler32 romAdler over
+	// the decoded bytes as it goes
+	static bool decode(const ModelLayout &layout, const std::string &firmware, std::string &rom,
+					   uint32_t &romAdler)
+	{
+		// extract just the ROM image portion of the file out and decode the Ascii85
+		size_t curPos = layout.romOffset;
+		while (curPos < layout.romEndOffset)
+		{
+			// Skip past the "dc85 "
+			size_t dc85Pos = firmware.find("dc85 ", curPos);
+			if (dc85Pos == std::string::npos) break;
+			curPos = dc85Pos + 5;
+
+			// Find the carriage return
+			size_t endLinePos = firmware.find('\r', curPos);
+			if (endLinePos == std::string::npos) break;
+
+			// Decode this line of the firmware file straight onto the end of the buffer, and
+			// checksum it while it's still in the cache
+			size_t decodedPos = rom.length();
+			if (!dc85(firmware.data() + curPos, endLinePos - curPos, rom))
+			{
+				return false;
+			}
+			romAdler = adler32Update(romAdler, rom.data() + decodedPos, rom.length() - decodedPos);
+
+			// Move to the next line
+			curPos = endLinePos + 1;
+		}
+
+		return true;
+	}
+
+	// Encodes whole lines of the ROM image, starting at pos, onto the end of encoded until at
+	// least minBytes of the ROM have been used up (or it runs out). The running adler32
+	// encodedAdler is continued over the encoded text as it goes. Returns where it stopped.
+	static size_t encode(const ModelLayout &layout, const std::string &rom, size_t pos, size_t minBytes,
+						 std::string &encoded, uint32_t &encodedAdler)
+	{
+		size_t curPos = pos;
+		size_t endPos = (minBytes < rom.length() - pos) ? pos + minBytes : rom.length();
+		while (curPos < endPos)
+		{
+			// Encode the data, with no more than columnWidth characters per line
+			// (not including "dc85 " and carriage return at end of line)
+			// This just matches the format Apple used, so why not follow it?
+			size_t linePos = encoded.length();
+			encoded.append("dc85 ", 5);
+			curPos += ec85Append(rom, encoded, curPos, layout.columnWidth);
+			encoded.append(1, '\r');
+			encodedAdler = adler32Update(encodedAdler, encoded.data() + linePos, encoded.length() - linePos);
+		}
+		return curPos;
+	}
+
+	// Finds the end of the ROM image in a (possibly patched) firmware file: just past the last
+	// "dc85 " line. Returns 0 if there's no ROM image where the layout says it starts.
+	static size_t findRomEnd(const ModelLayout &layout, const std::string &firmware)
+	{
+		size_t curPos = layout.romOffset;
+		while (firmware.compare(curPos, 5, "dc85 ") == 0)
+		{
+			size_t endLinePos = firmware.find('\r', curPos + 5);
+			if (endLinePos == std::string::npos) return 0;
+			curPos = endLinePos + 1;
+		}
+		return (curPos > layout.romOffset) ? curPos : 0;
+	}
+
+	// Whether a (possibly patched) firmware file looks like it has an Ascii85 ROM image where
+	// this layout says it should be. The reader has to be positioned before the ROM.
+	static bool looksLike(const ModelLayout &layout, FirmwareReader &reader)
+	{
+		const char *start;
+		return reader.skipTo(layout.romOffset) && (start = reader.peek(5)) && memcmp(start, "dc85 ", 5) == 0;
+	}
+
+	// Decodes the ROM image as the reader goes past it, one line at a time, feeding it to rom
+	// (a RomChecker, say). The reader has to be positioned at the start of the ROM image, and
+	// is left just past the end of it (which may not be at romEndOffset if the file has been
+	// patched).
+	template <class RomSink>
+	static bool streamDecode(const ModelLayout &layout, FirmwareReader &reader, RomSink &rom)
+	{
+		std::string line;
+		std::string decoded;
+		const char *start;
+		while ((start = reader.peek(5)) && memcmp(start, "dc85 ", 5) == 0)
+		{
+			if (!reader.readLine('\r', line, layout.columnWidth + 16))
+			{
+				return false;
+			}
+			decoded.clear();
+			if (!dc85(line.data() + 5, line.length() - 5, decoded))
+			{
+				return false;
+			}
+			rom.feed(decoded.data(), decoded.length());
+		}
+		return rom.length() > 0;
+	}
+
+	// Encodes a ROM image fed to it a piece at a time, writing out each line as soon as it's
+	// sure to come out exactly the way Ascii85Lines::encode would have made it
+	class StreamEncoder
+	{
+	public:
+		StreamEncoder(const ModelLayout &layout, FirmwareWriter &writer) : layout(layout), writer(writer), pos(0) {}
+
+		void feed(const char *data, size_t len)
+		{
+			// No line uses up more than 4 bytes per character ('z' shortcuts), so a line can
+			// be encoded as soon as there are that many bytes in hand
+			window.erase(0, pos);
+			pos = 0;
+			window.append(data, len);
+			while (window.length() - pos >= layout.columnWidth * 4)
+			{
+				encodeLine();
+			}
+		}
+
+		// Encodes whatever is left once the whole ROM has been fed
+		void finish()
+		{
+			while (pos < window.length())
+			{
+				encodeLine();
+			}
+		}
+
+	private:
+		void encodeLine()
+		{
+			line.assign("dc85 ", 5);
+			pos += ec85Append(window, line, pos, layout.columnWidth);
+			line.append(1, '\r');
+			writer.write(line.data(), line.length());
+		}
+
+		const ModelLayout &layout;
+		FirmwareWriter &writer;
+		std::string window; // decoded ROM bytes not encoded yet (from pos on)
+		size_t pos;
+		std::string line;
+	};
+
+	// The longest the encoded ROM can possibly be: no 'z' or 'y' shortcuts anywhere
+	static size_t maxEncodedLength(const ModelLayout &layout)
+	{
+		size_t groups = (layout.romChecksumLength + 3) / 4;
+		size_t groupsPerLine = layout.columnWidth / 5;
+		size_t lines = (groups + groupsPerLine - 1) / groupsPerLine;
+		return groups * 5 + lines * 6;
+	}
+
+	// The longest piece encode can make when asked for minBytes: its last line can go past
+	// them by up to columnWidth groups (if they're all 'z' or 'y')
+	static size_t maxEncodedChunk(const ModelLayout &layout, size_t minBytes)
+	{
+		size_t groups = (minBytes + 3) / 4 + layout.columnWidth;
+		size_t groupsPerLine = layout.columnWidth / 5;
+		size_t lines = (groups + groupsPerLine - 1) / groupsPerLine;
+		return groups * 5 + lines * 6;
+	}
+};
+
+// Container codec: the ROM image is stored as a raw section of the firmware file.
+struct RawSection
+{
+	static bool decode(const ModelLayout &layout, const std::string &firmware, std::string &rom,
+					   uint32_t &romAdler)
+	{
+		// extract just the ROM image portion of the file out, as long as there is room
+		if (firmware.length() < layout.romEndOffset)
+		{
+			return false;
+		}
+		rom.assign(firmware, layout.romOffset, layout.romEndOffset - layout.romOffset);
+		romAdler = adler32Update(romAdler, rom.data(), rom.length());
+		return true;
+	}
+
+	static size_t encode(const ModelLayout &, const std::string &rom, size_t pos, size_t minBytes,
+						 std::string &encoded, uint32_t &encodedAdler)
+	{
+		size_t len = (minBytes < rom.length() - pos) ? minBytes : rom.length() - pos;
+		encoded.append(rom, pos, len);
+		encodedAdler = adler32Update(encodedAdler, rom.data() + pos, len);
+		return pos + len;
+	}
+
+	// A raw ROM image is always the same length
+	static size_t findRomEnd(const ModelLayout &layout, const std::string &firmware)
+	{
+		return (firmware.length() >= layout.romEndOffset) ? layout.romEndOffset : 0;
+	}
+
+	// There's nothing to recognize a raw ROM image by, so just check that there's room for one
+	static bool looksLike(const ModelLayout &layout, FirmwareReader &reader)
+	{
+		return reader.length() >= layout.romEndOffset + layout.fileChecksumEndBack;
+	}
+
+	template <class RomSink>
+	static bool streamDecode(const ModelLayout &layout, FirmwareReader &reader, RomSink &rom)
+	{
+		size_t remaining = layout.romEndOffset - layout.romOffset;
+		while (remaining > 0)
+		{
+			size_t len = (remaining < reader.capacity()) ? remaining : reader.capacity();
+			const char *data = reader.peek(len);
+			if (!data)
+			{
+				return false;
+			}
+			rom.feed(data, len);
+			reader.skip(len);
+			remaining -= len;
+		}
+		return true;
+	}
+
+	static size_t maxEncodedLength(const ModelLayout &layout)
+	{
+		return layout.romEndOffset - layout.romOffset;
+	}
+
+	// encode never goes past minBytes
+	static size_t maxEncodedChunk(const ModelLayout &, size_t minBytes)
+	{
+		return minBytes;
+	}
+
+	// Nothing to encode; the ROM is written out as it's fed
+	class StreamEncoder
+	{
+	public:
+		StreamEncoder(const ModelLayout &, FirmwareWriter &writer) : writer(writer) {}
+		void feed(const char *data, size_t len) { writer.write(data, len); }
+		void finish() {}
+
+	private:
+		FirmwareWriter &writer;
+	};
+};
+
+// Checksum field: 8 uppercase hex digits
+struct HexChecksumField
+{
+	enum { SIZE = 8 };
+
+	static void write(std::string &buf, size_t pos, uint32_t checksum)
+	{
+		static const char hexDigits[] = "0123456789ABCDEF";
+		char field[SIZE];
+		for (int x = 0; x < SIZE; x++)
+		{
+			field[x] = hexDigits[(checksum >> (4 * (SIZE - 1 - x))) & 0xF];
+		}
+		buf.replace(pos, SIZE, field, SIZE);
+	}
+
+	static bool read(const std::string &buf, size_t pos, uint32_t &checksum)
+	{
+		return (pos + SIZE <= buf.length()) && read(buf.data() + pos, checksum);
+	}
+
+	static bool read(const char *field, uint32_t &checksum)
+	{
+		checksum = 0;
+		for (int x = 0; x < SIZE; x++)
+		{
+			char c = field[x];
+			uint32_t digit;
+			if (c >= '0' && c <= '9') digit = c - '0';
+			else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+			else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+			else return false;
+			checksum = (checksum << 4) | digit;
+		}
+		return true;
+	}
+};
+
+// Checksum field: 4 raw bytes, big-endian
+struct BigEndianChecksumField
+{
+	enum { SIZE = 4 };
+
+	static void write(std::string &buf, size_t pos, uint32_t checksum)
+	{
+		char field[SIZE];
+		field[0] = static_cast<char>((checksum >> 24) & 0xFF);
+		field[1] = static_cast<char>((checksum >> 16) & 0xFF);
+		field[2] = static_cast<char>((checksum >> 8) & 0xFF);
+		field[3] = static_cast<char>((checksum >> 0) & 0xFF);
+		buf.replace(pos, SIZE, field, SIZE);
+	}
+
+	static bool read(const std::string &buf, size_t pos, uint32_t &checksum)
+	{
+		return (pos + SIZE <= buf.length()) && read(buf.data() + pos, checksum);
+	}
+
+	static bool read(const char *field, uint32_t &checksum)
+	{
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(field);
+		checksum = (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+			(static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+		return true;
+	}
+};
+
+template <class Container, class ChecksumField>
+struct PatchEngine
+{
+	// Decodes the ROM image out of a (verified) firmware file, and checks it against the ROM
+	// checksum stored in the file. The checksum is calculated as the ROM is decoded, so this
+	// doesn't take another pass over it.
+	static DecodeResult decodeFirmware(const ModelLayout &layout, const std::string &firmware, std::string &rom)
+	{
+		StageTimer timer("decodeRom", layout.romEndOffset - layout.romOffset);
+		uint32_t romAdler = 1; // adler32 of nothing
+		if (!Container::decode(layout, firmware, rom, romAdler))
+		{
+			return DECODE_BAD_FORMAT;
+		}
+
+		return checkDecodedRom(layout, firmware, rom.length(), romAdler);
+	}
+
+	// Checks an already-decoded ROM image (from the ROM cache, say) against the ROM checksum
+	// stored in the firmware file, the same way decodeFirmware does
+	static DecodeResult checkRom(const ModelLayout &layout, const std::string &firmware, const char *rom, size_t romLength)
+	{
+		StageTimer timer("checkRom", romLength);
+		return checkDecodedRom(layout, firmware, romLength, adler32Update(1, rom, romLength));
+	}
+
+	// Quick check of whether a firmware file (patched or not) could be this model's
+	static bool looksLike(const ModelLayout &layout, FirmwareReader &reader)
+	{
+		return reader.length() > layout.romOffset + layout.fileChecksumEndBack && Container::looksLike(layout, reader);
+	}
+
+	// Checks that a firmware file (patched or not) is self-consistent, reading it front to back
+	// exactly once: the file checksum, the ROM checksum (by decoding the ROM image as it goes
+	// by) and the packet headers of the chime. The reader has to be freshly opened.
+	static void verifyFirmware(const ModelLayout &layout, FirmwareReader &reader, VerifyResult &result)
+	{
+		result = VerifyResult();
+		size_t length = reader.length();
+		// (A patched file can be shorter than the original, but the ROM image always starts in the same place)
+		if (length < layout.romOffset + layout.fileChecksumEndBack)
+		{
+			result.error = "file is too short";
+			return;
+		}
+		reader.setChecksumEnd(length - layout.fileChecksumEndBack);
+
+		// The ROM checksum is either before the ROM image...
+		char field[ChecksumField::SIZE];
+		bool romFieldBeforeRom = layout.romChecksumPos < layout.romOffset;
+		if (romFieldBeforeRom && (!reader.skipTo(layout.romChecksumPos) || !reader.read(field, ChecksumField::SIZE) ||
+			!ChecksumField::read(field, result.storedRomChecksum)))
+		{
+			result.error = "unable to read the ROM checksum";
+			return;
+		}
+
+		RomChecker rom(layout.soundOffset);
+		if (!reader.skipTo(layout.romOffset) || !Container::streamDecode(layout, reader, rom) ||
+			rom.length() < layout.soundOffset + SOUND_COMPRESSED_SIZE || rom.length() > layout.romChecksumLength)
+		{
+			result.error = "unable to decode the ROM image";
+			return;
+		}
+		result.romChecksum = adler32Fill(rom.checksum(), layout.romPadByte, layout.romChecksumLength - rom.length());
+		result.badPacket = rom.firstBadPacket();
+
+		// ...or after it, moved by however much the ROM image grew or shrank when it was re-encoded
+		if (!romFieldBeforeRom)
+		{
+			size_t pos = layout.romChecksumPos - layout.romEndOffset + reader.position();
+			if (!reader.skipTo(pos) || !reader.read(field, ChecksumField::SIZE) ||
+				!ChecksumField::read(field, result.storedRomChecksum))
+			{
+				result.error = "unable to read the ROM checksum";
+				return;
+			}
+		}
+
+		// Then the file checksum at the end
+		if (!reader.skipTo(length - layout.fileChecksumPosBack) || !reader.read(field, ChecksumField::SIZE) ||
+			!ChecksumField::read(field, result.storedFileChecksum))
+		{
+			result.error = "unable to read the file checksum";
+			return;
+		}
+		result.fileChecksum = reader.checksum();
+	}
+
+	// Works out the layout of a firmware file that may already have been patched. Re-encoding
+	// can change the length of the ROM image, which moves everything after it; actual gets the
+	// layout with the end of the ROM image and the ROM checksum field where they really are.
+	static bool rebaseLayout(const ModelLayout &layout, const std::string &firmware, ModelLayout &actual)
+	{
+		size_t romEnd = (firmware.length() > layout.romOffset) ? Container::findRomEnd(layout, firmware) : 0;
+		if (romEnd == 0 || firmware.length() < romEnd + layout.fileChecksumEndBack ||
+			firmware.length() < layout.fileChecksumPosBack)
+		{
+			return false;
+		}
+		actual = layout;
+		actual.romEndOffset = romEnd;
+		if (layout.romChecksumPos >= layout.romEndOffset)
+		{
+			actual.romChecksumPos = layout.romChecksumPos - layout.romEndOffset + romEnd;
+		}
+		return actual.romChecksumPos + ChecksumField::SIZE <= firmware.length();
+	}
+
+	// MD5 of everything in a firmware file that patching doesn't change, so it comes out the
+	// same for the original file and for every file patched from it: the file with the ROM
+	// image swapped for the decoded ROM, and the chime and both checksum fields zeroed. The
+	// decoded ROM is used because re-encoding it can move the line breaks. layout has to be
+	// the file's actual layout (see rebaseLayout), and rom the decoded ROM image.
+	static std::string maskedDigest(const ModelLayout &layout, const std::string &firmware, const std::string &rom)
+	{
+		StageTimer timer("maskedMd5", firmware.length());
+		size_t romFieldEnd = layout.romChecksumPos + ChecksumField::SIZE;
+		size_t fileFieldPos = firmware.length() - layout.fileChecksumPosBack;
+		MD5 digest;
+		updateMasked(digest, firmware.data(), 0, layout.romOffset, layout.romChecksumPos, romFieldEnd);
+		updateMasked(digest, rom.data(), 0, rom.length(), layout.soundOffset, layout.soundOffset + SOUND_COMPRESSED_SIZE);
+		updateMasked(digest, firmware.data(), layout.romEndOffset, fileFieldPos, layout.romChecksumPos, romFieldEnd);
+		updateMasked(digest, firmware.data(), fileFieldPos, firmware.length(), fileFieldPos, fileFieldPos + ChecksumField::SIZE);
+		return digest.finalize().hexdigest();
+	}
+
+	// Checksums the unchanging parts of a firmware file, for injectChime. For a file that has
+	// already been patched, layout has to be its actual layout (see rebaseLayout).
+	static void fileChecksumParts(const ModelLayout &layout, const std::string &firmware, FileChecksumParts &parts)
+	{
+		parts.beforeRomAdler = adler32Update(1, firmware.data(), layout.romOffset);
+		parts.afterRomLength = firmware.length() - layout.fileChecksumEndBack - layout.romEndOffset;
+		parts.afterRomAdler = adler32Update(1, firmware.data() + layout.romEndOffset, parts.afterRomLength);
+	}
+
+	// Size of the scratch buffer injectChime needs for the encoded ROM
+	static size_t maxEncodedLength(const ModelLayout &layout)
+	{
+		return Container::maxEncodedLength(layout);
+	}
+
+	// Sticks the new sound in place, recalculates checksums and encodes the ROM back into the
+	// firmware. parts must come from the same firmware file (see fileChecksumParts).
+	// encodedROMImage is scratch space; if it (and the other buffers) already have enough
+	// capacity reserved, no memory is allocated.
+	static void injectChime(const ModelLayout &layout, std::string &firmware, std::string &rom,
+							const std::string &compressedSound, const FileChecksumParts &parts,
+							std::string &encodedROMImage)
+	{
+		uint32_t romAdler = patchRom(layout, rom, compressedSound);
+
+		// Encode the ROM back into its container format, checksumming the encoded text as it's written
+		encodedROMImage.clear();
+		uint32_t encodedAdler = 1;
+		{
+			StageTimer timer("encodeRom", rom.length());
+			Container::encode(layout, rom, 0, rom.length(), encodedROMImage, encodedAdler);
+		}
+
+		// Replace the checksum of the ROM image with the recalculated checksum, keeping track of
+		// what that does to the checksum of whichever part of the file it's in
+		uint32_t beforeRomAdler = parts.beforeRomAdler;
+		uint32_t afterRomAdler = parts.afterRomAdler;
+		if (layout.romChecksumPos < layout.romOffset)
+		{
+			beforeRomAdler = replaceChecksumField(firmware, layout.romChecksumPos, romAdler, beforeRomAdler, 0,
+												  layout.romOffset);
+		}
+		else
+		{
+			afterRomAdler = replaceChecksumField(firmware, layout.romChecksumPos, romAdler, afterRomAdler,
+												 layout.romEndOffset, parts.afterRomLength);
+		}
+
+		// Replace the original ROM with the new one (note: this may change the firmware length!)
+		{
+			StageTimer timer("splice", encodedROMImage.length());
+			firmware.replace(layout.romOffset, layout.romEndOffset - layout.romOffset, encodedROMImage);
+		}
+
+		// The adler32 of the new firmware file (minus the part at the end that is used for
+		// storing the adler32) is just the three parts put together
+		StageTimer timer("fileChecksum");
+		uint32_t fullAdler = adler32Combine(beforeRomAdler, encodedAdler, encodedROMImage.length());
+		fullAdler = adler32Combine(fullAdler, afterRomAdler, parts.afterRomLength);
+
+		// Replace old adler32. Use offsets from END of file because firmware length may have changed.
+		ChecksumField::write(firmware, firmware.length() - layout.fileChecksumPosBack, fullAdler);
+	}
+
+	// ROM bytes encoded into each piece that streamChime hands over
+	enum { STREAM_CHUNK = 64 * 1024 };
+
+	// The biggest piece streamChime can hand over for this firmware file, so that the buffers
+	// can be sized for it up front
+	static size_t maxStreamSegment(const ModelLayout &layout, const std::string &firmware)
+	{
+		size_t outsideRom = std::max<size_t>(layout.romOffset, firmware.length() - layout.romEndOffset);
+		return std::max<size_t>(outsideRom, Container::maxEncodedChunk(layout, STREAM_CHUNK));
+	}
+
+	// Same as injectChime, except that the new firmware file is handed to sink a piece at a
+	// time as soon as each piece is final, and firmware (the original) is left alone. The part
+	// before the ROM goes first, as soon as the new ROM checksum is known; then the encoded ROM,
+	// STREAM_CHUNK bytes of it at a time; then the rest of the file with the new file checksum.
+	// Each piece is put together in segment, which is left holding the last buffer sink gave back.
+	static void streamChime(const ModelLayout &layout, const std::string &firmware, std::string &rom,
+							const std::string &compressedSound, const FileChecksumParts &parts,
+							std::string &segment, const SegmentSink &sink)
+	{
+		uint32_t romAdler = patchRom(layout, rom, compressedSound);
+		uint32_t beforeRomAdler = parts.beforeRomAdler;
+		uint32_t afterRomAdler = parts.afterRomAdler;
+
+		segment.assign(firmware, 0, layout.romOffset);
+		if (layout.romChecksumPos < layout.romOffset)
+		{
+			beforeRomAdler = replaceChecksumField(segment, layout.romChecksumPos, romAdler, beforeRomAdler, 0,
+												  layout.romOffset);
+		}
+		sink(segment);
+
+		uint32_t encodedAdler = 1;
+		size_t encodedLength = 0;
+		{
+			StageTimer timer("encodeRom", rom.length());
+			size_t pos = 0;
+			while (pos < rom.length())
+			{
+				segment.clear();
+				pos = Container::encode(layout, rom, pos, STREAM_CHUNK, segment, encodedAdler);
+				encodedLength += segment.length();
+				sink(segment);
+			}
+		}
+
+		segment.assign(firmware, layout.romEndOffset, std::string::npos);
+		if (layout.romChecksumPos >= layout.romOffset)
+		{
+			afterRomAdler = replaceChecksumField(segment, layout.romChecksumPos - layout.romEndOffset, romAdler,
+												 afterRomAdler, 0, parts.afterRomLength);
+		}
+		uint32_t fullAdler = adler32Combine(beforeRomAdler, encodedAdler, encodedLength);
+		fullAdler = adler32Combine(fullAdler, afterRomAdler, parts.afterRomLength);
+		ChecksumField::write(segment, segment.length() - layout.fileChecksumPosBack, fullAdler);
+		sink(segment);
+	}
+
+	// ROM bytes (at least) in each piece of an IncrementalPatch's encoded ROM image
+	enum { INCREMENTAL_CHUNK = 4096 };
+
+	// Same as injectChime, except that the result goes into patch, to be updated with
+	// repatchIncremental later. The ROM is encoded a piece at a time and the pieces'
+	// checksums are kept, so a change to the chime only needs the pieces it touches redone.
+	static void patchIncremental(const ModelLayout &layout, const std::string &firmware, const char *rom,
+								 size_t romLength, const std::string &compressedSound, const FileChecksumParts &parts,
+								 IncrementalPatch &patch)
+	{
+		patch.layout = layout;
+		patch.rom.assign(rom, romLength);
+		patch.romChecksum = patchRom(layout, patch.rom, compressedSound);
+		patch.firmware = firmware;
+		patch.beforeRomAdler = parts.beforeRomAdler;
+		patch.afterRomAdler = parts.afterRomAdler;
+		patch.afterRomLength = parts.afterRomLength;
+		writeRomChecksum(patch);
+
+		std::string encoded;
+		patch.chunks.clear();
+		{
+			StageTimer timer("encodeRom", romLength);
+			size_t pos = 0;
+			while (pos < patch.rom.length())
+			{
+				size_t encodedPos = encoded.length();
+				EncodedRomChunk chunk = {pos, 0, 1};
+				pos = Container::encode(layout, patch.rom, pos, INCREMENTAL_CHUNK, encoded, chunk.adler);
+				chunk.length = encoded.length() - encodedPos;
+				patch.chunks.push_back(chunk);
+			}
+		}
+		spliceEncodedRom(patch, 0, layout.romEndOffset - layout.romOffset, encoded);
+		writeFileChecksum(patch);
+
+		patch.changed.clear();
+		FirmwareRange everything = {0, patch.firmware.length()};
+		patch.changed.push_back(everything);
+	}
+
+	// Swaps bytes [start, end) of the chime in patch for the same bytes of compressedSound.
+	// Only the pieces of the encoded ROM that those bytes are in are re-encoded (and more, if
+	// the line breaks move), and the checksums are adjusted rather than recalculated. The
+	// parts of the firmware file that changed are left in patch.changed.
+	static void repatchIncremental(IncrementalPatch &patch, const std::string &compressedSound, size_t start,
+								   size_t end)
+	{
+		const ModelLayout &layout = patch.layout;
+		size_t romStart = layout.soundOffset + start;
+		size_t romEnd = layout.soundOffset + end;
+		patch.romChecksum = adler32Replace(patch.romChecksum, layout.romChecksumLength, romStart,
+										   patch.rom.data() + romStart, compressedSound.data() + start, end - start);
+		patch.rom.replace(romStart, end - start, compressedSound, start, end - start);
+		size_t oldLength = patch.firmware.length();
+
+		// Re-encode from the start of the piece the change begins in, until the encoder lines
+		// back up with a piece that's past the change. Each new piece is made to end where an
+		// old one did, so that it can.
+		std::vector<EncodedRomChunk> &chunks = patch.chunks;
+		size_t first = 0;
+		size_t encodedStart = layout.romOffset;
+		while (first + 1 < chunks.size() && chunks[first + 1].romPos <= romStart)
+		{
+			encodedStart += chunks[first].length;
+			first++;
+		}
+		std::vector<EncodedRomChunk> newChunks;
+		std::string encoded;
+		size_t next = first;
+		size_t oldEncodedLength = 0;
+		size_t pos = chunks[first].romPos;
+		while (pos < patch.rom.length())
+		{
+			while (next < chunks.size() && chunks[next].romPos < pos)
+			{
+				oldEncodedLength += chunks[next].length;
+				next++;
+			}
+			if (pos >= romEnd && next < chunks.size() && chunks[next].romPos == pos)
+			{
+				break;
+			}
+			size_t boundary = next;
+			while (boundary < chunks.size() && chunks[boundary].romPos < pos + INCREMENTAL_CHUNK / 2)
+			{
+				boundary++;
+			}
+			size_t minBytes = ((boundary < chunks.size()) ? chunks[boundary].romPos : patch.rom.length()) - pos;
+			size_t encodedPos = encoded.length();
+			EncodedRomChunk chunk = {pos, 0, 1};
+			pos = Container::encode(layout, patch.rom, pos, minBytes, encoded, chunk.adler);
+			chunk.length = encoded.length() - encodedPos;
+			newChunks.push_back(chunk);
+		}
+		while (next < chunks.size() && chunks[next].romPos < pos)
+		{
+			oldEncodedLength += chunks[next].length;
+			next++;
+		}
+		chunks.erase(chunks.begin() + first, chunks.begin() + next);
+		chunks.insert(chunks.begin() + first, newChunks.begin(), newChunks.end());
+
+		// Only what actually differs has to be written out, unless everything after it moved
+		size_t same = 0;
+		while (same < encoded.length() && same < oldEncodedLength &&
+			   encoded[same] == patch.firmware[encodedStart + same])
+		{
+			same++;
+		}
+		size_t sameAtEnd = 0;
+		if (encoded.length() == oldEncodedLength)
+		{
+			while (sameAtEnd < encoded.length() - same &&
+				   encoded[encoded.length() - 1 - sameAtEnd] == patch.firmware[encodedStart + oldEncodedLength - 1 - sameAtEnd])
+			{
+				sameAtEnd++;
+			}
+		}
+		spliceEncodedRom(patch, encodedStart - layout.romOffset, oldEncodedLength, encoded);
+		writeRomChecksum(patch);
+		writeFileChecksum(patch);
+
+		patch.changed.clear();
+		FirmwareRange romField = {layout.romChecksumPos, ChecksumField::SIZE};
+		FirmwareRange fileField = {patch.firmware.length() - layout.fileChecksumPosBack, ChecksumField::SIZE};
+		if (patch.firmware.length() != oldLength)
+		{
+			FirmwareRange moved = {encodedStart + same, patch.firmware.length() - encodedStart - same};
+			patch.changed.push_back(moved);
+			if (layout.romChecksumPos < layout.romOffset)
+			{
+				patch.changed.push_back(romField);
+			}
+			return;
+		}
+		if (same < encoded.length())
+		{
+			FirmwareRange rewritten = {encodedStart + same, encoded.length() - same - sameAtEnd};
+			patch.changed.push_back(rewritten);
+		}
+		patch.changed.push_back(romField);
+		patch.changed.push_back(fileField);
+	}
+
+	// Reads the stored ROM checksum and the chime out of an original firmware file, decoding
+	// no more than a line of the ROM image at a time. The reader has to be freshly opened.
+	static bool streamReadChime(const ModelLayout &layout, FirmwareReader &reader, uint32_t &romChecksum,
+								std::string &chime)
+	{
+		char field[ChecksumField::SIZE];
+		bool romFieldBeforeRom = layout.romChecksumPos < layout.romOffset;
+		if (romFieldBeforeRom && (!reader.skipTo(layout.romChecksumPos) || !reader.read(field, ChecksumField::SIZE) ||
+			!ChecksumField::read(field, romChecksum)))
+		{
+			return false;
+		}
+
+		ChimeCapture capture(layout.soundOffset, chime);
+		if (!reader.skipTo(layout.romOffset) || !Container::streamDecode(layout, reader, capture) ||
+			chime.length() != SOUND_COMPRESSED_SIZE)
+		{
+			return false;
+		}
+
+		return romFieldBeforeRom || (reader.skipTo(layout.romChecksumPos) && reader.read(field, ChecksumField::SIZE) &&
+									 ChecksumField::read(field, romChecksum));
+	}
+
+	// Copies an original firmware file to the writer with the new chime in it, reading and
+	// writing it front to back through their buffers. The ROM image is decoded, patched and
+	// re-encoded a line at a time as it goes by. romChecksum is the new ROM's checksum, which
+	// has to be known up front because it can come before the ROM image; the file checksum
+	// is worked out from what's written. The reader has to be freshly opened.
+	static bool streamPatch(const ModelLayout &layout, FirmwareReader &reader, const std::string &compressedSound,
+							uint32_t romChecksum, FirmwareWriter &writer)
+	{
+		std::string field(ChecksumField::SIZE, '\0');
+		ChecksumField::write(field, 0, romChecksum);
+		size_t length = reader.length();
+		size_t tailLength = (layout.fileChecksumPosBack > layout.fileChecksumEndBack) ?
+			layout.fileChecksumPosBack : layout.fileChecksumEndBack;
+		if (length < layout.romEndOffset + tailLength)
+		{
+			return false;
+		}
+
+		// Everything before the ROM image, with the new ROM checksum if it's in there
+		if (layout.romChecksumPos < layout.romOffset)
+		{
+			if (!copyFirmware(reader, writer, layout.romChecksumPos) || !reader.skip(ChecksumField::SIZE))
+			{
+				return false;
+			}
+			writer.write(field.data(), field.length());
+		}
+		if (!copyFirmware(reader, writer, layout.romOffset))
+		{
+			return false;
+		}
+
+		// The ROM image, with the new chime swapped in on its way from the decoder to the encoder
+		ChimeRewriter<typename Container::StreamEncoder> rom(layout, compressedSound, writer);
+		if (!Container::streamDecode(layout, reader, rom) || reader.position() != layout.romEndOffset)
+		{
+			return false;
+		}
+		rom.finish();
+
+		// Everything after it, with the new ROM checksum if it's in there
+		if (layout.romChecksumPos >= layout.romEndOffset)
+		{
+			if (!copyFirmware(reader, writer, layout.romChecksumPos) || !reader.skip(ChecksumField::SIZE))
+			{
+				return false;
+			}
+			writer.write(field.data(), field.length());
+		}
+		if (!copyFirmware(reader, writer, length - tailLength))
+		{
+			return false;
+		}
+
+		// And the end of the file, with the checksum of everything before it
+		std::string tail(tailLength, '\0');
+		if (!reader.read(&tail[0], tailLength))
+		{
+			return false;
+		}
+		size_t checksummed = tailLength - layout.fileChecksumEndBack;
+		writer.write(tail.data(), checksummed);
+		writer.stopChecksum();
+		ChecksumField::write(tail, tailLength - layout.fileChecksumPosBack, writer.checksum());
+		writer.write(tail.data() + checksummed, tailLength - checksummed);
+		return true;
+	}
+
+	// Sits between streamDecode and a container's StreamEncoder, swapping in the new chime
+	template <class Encoder>
+	class ChimeRewriter
+	{
+	public:
+		ChimeRewriter(const ModelLayout &layout, const std::string &compressedSound, FirmwareWriter &writer) :
+			soundOffset(layout.soundOffset), compressedSound(compressedSound), encoder(layout, writer), romLength(0) {}
+
+		void feed(const char *data, size_t len)
+		{
+			size_t soundEnd = soundOffset + SOUND_COMPRESSED_SIZE;
+			size_t begin = (romLength > soundOffset) ? romLength : soundOffset;
+			size_t end = (romLength + len < soundEnd) ? romLength + len : soundEnd;
+			if (begin < end)
+			{
+				scratch.assign(data, len);
+				scratch.replace(begin - romLength, end - begin, compressedSound, begin - soundOffset, end - begin);
+				data = scratch.data();
+			}
+			encoder.feed(data, len);
+			romLength += len;
+		}
+
+		void finish() { encoder.finish(); }
+		size_t length() const { return romLength; }
+
+	private:
+		size_t soundOffset;
+		const std::string &compressedSound;
+		Encoder encoder;
+		size_t romLength;
+		std::string scratch;
+	};
+
+	// The end of decodeFirmware and checkRom: romAdler is the adler32 of the decoded ROM
+	static DecodeResult checkDecodedRom(const ModelLayout &layout, const std::string &firmware, size_t romLength,
+										uint32_t romAdler)
+	{
+		// Make sure the chime is actually inside the ROM we decoded
+		if ((romLength < layout.soundOffset + SOUND_COMPRESSED_SIZE) ||
+			(romLength > layout.romChecksumLength))
+		{
+			return DECODE_BAD_FORMAT;
+		}
+
+		// The stored checksum includes the padding out to romChecksumLength
+		romAdler = adler32Fill(romAdler, layout.romPadByte, layout.romChecksumLength - romLength);
+		uint32_t storedAdler;
+		if (!ChecksumField::read(firmware, layout.romChecksumPos, storedAdler) || storedAdler != romAdler)
+		{
+			return DECODE_BAD_CHECKSUM;
+		}
+		return DECODE_OK;
+	}
+
+	// Replaces the original chime in the ROM with the new one, and returns the ROM's new
+	// checksum (taking into account the padding at the end which brings the total length up
+	// to romChecksumLength)
+	static uint32_t patchRom(const ModelLayout &layout, std::string &rom, const std::string &compressedSound)
+	{
+		rom.replace(layout.soundOffset, SOUND_COMPRESSED_SIZE, compressedSound);
+
+		StageTimer timer("romChecksum", rom.length());
+		uint32_t romAdler = adler32(rom);
+		return adler32Fill(romAdler, layout.romPadByte, layout.romChecksumLength - rom.length());
+	}
+
+	// Puts patch.romChecksum into its field, keeping track of what that does to the checksum of
+	// whichever part of the file it's in
+	static void writeRomChecksum(IncrementalPatch &patch)
+	{
+		const ModelLayout &layout = patch.layout;
+		if (layout.romChecksumPos < layout.romOffset)
+		{
+			patch.beforeRomAdler = replaceChecksumField(patch.firmware, layout.romChecksumPos, patch.romChecksum,
+														patch.beforeRomAdler, 0, layout.romOffset);
+		}
+		else
+		{
+			patch.afterRomAdler = replaceChecksumField(patch.firmware, layout.romChecksumPos, patch.romChecksum,
+													   patch.afterRomAdler, layout.romEndOffset, patch.afterRomLength);
+		}
+	}
+
+	// Replaces oldLength bytes of patch's encoded ROM image, from pos, with encoded. Anything
+	// after the ROM image moves along with the end of it.
+	static void spliceEncodedRom(IncrementalPatch &patch, size_t pos, size_t oldLength, const std::string &encoded)
+	{
+		StageTimer timer("splice", encoded.length());
+		ModelLayout &layout = patch.layout;
+		patch.firmware.replace(layout.romOffset + pos, oldLength, encoded);
+		size_t newRomEnd = layout.romEndOffset - oldLength + encoded.length();
+		if (layout.romChecksumPos >= layout.romEndOffset)
+		{
+			layout.romChecksumPos = layout.romChecksumPos - layout.romEndOffset + newRomEnd;
+		}
+		layout.romEndOffset = newRomEnd;
+	}
+
+	// The file checksum of patch, from its three parts (the encoded ROM image in pieces)
+	static void writeFileChecksum(IncrementalPatch &patch)
+	{
+		StageTimer timer("fileChecksum");
+		uint32_t fullAdler = patch.beforeRomAdler;
+		for (size_t x = 0; x < patch.chunks.size(); x++)
+		{
+			fullAdler = adler32Combine(fullAdler, patch.chunks[x].adler, patch.chunks[x].length);
+		}
+		fullAdler = adler32Combine(fullAdler, patch.afterRomAdler, patch.afterRomLength);
+		ChecksumField::write(patch.firmware, patch.firmware.length() - patch.layout.fileChecksumPosBack, fullAdler);
+	}
+
+	// Writes checksum into the field at pos in buf, and returns what that does to partAdler,
+	// the adler32 of the partLength bytes of buf starting at partStart
+	static uint32_t replaceChecksumField(std::string &buf, size_t pos, uint32_t checksum, uint32_t partAdler,
+										 size_t partStart, size_t partLength)
+	{
+		char oldField[ChecksumField::SIZE];
+		buf.copy(oldField, ChecksumField::SIZE, pos);
+		ChecksumField::write(buf, pos, checksum);
+		return adler32Replace(partAdler, partLength, pos - partStart, oldField, buf.data() + pos,
+							  ChecksumField::SIZE);
+	}
+
+	// Feeds data[start, end) to the digest, with whatever part of it is in [maskStart, maskEnd)
+	// replaced by zeros
+	static void updateMasked(MD5 &digest, const char *data, size_t start, size_t end, size_t maskStart, size_t maskEnd)
+	{
+		static const char zeros[256] = {0};
+		while (start < end)
+		{
+			size_t stop;
+			if (start >= maskStart && start < maskEnd)
+			{
+				stop = (maskEnd < end) ? maskEnd : end;
+				for (size_t pos = start; pos < stop; pos += sizeof(zeros))
+				{
+					size_t len = (stop - pos < sizeof(zeros)) ? stop - pos : sizeof(zeros);
+					digest.update(zeros, static_cast<MD5::size_type>(len));
+				}
+			}
+			else
+			{
+				stop = (start < maskStart && maskStart < end) ? maskStart : end;
+				digest.update(data + start, static_cast<MD5::size_type>(stop - start));
+			}
+			start = stop;
+		}
+	}
+};
+
+#endif // PATCH_ENGINE_H
@@ -0,0 +1,69 @@
+#include "patch_pipeline.h"
+#include "stats.h"
+#include <thread>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+ChimeError runPatchPipeline(FirmwareImage &image, PatchContext &context, const char *firmwareFile,
+							const char *soundFile, const char *outputFile, const ModelInfo *expectedModel,
+							PipelineStage &failedStage)
+{
+	// The sound doesn't depend on the firmware at all. Its stages are collected on its own
+	// thread and added to this thread's stats once it's done.
+	ChimeError soundError = CHIME_OK;
+	StatsCollector *stats = threadStatsCollector();
+	StatsCollector soundStats;
+	thread soundLoader([&context, soundFile, &soundError, stats, &soundStats]()
+	{
+		ScopedStats scopedStats(stats ? &soundStats : NULL);
+		{
+			StageTimer timer("loadSoundFile");
+			soundError = context.loadSoundFile(soundFile);
+		}
+		if (soundError == CHIME_OK)
+		{
+			soundError = context.encodeSound();
+		}
+	});
+
+	ChimeError error;
+	{
+		StageTimer timer("loadFirmwareFile");
+		error = image.loadFile(firmwareFile, expectedModel);
+	}
+	soundLoader.join();
+	if (stats)
+	{
+		stats->merge(soundStats);
+	}
+	if (error != CHIME_OK)
+	{
+		failedStage = PIPELINE_LOAD_FIRMWARE;
+		return error;
+	}
+	if (soundError != CHIME_OK)
+	{
+		failedStage = PIPELINE_LOAD_SOUND;
+		return soundError;
+	}
+
+	{
+		StageTimer timer("openOutputFile");
+		error = context.openOutputFile(outputFile);
+	}
+	if (error != CHIME_OK)
+	{
+		failedStage = PIPELINE_OPEN_OUTPUT;
+		return error;
+	}
+
+	{
+		StageTimer timer("streamChime");
+		error = context.streamOutputFile();
+	}
+	failedStage = (error == CHIME_OK) ? PIPELINE_DONE : PIPELINE_PATCH;
+	return error;
+}
@@ -0,0 +1,33 @@
+#ifndef PATCH_PIPELINE_H
+#define PATCH_PIPELINE_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// One patch job with its independent stages overlapped, to get from input files to output
+// file sooner: the sound is read and compressed on another thread while the firmware is
+// read, verified and decoded, and the new firmware is written out while its ROM image is
+// still being encoded (see PatchContext::streamOutputFile).
+
+#include "chimepatch.h"
+
+// Where a pipeline stopped
+enum PipelineStage
+{
+	PIPELINE_LOAD_FIRMWARE = 0,
+	PIPELINE_LOAD_SOUND,
+	PIPELINE_OPEN_OUTPUT,
+	PIPELINE_PATCH,
+	PIPELINE_DONE
+};
+
+// Loads firmwareFile into image and soundFile into context (which has to be for image) at the
+// same time, then opens outputFile and streams the patched firmware to it. The output file
+// is only created once both inputs are known to be good. If something fails, failedStage
+// says which stage (the firmware's error wins if both inputs are bad, like it would if they
+// were loaded one after the other).
+ChimeError runPatchPipeline(FirmwareImage &image, PatchContext &context, const char *firmwareFile,
+							const char *soundFile, const char *outputFile, const ModelInfo *expectedModel,
+							PipelineStage &failedStage);
+
+#endif // PATCH_PIPELINE_H
@@ -0,0 +1,152 @@
+#include "pattern_search.h"
+#include "cpu_dispatch.h"
+#include "kernels.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+void findPatterns(const unsigned char *data, size_t len, const PatternSet &set, vector<PatternMatch> &matches)
+{
+	kernels().findPatterns(data, len, set, matches);
+}
+
+// Checks every pattern at one position
+static KERNEL_INLINE void matchAt(const unsigned char *data, size_t len, size_t pos, const PatternSet &set,
+								  vector<PatternMatch> &matches)
+{
+	for (size_t p = 0; p < set.count; p++)
+	{
+		if (set.lengths[p] <= len - pos && data[pos] == static_cast<unsigned char>(set.patterns[p][0]) &&
+			memcmp(data + pos, set.patterns[p], set.lengths[p]) == 0)
+		{
+			PatternMatch match = {pos, p};
+			matches.push_back(match);
+		}
+	}
+}
+
+// Checks the positions a vector kernel flagged, lowest first
+static KERNEL_INLINE void matchCandidates(const unsigned char *data, size_t len, size_t start, uint64_t candidates,
+										  const PatternSet &set, vector<PatternMatch> &matches)
+{
+	while (candidates)
+	{
+		matchAt(data, len, start + __builtin_ctzll(candidates), set, matches);
+		candidates &= candidates - 1;
+	}
+}
+
+// How many bytes a vector of positions needs, so every pattern fits after the last of them
+static KERNEL_INLINE size_t vectorReach(const PatternSet &set, size_t width)
+{
+	size_t longest = 0;
+	for (size_t p = 0; p < set.count; p++)
+	{
+		if (set.lengths[p] > longest) longest = set.lengths[p];
+	}
+	return width + longest - 1;
+}
+
+static KERNEL_INLINE void findPatternsTail(const unsigned char *data, size_t len, size_t start, const PatternSet &set,
+										   vector<PatternMatch> &matches)
+{
+	for (size_t pos = start; pos < len; pos++)
+	{
+		matchAt(data, len, pos, set, matches);
+	}
+}
+
+void findPatternsScalar(const unsigned char *data, size_t len, const PatternSet &set, vector<PatternMatch> &matches)
+{
+	findPatternsTail(data, len, 0, set, matches);
+}
+
+#ifdef KERNELS_X86
+TARGET_SSE41 void findPatternsSse41(const unsigned char *data, size_t len, const PatternSet &set,
+									vector<PatternMatch> &matches)
+{
+	__m128i first[MAX_SEARCH_PATTERNS], last[MAX_SEARCH_PATTERNS];
+	for (size_t p = 0; p < set.count; p++)
+	{
+		first[p] = _mm_set1_epi8(set.patterns[p][0]);
+		last[p] = _mm_set1_epi8(set.patterns[p][set.lengths[p] - 1]);
+	}
+
+	size_t reach = vectorReach(set, 16);
+	size_t pos = 0;
+	for (; pos + reach <= len; pos += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+		uint32_t candidates = 0;
+		for (size_t p = 0; p < set.count; p++)
+		{
+			__m128i blockEnd = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + set.lengths[p] - 1));
+			candidates |= static_cast<uint32_t>(_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpeq_epi8(block, first[p]), _mm_cmpeq_epi8(blockEnd, last[p]))));
+		}
+		matchCandidates(data, len, pos, candidates, set, matches);
+	}
+	findPatternsTail(data, len, pos, set, matches);
+}
+
+TARGET_AVX2 void findPatternsAvx2(const unsigned char *data, size_t len, const PatternSet &set,
+								  vector<PatternMatch> &matches)
+{
+	__m256i first[MAX_SEARCH_PATTERNS], last[MAX_SEARCH_PATTERNS];
+	for (size_t p = 0; p < set.count; p++)
+	{
+		first[p] = _mm256_set1_epi8(set.patterns[p][0]);
+		last[p] = _mm256_set1_epi8(set.patterns[p][set.lengths[p] - 1]);
+	}
+
+	size_t reach = vectorReach(set, 32);
+	size_t pos = 0;
+	for (; pos + reach <= len; pos += 32)
+	{
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+		uint32_t candidates = 0;
+		for (size_t p = 0; p < set.count; p++)
+		{
+			__m256i blockEnd = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + set.lengths[p] - 1));
+			candidates |= static_cast<uint32_t>(_mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpeq_epi8(block, first[p]), _mm256_cmpeq_epi8(blockEnd, last[p]))));
+		}
+		matchCandidates(data, len, pos, candidates, set, matches);
+	}
+	findPatternsTail(data, len, pos, set, matches);
+}
+
+TARGET_AVX512 void findPatternsAvx512(const unsigned char *data, size_t len, const PatternSet &set,
+									  vector<PatternMatch> &matches)
+{
+	__m512i first[MAX_SEARCH_PATTERNS], last[MAX_SEARCH_PATTERNS];
+	for (size_t p = 0; p < set.count; p++)
+	{
+		first[p] = _mm512_set1_epi8(set.patterns[p][0]);
+		last[p] = _mm512_set1_epi8(set.patterns[p][set.lengths[p] - 1]);
+	}
+
+	size_t reach = vectorReach(set, 64);
+	size_t pos = 0;
+	for (; pos + reach <= len; pos += 64)
+	{
+		__m512i block = _mm512_loadu_si512(data + pos);
+		uint64_t candidates = 0;
+		for (size_t p = 0; p < set.count; p++)
+		{
+			__m512i blockEnd = _mm512_loadu_si512(data + pos + set.lengths[p] - 1);
+			candidates |= _mm512_cmpeq_epi8_mask(block, first[p]) & _mm512_cmpeq_epi8_mask(blockEnd, last[p]);
+		}
+		matchCandidates(data, len, pos, candidates, set, matches);
+	}
+	findPatternsTail(data, len, pos, set, matches);
+}
+#endif
@@ -0,0 +1,32 @@
+#ifndef PATTERN_SEARCH_H
+#define PATTERN_SEARCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Searches a block of data for several byte strings at once, in a single pass. The vector
+// kernels compare the first and last byte of every pattern against a whole vector of
+// positions at a time, and only check the rest of a pattern where both of those match.
+
+#include <stddef.h>
+#include <vector>
+
+#define MAX_SEARCH_PATTERNS 8
+
+struct PatternSet
+{
+	const char *patterns[MAX_SEARCH_PATTERNS];
+	size_t lengths[MAX_SEARCH_PATTERNS]; // none of them can be 0
+	size_t count;
+};
+
+struct PatternMatch
+{
+	size_t offset;
+	size_t pattern; // index into the PatternSet
+};
+
+// Appends every occurrence of every pattern to matches, in order of offset (then pattern)
+void findPatterns(const unsigned char *data, size_t len, const PatternSet &set, std::vector<PatternMatch> &matches);
+
+#endif // PATTERN_SEARCH_H
@@ -0,0 +1,142 @@
+#include "rom_cache.h"
+#include "files.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Bump the number if the format changes, or anything changes what gets decoded
+static const char ROM_CACHE_MAGIC[16] = "chimepatch-rom1";
+
+// The start of every entry, followed by the decoded ROM. An entry is only ever read on the
+// machine that wrote it, so everything is in native byte order.
+struct RomCacheHeader
+{
+	char magic[16];
+	char firmwareMd5[33];
+	char modelId[63];
+	uint64_t original;
+	uint64_t romEndOffset;
+	uint64_t romChecksumPos;
+	uint64_t afterRomLength;
+	uint32_t beforeRomAdler;
+	uint32_t afterRomAdler;
+	uint64_t romLength;
+};
+
+// Where the ROM starts in an entry, so it's nicely aligned
+static const size_t ROM_DATA_OFFSET = (sizeof(RomCacheHeader) + 63) & ~static_cast<size_t>(63);
+
+MappedRom::MappedRom(void *map, size_t mapLength, size_t romOffset, size_t romLength) :
+	map(map),
+	mapLength(mapLength),
+	romOffset(romOffset),
+	romLength(romLength)
+{
+}
+
+MappedRom::~MappedRom()
+{
+	munmap(map, mapLength);
+}
+
+RomCache::RomCache(const string &directory) :
+	cacheDirectory(directory)
+{
+}
+
+string RomCache::pathFor(const string &firmwareMd5) const
+{
+	return cacheDirectory + "/" + firmwareMd5 + ".rom";
+}
+
+shared_ptr<const MappedRom> RomCache::lookup(const string &firmwareMd5, DecodedFirmwareInfo &info) const
+{
+	int fd = open(pathFor(firmwareMd5).c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return shared_ptr<const MappedRom>();
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= ROM_DATA_OFFSET)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	// The mapping keeps the file open
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return shared_ptr<const MappedRom>();
+	}
+	shared_ptr<const MappedRom> rom(new MappedRom(map, st.st_size, ROM_DATA_OFFSET, st.st_size - ROM_DATA_OFFSET));
+
+	// Anything that doesn't add up is treated as a miss (and gets replaced)
+	RomCacheHeader header;
+	memcpy(&header, map, sizeof(header));
+	header.firmwareMd5[sizeof(header.firmwareMd5) - 1] = '\0';
+	header.modelId[sizeof(header.modelId) - 1] = '\0';
+	if (memcmp(header.magic, ROM_CACHE_MAGIC, sizeof(header.magic)) != 0 || firmwareMd5 != header.firmwareMd5 ||
+		header.romLength != rom->length())
+	{
+		return shared_ptr<const MappedRom>();
+	}
+
+	info.modelId = header.modelId;
+	info.original = header.original != 0;
+	info.romEndOffset = header.romEndOffset;
+	info.romChecksumPos = header.romChecksumPos;
+	info.checksumParts.beforeRomAdler = header.beforeRomAdler;
+	info.checksumParts.afterRomAdler = header.afterRomAdler;
+	info.checksumParts.afterRomLength = header.afterRomLength;
+	return rom;
+}
+
+bool RomCache::store(const string &firmwareMd5, const DecodedFirmwareInfo &info, const char *rom,
+					 size_t romLength) const
+{
+	RomCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	if (firmwareMd5.length() >= sizeof(header.firmwareMd5) || info.modelId.length() >= sizeof(header.modelId))
+	{
+		return false;
+	}
+	memcpy(header.magic, ROM_CACHE_MAGIC, sizeof(header.magic));
+	firmwareMd5.copy(header.firmwareMd5, firmwareMd5.length());
+	info.modelId.copy(header.modelId, info.modelId.length());
+	header.original = info.original ? 1 : 0;
+	header.romEndOffset = info.romEndOffset;
+	header.romChecksumPos = info.romChecksumPos;
+	header.afterRomLength = info.checksumParts.afterRomLength;
+	header.beforeRomAdler = info.checksumParts.beforeRomAdler;
+	header.afterRomAdler = info.checksumParts.afterRomAdler;
+	header.romLength = romLength;
+
+	string entry(ROM_DATA_OFFSET, '\0');
+	memcpy(&entry[0], &header, sizeof(header));
+	entry.append(rom, romLength);
+
+	// Write to a unique temporary file first so nobody ever maps a partial entry
+	string tmpPath = pathFor(firmwareMd5) + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if (fd < 0)
+	{
+		return false;
+	}
+	close(fd);
+
+	if (!writeFile(tmpPath.c_str(), entry) || rename(tmpPath.c_str(), pathFor(firmwareMd5).c_str()) != 0)
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
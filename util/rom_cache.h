@@ -0,0 +1,69 @@
+#ifndef ROM_CACHE_H
+#define ROM_CACHE_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// A directory of decoded ROM images, named by the MD5 of the firmware file they came from.
+// Decoding is deterministic, so once a firmware file has been decoded, later runs (in any
+// process) can map the result instead of decoding it again. Entries are mapped read-only and
+// shared, so any number of processes using the same firmware share one copy in the page
+// cache. Like OutputCache, entries are written to a temporary file and renamed into place.
+//
+// An entry is only as trustworthy as the disk it's on, so FirmwareImage still checks the
+// mapped ROM against the ROM checksum in the firmware file before using it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include "patch_engine.h"
+
+// Everything besides the ROM itself that FirmwareImage works out from a firmware file
+struct DecodedFirmwareInfo
+{
+	std::string modelId;
+	bool original; // false if the file had already been patched
+	size_t romEndOffset; // where the ROM image ends in the file (it moves when a file is patched)
+	size_t romChecksumPos; // where the ROM checksum is (it moves too, if it's after the ROM image)
+	FileChecksumParts checksumParts;
+};
+
+// A decoded ROM image mapped from the cache. It stays mapped for as long as this is around.
+class MappedRom
+{
+public:
+	MappedRom(void *map, size_t mapLength, size_t romOffset, size_t romLength);
+	~MappedRom();
+
+	const char *data() const { return static_cast<const char *>(map) + romOffset; }
+	size_t length() const { return romLength; }
+
+private:
+	MappedRom(const MappedRom &);
+	MappedRom &operator=(const MappedRom &);
+
+	void *map;
+	size_t mapLength;
+	size_t romOffset;
+	size_t romLength;
+};
+
+class RomCache
+{
+public:
+	explicit RomCache(const std::string &directory);
+
+	// Maps the entry for a firmware file, filling in info. Returns NULL if there's no entry
+	// (or it's truncated, or from an incompatible version).
+	std::shared_ptr<const MappedRom> lookup(const std::string &firmwareMd5, DecodedFirmwareInfo &info) const;
+	bool store(const std::string &firmwareMd5, const DecodedFirmwareInfo &info, const char *rom,
+			   size_t romLength) const;
+
+private:
+	std::string pathFor(const std::string &firmwareMd5) const;
+
+	std::string cacheDirectory;
+};
+
+#endif // ROM_CACHE_H
@@ -0,0 +1,44 @@
+#include "sound.h"
+#include "patch_engine.h"
+#include "ima.h"
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+SoundResult validateSound(const std::string &sound)
+{
+	// Verify length of sound
+	size_t soundLen = sound.length();
+	if (soundLen > SOUND_MAX_SIZE)
+	{
+		return SOUND_TOO_LONG;
+	}
+	else if (soundLen % 2)
+	{
+		// Not a multiple of 2 (which it has to be for it to be 16-bit sound)
+		return SOUND_NOT_16_BIT;
+	}
+	return SOUND_OK;
+}
+
+SoundResult compressSound(std::string &sound, std::string &compressed)
+{
+	SoundResult result = validateSound(sound);
+	if (result != SOUND_OK)
+	{
+		return result;
+	}
+
+	// Shorter than the original sound, so fill the rest with silence -- not an error!
+	sound.append(SOUND_MAX_SIZE - sound.length(), 0);
+
+	// Now, compress the sound file in IMA 4:1 format and ensure the compressed data is the
+	// correct length (it WILL be -- but just to be safe, I'm checking...)
+	imaEncode(sound, compressed);
+	if (compressed.length() != SOUND_COMPRESSED_SIZE)
+	{
+		return SOUND_COMPRESS_FAILED;
+	}
+
+	return SOUND_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+
+enum SoundResult
+{
+	SOUND_OK,
+	SOUND_TOO_LONG, // longer than SOUND_MAX_SIZE
+	SOUND_NOT_16_BIT, // odd number of bytes
+	SOUND_COMPRESS_FAILED, // compressed data isn't SOUND_COMPRESSED_SIZE bytes
+	SOUND_BAD_FORMAT // an already-compressed sound that isn't in a format we can use
+};
+
+// Checks that a raw 16-bit big-endian sound will fit in place of the chime
+SoundResult validateSound(const std::string &sound);
+
+// Settings the IMA 4:1 encoder runs with. Anything that would change the compressed
+// output for the same input sound must be reflected here.
+#define IMA_ENCODER_OPTIONS "ima4:be16:mono:44100"
+
+// Pads a raw 16-bit big-endian sound out to the full chime length with silence and
+// compresses it in IMA 4:1 format
+SoundResult compressSound(std::string &sound, std::string &compressed);
+
+#endif // SOUND_H
@@ -0,0 +1,268 @@
+#include "stats.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static thread_local StatsCollector *currentCollector = NULL;
+static thread_local uint64_t allocationCount = 0;
+static thread_local bool bookkeeping = false; // don't count our own allocations
+static bool countingAllocations = false;
+
+void enableAllocationCounting()
+{
+	countingAllocations = true;
+}
+
+void countAllocation()
+{
+	if (!bookkeeping) allocationCount++;
+}
+
+bool allocationsCounted()
+{
+	return countingAllocations;
+}
+
+uint64_t threadAllocationCount()
+{
+	return allocationCount;
+}
+
+uint64_t currentRssBytes()
+{
+	// The second number in statm is the resident size in pages
+	FILE *statm = fopen("/proc/self/statm", "r");
+	unsigned long size = 0, resident = 0;
+	bool ok = statm && fscanf(statm, "%lu %lu", &size, &resident) == 2;
+	if (statm) fclose(statm);
+	return ok ? static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE) : 0;
+}
+
+uint64_t peakRssBytes()
+{
+	// Linux reports it in kilobytes, macOS in bytes
+	struct rusage usage;
+#ifdef __APPLE__
+	const uint64_t unit = 1;
+#else
+	const uint64_t unit = 1024;
+#endif
+	return (getrusage(RUSAGE_SELF, &usage) == 0) ? static_cast<uint64_t>(usage.ru_maxrss) * unit : 0;
+}
+
+static uint64_t nowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef __linux__
+// Hardware counters for the current thread, opened the first time they're needed
+class PerfCounters
+{
+public:
+	PerfCounters() : opened(false), cyclesFd(-1), cacheMissesFd(-1) {}
+	~PerfCounters()
+	{
+		if (cyclesFd >= 0) close(cyclesFd);
+		if (cacheMissesFd >= 0) close(cacheMissesFd);
+	}
+
+	bool read(uint64_t &cycles, uint64_t &cacheMisses)
+	{
+		if (!opened)
+		{
+			opened = true;
+			cyclesFd = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+			cacheMissesFd = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+		}
+		return (cyclesFd >= 0) && (cacheMissesFd >= 0) &&
+			readCounter(cyclesFd, cycles) && readCounter(cacheMissesFd, cacheMisses);
+	}
+
+private:
+	static int openCounter(uint64_t config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	static bool readCounter(int fd, uint64_t &value)
+	{
+		return ::read(fd, &value, sizeof(value)) == sizeof(value);
+	}
+
+	bool opened;
+	int cyclesFd;
+	int cacheMissesFd;
+};
+#else
+// perf_event_open is Linux-only; elsewhere the counters are reported as unavailable
+class PerfCounters
+{
+public:
+	bool read(uint64_t &, uint64_t &) { return false; }
+};
+#endif
+
+static thread_local PerfCounters perfCounters;
+
+StatsCollector::StatsCollector()
+{
+}
+
+size_t StatsCollector::beginStage(const char *name)
+{
+	StageStats stats = StageStats();
+	stats.name = openStages.empty() ? name : (stageList[openStages.back()].name + "/" + name);
+	stats.depth = openStages.size();
+	stageList.push_back(stats);
+	openStages.push_back(stageList.size() - 1);
+	return stageList.size() - 1;
+}
+
+void StatsCollector::endStage(size_t index, const StageStats &stats)
+{
+	string name = stageList[index].name;
+	int depth = stageList[index].depth;
+	stageList[index] = stats;
+	stageList[index].name = name;
+	stageList[index].depth = depth;
+	if (!openStages.empty() && openStages.back() == index)
+	{
+		openStages.pop_back();
+	}
+}
+
+void StatsCollector::merge(const StatsCollector &other)
+{
+	string prefix = openStages.empty() ? "" : stageList[openStages.back()].name + "/";
+	int depth = openStages.size();
+	bookkeeping = true;
+	for (size_t x = 0; x < other.stageList.size(); x++)
+	{
+		stageList.push_back(other.stageList[x]);
+		stageList.back().name = prefix + stageList.back().name;
+		stageList.back().depth += depth;
+	}
+	bookkeeping = false;
+}
+
+string StatsCollector::toJson(const string &extraFields) const
+{
+	ostringstream json;
+	json << "{";
+	if (!extraFields.empty())
+	{
+		json << extraFields << ",";
+	}
+	json << "\"stages\":[";
+	for (size_t x = 0; x < stageList.size(); x++)
+	{
+		const StageStats &s = stageList[x];
+		json << (x ? "," : "") << "{\"name\":\"" << s.name << "\",\"depth\":" << s.depth <<
+			",\"wall_ns\":" << s.wallNs << ",\"bytes\":" << s.bytes << ",\"allocations\":";
+		if (s.hasAllocations)
+		{
+			json << s.allocations;
+		}
+		else
+		{
+			json << "null";
+		}
+		if (s.hasCounters)
+		{
+			json << ",\"cycles\":" << s.cycles << ",\"cache_misses\":" << s.cacheMisses;
+		}
+		else
+		{
+			json << ",\"cycles\":null,\"cache_misses\":null";
+		}
+		json << "}";
+	}
+	json << "]}";
+	return json.str();
+}
+
+StatsCollector *threadStatsCollector()
+{
+	return currentCollector;
+}
+
+ScopedStats::ScopedStats(StatsCollector *collector) :
+	previous(currentCollector)
+{
+	currentCollector = collector;
+}
+
+ScopedStats::~ScopedStats()
+{
+	currentCollector = previous;
+}
+
+StageTimer::StageTimer(const char *name, uint64_t bytes) :
+	collector(currentCollector),
+	index(0),
+	stageBytes(bytes),
+	startNs(0),
+	startAllocations(0),
+	countersStarted(false),
+	startCycles(0),
+	startCacheMisses(0)
+{
+	if (!collector)
+	{
+		return;
+	}
+
+	bookkeeping = true;
+	index = collector->beginStage(name);
+	bookkeeping = false;
+	countersStarted = perfCounters.read(startCycles, startCacheMisses);
+	startAllocations = allocationCount;
+	startNs = nowNs();
+}
+
+StageTimer::~StageTimer()
+{
+	if (!collector)
+	{
+		return;
+	}
+
+	StageStats stats = StageStats();
+	stats.wallNs = nowNs() - startNs;
+	stats.allocations = allocationCount - startAllocations;
+	stats.hasAllocations = countingAllocations;
+	stats.bytes = stageBytes;
+	uint64_t cycles;
+	uint64_t cacheMisses;
+	if (countersStarted && perfCounters.read(cycles, cacheMisses))
+	{
+		stats.hasCounters = true;
+		stats.cycles = cycles - startCycles;
+		stats.cacheMisses = cacheMisses - startCacheMisses;
+	}
+	bookkeeping = true;
+	collector->endStage(index, stats);
+	bookkeeping = false;
+}
@@ -0,0 +1,100 @@
+#ifndef STATS_H
+#define STATS_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Per-stage instrumentation. Code marks a stage by putting a StageTimer on the stack; if the
+// current thread has a StatsCollector installed (with ScopedStats), the stage's wall time,
+// bytes processed, heap allocations and, where perf_event_open works, CPU cycles and cache
+// misses are recorded. Stages nest, and nested stages are named "outer/inner". Without a
+// collector a StageTimer does nothing, so the library can be instrumented everywhere.
+//
+// Heap allocations are only counted in programs that link alloc_counter.o (which replaces
+// operator new); the library itself leaves the allocator alone.
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct StageStats
+{
+	std::string name; // e.g. "injectChime/patch/encodeRom"
+	int depth; // how deeply nested the stage is (0 for top level)
+	uint64_t wallNs; // wall time in nanoseconds
+	uint64_t bytes; // bytes processed
+	uint64_t allocations; // heap allocations made on this thread
+	bool hasAllocations; // true if allocations is valid (see alloc_counter.cpp)
+	bool hasCounters; // true if cycles and cacheMisses are valid
+	uint64_t cycles;
+	uint64_t cacheMisses;
+};
+
+class StatsCollector
+{
+public:
+	StatsCollector();
+
+	// Called by StageTimer
+	size_t beginStage(const char *name);
+	void endStage(size_t index, const StageStats &stats);
+
+	// Adds the stages another collector (another thread's, say) recorded, as if they had
+	// happened inside whatever stage is open here
+	void merge(const StatsCollector &other);
+
+	const std::vector<StageStats> &stages() const { return stageList; }
+	// All stages, in the order they started, as a JSON object. extraFields are added to the
+	// object as-is (for example "\"model\":\"g3_blue_and_white\"").
+	std::string toJson(const std::string &extraFields = "") const;
+
+private:
+	std::vector<StageStats> stageList;
+	std::vector<size_t> openStages; // indexes of stages that haven't ended yet
+};
+
+// The collector installed for the current thread (NULL if none)
+StatsCollector *threadStatsCollector();
+
+// Installs a collector for the current thread for as long as it's in scope
+class ScopedStats
+{
+public:
+	explicit ScopedStats(StatsCollector *collector);
+	~ScopedStats();
+
+private:
+	StatsCollector *previous;
+};
+
+class StageTimer
+{
+public:
+	explicit StageTimer(const char *name, uint64_t bytes = 0);
+	~StageTimer();
+
+	void setBytes(uint64_t bytes) { stageBytes = bytes; }
+
+private:
+	StatsCollector *collector;
+	size_t index;
+	uint64_t stageBytes;
+	uint64_t startNs;
+	uint64_t startAllocations;
+	bool countersStarted;
+	uint64_t startCycles;
+	uint64_t startCacheMisses;
+};
+
+// Heap allocations made so far by the current thread (always 0 without alloc_counter.o)
+uint64_t threadAllocationCount();
+// Whether heap allocations are being counted, which is up to the program (see alloc_counter.cpp)
+bool allocationsCounted();
+// Called by alloc_counter.o: once at startup, then for every allocation
+void enableAllocationCounting();
+void countAllocation();
+// The process's resident set size right now, and the most it's been, in bytes (0 if unknown)
+uint64_t currentRssBytes();
+uint64_t peakRssBytes();
+
+#endif // STATS_H
@@ -0,0 +1,160 @@
+#include "stream_patch.h"
+#include "md5.h"
+#include "stats.h"
+#include <cstdio>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+// Buffers bigger than this don't make anything faster
+static const size_t MAX_STREAM_BUFFER = 1024 * 1024;
+// What's needed besides the buffers: the sound file, the new and old chimes, and some slack
+// for the Ascii85 line window and the allocator
+static const size_t STREAM_FIXED_MEMORY = SOUND_MAX_SIZE + 2 * SOUND_COMPRESSED_SIZE + 256 * 1024;
+// Buffers that can be around at once: a reader, the writer, and a decoded piece of the ROM
+// image along with its patched copy
+static const size_t STREAM_BUFFER_COUNT = 4;
+
+static bool streamMd5(const char *filename, size_t bufferSize, string &md5); // MD5 of a file, read through a buffer
+static const ModelInfo *findPatchedLookalike(const char *filename, const ModelInfo *expectedModel, size_t bufferSize); // a re-patchable model the file looks like
+
+size_t streamBufferSize(uint64_t maxMemory, uint64_t currentRss)
+{
+	if (maxMemory < currentRss + STREAM_FIXED_MEMORY + STREAM_BUFFER_COUNT * STREAM_MIN_BUFFER)
+	{
+		return 0;
+	}
+	uint64_t bufferSize = (maxMemory - currentRss - STREAM_FIXED_MEMORY) / STREAM_BUFFER_COUNT;
+	return (bufferSize < MAX_STREAM_BUFFER) ? static_cast<size_t>(bufferSize) : MAX_STREAM_BUFFER;
+}
+
+ChimeError streamPatchFile(const char *firmwareFile, const char *soundFile, const char *outputFile,
+						   const ModelInfo *expectedModel, size_t bufferSize, const ModelInfo *&detected)
+{
+	detected = NULL;
+	if (bufferSize < STREAM_MIN_BUFFER)
+	{
+		bufferSize = STREAM_MIN_BUFFER;
+	}
+
+	// Only an original firmware file will do
+	string firmwareMd5;
+	{
+		StageTimer timer("md5");
+		if (!streamMd5(firmwareFile, bufferSize, firmwareMd5))
+		{
+			return CHIME_ERR_READ_FIRMWARE;
+		}
+	}
+	const ModelInfo *model = findModelByMd5(firmwareMd5);
+	if (!model || (expectedModel && model != expectedModel))
+	{
+		// Say so if it's probably a patched file, which would work without streaming
+		detected = findPatchedLookalike(firmwareFile, expectedModel, bufferSize);
+		return detected ? CHIME_ERR_PATCHED_FIRMWARE : CHIME_ERR_UNKNOWN_FIRMWARE;
+	}
+	detected = model;
+	const ModelLayout &layout = *model->layout;
+
+	// The new ROM checksum is the old one with the old chime swapped for the new one
+	uint32_t romChecksum;
+	string oldChime;
+	{
+		StageTimer timer("readChime");
+		FirmwareReader reader(bufferSize);
+		if (!reader.open(firmwareFile))
+		{
+			return CHIME_ERR_READ_FIRMWARE;
+		}
+		if (!model->streamReadChime(layout, reader, romChecksum, oldChime))
+		{
+			return CHIME_ERR_DECODE_FIRMWARE;
+		}
+	}
+
+	// The sound is small enough to just load (a context with no firmware can still compress it)
+	FirmwareImage noFirmware;
+	PatchContext context(noFirmware);
+	ChimeError error;
+	{
+		StageTimer timer("loadSoundFile");
+		error = context.loadSoundFile(soundFile);
+		if (error == CHIME_OK)
+		{
+			error = context.encodeSound();
+		}
+	}
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+	const string &newChime = context.compressedSound();
+	romChecksum = adler32Replace(romChecksum, layout.romChecksumLength, layout.soundOffset, oldChime.data(),
+								 newChime.data(), SOUND_COMPRESSED_SIZE);
+
+	StageTimer timer("streamPatch");
+	FirmwareWriter writer(bufferSize);
+	if (!writer.open(outputFile))
+	{
+		return CHIME_ERR_OPEN_OUTPUT;
+	}
+	FirmwareReader reader(bufferSize);
+	if (!reader.open(firmwareFile))
+	{
+		writer.close();
+		return CHIME_ERR_READ_FIRMWARE;
+	}
+	bool patched = model->streamPatch(layout, reader, newChime, romChecksum, writer);
+	error = !writer.close() ? CHIME_ERR_WRITE_OUTPUT : !patched ? CHIME_ERR_DECODE_FIRMWARE : CHIME_OK;
+
+	// Don't leave half a firmware file lying around
+	if (error != CHIME_OK)
+	{
+		remove(outputFile);
+	}
+	return error;
+}
+
+static bool streamMd5(const char *filename, size_t bufferSize, string &md5)
+{
+	FirmwareReader reader(bufferSize);
+	if (!reader.open(filename))
+	{
+		return false;
+	}
+	MD5 digest;
+	while (reader.position() < reader.length())
+	{
+		size_t len = reader.length() - reader.position();
+		if (len > reader.capacity()) len = reader.capacity();
+		const char *data = reader.peek(len);
+		if (!data)
+		{
+			return false;
+		}
+		digest.update(data, static_cast<MD5::size_type>(len));
+		reader.skip(len);
+	}
+	md5 = digest.finalize().hexdigest();
+	return true;
+}
+
+static const ModelInfo *findPatchedLookalike(const char *filename, const ModelInfo *expectedModel, size_t bufferSize)
+{
+	for (size_t x = 0; x < numModels(); x++)
+	{
+		const ModelInfo &model = modelAt(x);
+		if (!modelMaskedMd5(model) || (expectedModel && &model != expectedModel))
+		{
+			continue;
+		}
+		FirmwareReader reader(bufferSize);
+		if (reader.open(filename) && model.looksLike(*model.layout, reader))
+		{
+			return &model;
+		}
+	}
+	return NULL;
+}
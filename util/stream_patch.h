@@ -0,0 +1,40 @@
+#ifndef STREAM_PATCH_H
+#define STREAM_PATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Patching with a bounded amount of memory, so that lots of jobs can run side by side on
+// one machine. Instead of holding the firmware file, its decoded ROM image and the patched
+// copy in memory, the firmware is read three times through a fixed-size buffer: once for
+// its MD5, once to pull out the ROM checksum and the old chime (so the new ROM checksum can
+// be worked out without the rest of the ROM), and once to copy it to the output file,
+// decoding, patching and re-encoding the ROM image a line at a time on the way through. The
+// output is identical to what PatchContext makes.
+//
+// Only original firmware files can be patched this way, since recognizing a patched one
+// takes the whole decoded ROM image (see FirmwareImage). A file that looks like it was
+// patched from a model that can be re-patched is turned away up front, so that it can be
+// patched the normal way instead.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chimepatch.h"
+
+// Smallest buffer streamPatchFile can use
+#define STREAM_MIN_BUFFER	(4 * 1024)
+
+// How big streamPatchFile's buffers can be to keep the whole process's peak resident set
+// size within maxMemory, given what it's using already. 0 if the budget is too small.
+size_t streamBufferSize(uint64_t maxMemory, uint64_t currentRss);
+
+// Patches firmwareFile with soundFile into outputFile using buffers of bufferSize bytes.
+// If expectedModel is NULL, the model is detected from the firmware file's MD5; detected is
+// set to the model (or NULL if the firmware wasn't recognized). Returns
+// CHIME_ERR_PATCHED_FIRMWARE, with detected set, for a file that looks like it was patched
+// from a model with a masked MD5. The output file is only created once both inputs have been
+// checked.
+ChimeError streamPatchFile(const char *firmwareFile, const char *soundFile, const char *outputFile,
+						   const ModelInfo *expectedModel, size_t bufferSize, const ModelInfo *&detected);
+
+#endif // STREAM_PATCH_H
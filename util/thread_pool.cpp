@@ -0,0 +1,139 @@
+#include "thread_pool.h"
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Index of the queue owned by the current thread (-1 if it isn't a worker), and whose it is
+static thread_local int currentWorker = -1;
+static thread_local const ThreadPool *currentPool = NULL;
+
+ThreadPool::ThreadPool(unsigned numThreads) :
+	queued(0),
+	pending(0),
+	nextQueue(0),
+	stopping(false)
+{
+	if (numThreads == 0)
+	{
+		numThreads = std::thread::hardware_concurrency();
+		if (numThreads == 0) numThreads = 1;
+	}
+
+	for (unsigned x = 0; x < numThreads; x++)
+	{
+		queues.push_back(std::unique_ptr<Queue>(new Queue));
+	}
+	for (unsigned x = 0; x < numThreads; x++)
+	{
+		threads.push_back(std::thread(&ThreadPool::run, this, x));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> l(stateLock);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (size_t x = 0; x < threads.size(); x++)
+	{
+		threads[x].join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	// Tasks submitted by a worker go on its own queue so they stay cache-local (workers of
+	// some other pool, like an I/O thread, get round-robin like everyone else)
+	size_t index;
+	{
+		std::lock_guard<std::mutex> l(stateLock);
+		index = (currentWorker >= 0 && currentPool == this) ? currentWorker : (nextQueue++ % queues.size());
+		pending++;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(queues[index]->lock);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+
+	{
+		std::lock_guard<std::mutex> l(stateLock);
+		queued++;
+	}
+	workAvailable.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> l(stateLock);
+	allDone.wait(l, [this] { return pending == 0; });
+}
+
+int ThreadPool::currentWorkerIndex()
+{
+	return currentWorker;
+}
+
+bool ThreadPool::popTask(unsigned index, std::function<void()> &task)
+{
+	// Newest task from our own queue first...
+	{
+		Queue &own = *queues[index];
+		std::lock_guard<std::mutex> l(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+
+	// ...otherwise steal the oldest task from somebody else
+	for (size_t x = 1; x < queues.size(); x++)
+	{
+		Queue &victim = *queues[(index + x) % queues.size()];
+		std::lock_guard<std::mutex> l(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::run(unsigned index)
+{
+	currentWorker = static_cast<int>(index);
+	currentPool = this;
+
+	while (true)
+	{
+		std::function<void()> task;
+		if (popTask(index, task))
+		{
+			task();
+
+			std::lock_guard<std::mutex> l(stateLock);
+			if (--pending == 0)
+			{
+				allDone.notify_all();
+			}
+			continue;
+		}
+
+		// Nothing to do anywhere -- sleep until more work shows up
+		std::unique_lock<std::mutex> l(stateLock);
+		workAvailable.wait(l, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0)
+		{
+			return;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A simple work-stealing thread pool. Each worker has its own queue; tasks are handed out
+// round-robin, a worker runs its own tasks newest-first, and when it runs out it steals
+// the oldest task from another worker's queue.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned numThreads = 0); // 0 means one thread per CPU
+	~ThreadPool();
+
+	void submit(std::function<void()> task);
+	void wait(); // blocks until every submitted task has finished
+	unsigned size() const { return static_cast<unsigned>(threads.size()); }
+	// Index (0 to size() - 1) of the worker running the calling task, or -1 if the caller
+	// isn't a worker thread
+	static int currentWorkerIndex();
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	void run(unsigned index);
+	bool popTask(unsigned index, std::function<void()> &task);
+
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::vector<std::thread> threads;
+	std::mutex stateLock;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+	std::atomic<size_t> queued; // tasks sitting in queues
+	size_t pending; // tasks queued or running
+	size_t nextQueue;
+	bool stopping;
+};
+
+#endif // THREAD_POOL_H
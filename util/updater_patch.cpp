@@ -0,0 +1,276 @@
+#include "updater_patch.h"
+#include "pattern_search.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static const UpdaterEdit UPDATER_EDITS[] = {
+	{"g3_blue_and_white", "Apple PowerMac1,1 ", "Apple PowerMac1,1 1.1f4 BootROM built on 04/09/99 at 13:57:32", 0, 0, 0},
+	{"imac_original", "Apple iMac Open Firmware ", "Apple iMac Open Firmware 3.0.f2 built on 04/23/99 at 14:31:03", 0, 0, 0},
+	{"imac_slot_loading", NULL, NULL, 0x688F, 0x06, 0x07},
+};
+static const size_t NUM_UPDATER_EDITS = sizeof(UPDATER_EDITS) / sizeof(UPDATER_EDITS[0]);
+
+// A file mapped read/write, so that edits to it go straight back to the file
+class MappedFile
+{
+public:
+	explicit MappedFile(const string &path);
+	~MappedFile();
+	bool isOpen() const { return data != NULL; }
+	bool sync() { return msync(data, length, MS_SYNC) == 0; }
+
+	const string path;
+	unsigned char *data;
+	size_t length;
+};
+
+static bool fileExists(const string &path); // whether there's a non-empty regular file at path
+static bool sameShape(const unsigned char *candidate, const char *entry, size_t len); // whether candidate is an allow-list entry like entry
+static void patchVersionByte(const UpdaterEdit &edit, const string &path, UpdaterPatch &patch); // bumps the version byte
+
+const UpdaterEdit *findUpdaterEdit(const ModelInfo *model)
+{
+	for (size_t x = 0; model && x < NUM_UPDATER_EDITS; x++)
+	{
+		if (strcmp(UPDATER_EDITS[x].modelId, model->id) == 0)
+		{
+			return &UPDATER_EDITS[x];
+		}
+	}
+	return NULL;
+}
+
+vector<string> updaterForks(const string &path)
+{
+	vector<string> forks;
+	forks.push_back(path);
+
+	size_t slash = path.rfind('/');
+	string dir = (slash == string::npos) ? string() : path.substr(0, slash + 1);
+	string name = (slash == string::npos) ? path : path.substr(slash + 1);
+	const string resourceForks[] = {path + "/..namedfork/rsrc", dir + "._" + name, dir + ".AppleDouble/" + name};
+	for (size_t x = 0; x < sizeof(resourceForks) / sizeof(resourceForks[0]); x++)
+	{
+		if (fileExists(resourceForks[x]))
+		{
+			forks.push_back(resourceForks[x]);
+		}
+	}
+	return forks;
+}
+
+void patchUpdater(const string &path, const ModelInfo *model, UpdaterPatch &patch)
+{
+	patch = UpdaterPatch();
+	patch.result = UPDATER_NOT_FOUND;
+	patch.edit = NULL;
+	patch.offset = 0;
+
+	const UpdaterEdit *modelEdit = findUpdaterEdit(model);
+	if (model && !modelEdit)
+	{
+		return;
+	}
+	if (modelEdit && !modelEdit->allowListPrefix)
+	{
+		patchVersionByte(*modelEdit, path, patch);
+		return;
+	}
+
+	// Look for every allow list we know about at once (or just the model's)
+	PatternSet set;
+	const UpdaterEdit *setEdits[MAX_SEARCH_PATTERNS];
+	set.count = 0;
+	for (size_t x = 0; x < NUM_UPDATER_EDITS; x++)
+	{
+		const UpdaterEdit &edit = UPDATER_EDITS[x];
+		if (edit.allowListPrefix && (!modelEdit || modelEdit == &edit))
+		{
+			setEdits[set.count] = &edit;
+			set.patterns[set.count] = edit.allowListPrefix;
+			set.lengths[set.count] = strlen(edit.allowListPrefix);
+			set.count++;
+		}
+	}
+
+	// Every fork stays mapped until the edit is made, since the entry to rewrite is the last one found
+	vector<unique_ptr<MappedFile> > forks;
+	vector<string> forkPaths = updaterForks(path);
+	vector<PatternMatch> matches;
+	MappedFile *target = NULL;
+	size_t targetOffset = 0;
+	const UpdaterEdit *targetEdit = NULL;
+	for (size_t x = 0; x < forkPaths.size(); x++)
+	{
+		forks.push_back(unique_ptr<MappedFile>(new MappedFile(forkPaths[x])));
+		MappedFile &fork = *forks.back();
+		if (!fork.isOpen())
+		{
+			patch.result = UPDATER_ERROR;
+			patch.error = "unable to open \"" + fork.path + "\" for writing";
+			return;
+		}
+
+		matches.clear();
+		{
+			StageTimer timer("patternSearch", fork.length);
+			findPatterns(fork.data, fork.length, set, matches);
+		}
+		for (size_t m = 0; m < matches.size(); m++)
+		{
+			const UpdaterEdit &edit = *setEdits[matches[m].pattern];
+			size_t entryLength = strlen(edit.allowListEntry);
+			const unsigned char *candidate = fork.data + matches[m].offset;
+			if (entryLength > fork.length - matches[m].offset)
+			{
+				continue;
+			}
+			if (memcmp(candidate, edit.allowListEntry, entryLength) == 0)
+			{
+				patch.result = UPDATER_ALREADY_PATCHED;
+				patch.edit = &edit;
+				patch.fork = fork.path;
+				patch.offset = matches[m].offset;
+				return;
+			}
+			if (sameShape(candidate, edit.allowListEntry, entryLength))
+			{
+				target = &fork;
+				targetOffset = matches[m].offset;
+				targetEdit = &edit;
+			}
+		}
+	}
+	if (!target)
+	{
+		return;
+	}
+
+	// Rewrite the last entry, and make sure it gets to the disk
+	size_t entryLength = strlen(targetEdit->allowListEntry);
+	patch.edit = targetEdit;
+	patch.fork = target->path;
+	patch.offset = targetOffset;
+	patch.before.assign(reinterpret_cast<const char *>(target->data + targetOffset), entryLength);
+	memcpy(target->data + targetOffset, targetEdit->allowListEntry, entryLength);
+	if (!target->sync())
+	{
+		patch.result = UPDATER_ERROR;
+		patch.error = "unable to write \"" + target->path + "\"";
+		return;
+	}
+	patch.result = UPDATER_PATCHED;
+}
+
+MappedFile::MappedFile(const string &path) :
+	path(path),
+	data(NULL),
+	length(0)
+{
+	int fd = open(path.c_str(), O_RDWR);
+	struct stat st;
+	if (fd < 0)
+	{
+		return;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void *mapped = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mapped != MAP_FAILED)
+		{
+			data = static_cast<unsigned char *>(mapped);
+			length = st.st_size;
+		}
+	}
+	// The mapping keeps the file open
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+	{
+		munmap(data, length);
+	}
+}
+
+static bool fileExists(const string &path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+}
+
+static bool sameShape(const unsigned char *candidate, const char *entry, size_t len)
+{
+	// Digits can be any digit, and so can the letter in a version number (the "f" in
+	// "1.1f4"); everything else has to match exactly
+	for (size_t x = 0; x < len; x++)
+	{
+		char e = entry[x];
+		char c = static_cast<char>(candidate[x]);
+		bool versionLetter = x > 0 && e >= 'a' && e <= 'z' &&
+			(entry[x - 1] == '.' || (entry[x - 1] >= '0' && entry[x - 1] <= '9'));
+		if (e >= '0' && e <= '9')
+		{
+			if (c < '0' || c > '9') return false;
+		}
+		else if (versionLetter)
+		{
+			if (c < 'a' || c > 'z') return false;
+		}
+		else if (c != e)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void patchVersionByte(const UpdaterEdit &edit, const string &path, UpdaterPatch &patch)
+{
+	MappedFile fork(path);
+	if (!fork.isOpen())
+	{
+		patch.result = UPDATER_ERROR;
+		patch.error = "unable to open \"" + path + "\" for writing";
+		return;
+	}
+	if (edit.versionOffset >= fork.length)
+	{
+		return;
+	}
+
+	patch.edit = &edit;
+	patch.fork = path;
+	patch.offset = edit.versionOffset;
+	unsigned char &version = fork.data[edit.versionOffset];
+	if (version == edit.newVersion)
+	{
+		patch.result = UPDATER_ALREADY_PATCHED;
+		return;
+	}
+	if (version != edit.oldVersion)
+	{
+		patch.edit = NULL;
+		return;
+	}
+	patch.before.assign(1, static_cast<char>(version));
+	version = edit.newVersion;
+	if (!fork.sync())
+	{
+		patch.result = UPDATER_ERROR;
+		patch.error = "unable to write \"" + path + "\"";
+		return;
+	}
+	patch.result = UPDATER_PATCHED;
+}
@@ -0,0 +1,62 @@
+#ifndef UPDATER_PATCH_H
+#define UPDATER_PATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// Apple's firmware updaters won't install a patched firmware file, because the machine is
+// already up to date. The G3 and the original iMac updaters have an allow list of firmware
+// versions they'll update, so one entry is rewritten to the version being installed. The
+// slot-loading iMac updater checks a version byte instead, which gets bumped. The edit is
+// made in place, in whichever fork of the updater it's found in.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "models.h"
+
+struct UpdaterEdit
+{
+	const char *modelId;
+	const char *allowListPrefix; // what every allow-list entry starts with (NULL for a version byte)
+	const char *allowListEntry; // what the last entry gets rewritten to
+	size_t versionOffset; // where the version byte is in the data fork
+	uint8_t oldVersion;
+	uint8_t newVersion;
+};
+
+// The edit for a model's updater (NULL if there isn't one)
+const UpdaterEdit *findUpdaterEdit(const ModelInfo *model);
+
+enum UpdaterResult
+{
+	UPDATER_PATCHED = 0,
+	UPDATER_ALREADY_PATCHED,
+	UPDATER_NOT_FOUND, // nothing that could be edited is in the file
+	UPDATER_ERROR // a fork couldn't be opened or written
+};
+
+struct UpdaterPatch
+{
+	UpdaterResult result;
+	const UpdaterEdit *edit; // the edit that was made (or had been already)
+	std::string fork; // the file it was made in
+	size_t offset; // and where
+	std::string before; // what was there before
+	std::string error; // what went wrong, for UPDATER_ERROR
+};
+
+// The files an updater's forks live in: the data fork, then whichever resource forks exist
+// (macOS's ..namedfork/rsrc, an AppleDouble ._ file, or netatalk's .AppleDouble directory).
+std::vector<std::string> updaterForks(const std::string &path);
+
+// Finds and makes the edit. Every fork is memory-mapped and scanned once for all the
+// allow-list prefixes at the same time. Each entry found is checked against the one it would
+// be rewritten to as it goes by, so an updater that was already patched is left alone. The
+// edit is written straight into the mapping and synced back to the file. If model is NULL,
+// every model's allow list is looked for. A version byte can't be recognized by its
+// contents, so that edit is only made for an explicitly given model.
+void patchUpdater(const std::string &path, const ModelInfo *model, UpdaterPatch &patch);
+
+#endif // UPDATER_PATCH_H
@@ -0,0 +1,149 @@
+#include "verify.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+static bool verifyAs(const char *filename, const ModelInfo &model, VerifyResult &result); // checks a file as one model
+static string describeResult(const VerifyResult &result); // lists everything wrong with a file
+
+void verifyFirmwareFile(const char *filename, const ModelInfo *model, const ModelInfo *&detected,
+						VerifyResult &result)
+{
+	detected = NULL;
+	if (model)
+	{
+		if (verifyAs(filename, *model, result))
+		{
+			detected = model;
+		}
+		return;
+	}
+
+	// A patched file's MD5 doesn't tell us anything, so try every model the file could be.
+	// The first one whose ROM checksum works out is it; failing that, report the first that fit.
+	VerifyResult firstResult;
+	firstResult.error = "not a firmware file for any supported model";
+	for (size_t x = 0; x < numModels(); x++)
+	{
+		const ModelInfo &candidateModel = modelAt(x);
+		FirmwareReader reader;
+		if (!reader.open(filename))
+		{
+			result = VerifyResult();
+			result.error = "unable to read file";
+			return;
+		}
+		if (!candidateModel.looksLike(*candidateModel.layout, reader))
+		{
+			continue;
+		}
+
+		VerifyResult candidate;
+		if (!verifyAs(filename, candidateModel, candidate))
+		{
+			continue;
+		}
+		if (candidate.romChecksumOk())
+		{
+			detected = &candidateModel;
+			result = candidate;
+			return;
+		}
+		if (!detected)
+		{
+			detected = &candidateModel;
+			firstResult = candidate;
+		}
+	}
+	result = firstResult;
+}
+
+size_t runVerify(const vector<string> &files, const ModelInfo *model, unsigned numThreads)
+{
+	mutex outputLock;
+	atomic<size_t> failures(0);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	ThreadPool pool(numThreads);
+	for (size_t x = 0; x < files.size(); x++)
+	{
+		const string &file = files[x];
+		pool.submit([&file, model, &outputLock, &failures]()
+		{
+			const ModelInfo *detected;
+			VerifyResult result;
+			verifyFirmwareFile(file.c_str(), model, detected, result);
+
+			lock_guard<mutex> l(outputLock);
+			cout << file << ": " << (result.ok() ? "OK" : "FAILED");
+			if (detected)
+			{
+				cout << " (" << detected->layout->name << ")";
+			}
+			if (!result.ok())
+			{
+				cout << ": " << describeResult(result);
+				failures++;
+			}
+			cout << endl;
+		});
+	}
+	pool.wait();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Verified " << (files.size() - failures) << " of " << files.size() << " files in " <<
+		(seconds * 1000.0) << " ms on " << pool.size() << " threads." << endl;
+
+	return failures;
+}
+
+static bool verifyAs(const char *filename, const ModelInfo &model, VerifyResult &result)
+{
+	FirmwareReader reader;
+	if (!reader.open(filename))
+	{
+		result = VerifyResult();
+		result.error = "unable to read file";
+		return false;
+	}
+	model.verifyFirmware(*model.layout, reader, result);
+	return true;
+}
+
+static string describeResult(const VerifyResult &result)
+{
+	if (result.error)
+	{
+		return result.error;
+	}
+
+	ostringstream problems;
+	problems << hex << uppercase << setfill('0');
+	const char *separator = "";
+	if (!result.fileChecksumOk())
+	{
+		problems << "file checksum is " << setw(8) << result.fileChecksum << " but the file says " <<
+			setw(8) << result.storedFileChecksum;
+		separator = "; ";
+	}
+	if (!result.romChecksumOk())
+	{
+		problems << separator << "ROM checksum is " << setw(8) << result.romChecksum << " but the file says " <<
+			setw(8) << result.storedRomChecksum;
+		separator = "; ";
+	}
+	if (!result.soundOk())
+	{
+		problems << separator << dec << "chime packet " << result.badPacket << " has an invalid header";
+	}
+	return problems.str();
+}
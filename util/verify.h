@@ -0,0 +1,22 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+#include <string>
+#include <vector>
+#include "models.h"
+
+// Checks that a firmware file (original or patched) is self-consistent: its file checksum,
+// its ROM checksum and the chime's packet headers. The file is read once, front to back,
+// through a small buffer. If model is NULL, it's worked out from the file's structure;
+// detected is set to the model the file was checked as (NULL if none fit).
+void verifyFirmwareFile(const char *filename, const ModelInfo *model, const ModelInfo *&detected,
+						VerifyResult &result);
+
+// Verifies every file, spread across numThreads threads (0 = one per CPU), printing a line
+// for each. Returns the number of files that failed.
+size_t runVerify(const std::vector<std::string> &files, const ModelInfo *model, unsigned numThreads);
+
+#endif // VERIFY_H
@@ -0,0 +1,178 @@
+#include "watch.h"
+#include "files.h"
+#include "incremental_patch.h"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+using namespace std;
+
+#ifdef __linux__
+// Writes the parts of the output that changed. The whole file is written instead if inSync is
+// false, or if the file isn't the length it was left at (someone else wrote to it, say).
+static bool writeChanges(const char *outputFile, const IncrementalPatcher &patcher, size_t oldLength, bool &inSync,
+						 size_t &written);
+// Writes all of data at offset
+static bool writeAll(int fd, const char *data, size_t length, size_t offset);
+
+ChimeError runWatch(const FirmwareImage &image, const char *soundFile, const char *outputFile)
+{
+	IncrementalPatcher patcher(image);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ChimeError error = patcher.loadSoundFile(soundFile);
+	if (error != CHIME_OK)
+	{
+		return error;
+	}
+	if (!writeFile(outputFile, patcher.output()))
+	{
+		return CHIME_ERR_OPEN_OUTPUT;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Wrote " << outputFile << " in " << (seconds * 1000.0) << " ms." << endl;
+
+	// Editors tend to save by writing a new file and renaming it over the old one, so it's the
+	// directory that's watched, for the sound file being written or renamed into place
+	string path = soundFile;
+	size_t slash = path.rfind('/');
+	string directory = (slash == string::npos) ? "." : (slash == 0) ? "/" : path.substr(0, slash);
+	string name = (slash == string::npos) ? path : path.substr(slash + 1);
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		if (fd >= 0) close(fd);
+		return CHIME_ERR_WATCH;
+	}
+	cout << "Watching " << soundFile << " for changes (Ctrl-C to stop)." << endl;
+
+	size_t outputLength = patcher.output().length();
+	bool inSync = true;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;)
+	{
+		ssize_t length = read(fd, events, sizeof(events));
+		if (length < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (length <= 0)
+		{
+			break;
+		}
+
+		// Several events can come in at once, but one rebuild covers them all
+		bool soundChanged = false;
+		for (ssize_t pos = 0; pos < length; )
+		{
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(events + pos);
+			if (event->len > 0 && name == event->name)
+			{
+				soundChanged = true;
+			}
+			pos += sizeof(struct inotify_event) + event->len;
+		}
+		if (!soundChanged)
+		{
+			continue;
+		}
+
+		start = chrono::steady_clock::now();
+		error = patcher.loadSoundFile(soundFile);
+		if (error != CHIME_OK)
+		{
+			cerr << "\"" << soundFile << "\": " << chimeErrorString(error) << "; keeping the last good chime." << endl;
+			continue;
+		}
+		size_t written = 0;
+		if (!writeChanges(outputFile, patcher, outputLength, inSync, written))
+		{
+			cerr << "\"" << outputFile << "\": " << chimeErrorString(CHIME_ERR_WRITE_OUTPUT) << "." << endl;
+			continue;
+		}
+		outputLength = patcher.output().length();
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Rebuilt " << outputFile << " in " << (seconds * 1000.0) << " ms (" << patcher.packetsEncoded() <<
+			" packets encoded, " << written << " bytes written)." << endl;
+	}
+	close(fd);
+	return CHIME_ERR_WATCH;
+}
+
+static bool writeChanges(const char *outputFile, const IncrementalPatcher &patcher, size_t oldLength, bool &inSync,
+						 size_t &written)
+{
+	int fd = open(outputFile, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		inSync = false;
+		return false;
+	}
+	struct stat st;
+	size_t fileLength = (fstat(fd, &st) == 0) ? static_cast<size_t>(st.st_size) : 0;
+	if (fileLength != oldLength)
+	{
+		inSync = false;
+	}
+
+	const string &output = patcher.output();
+	bool ok = true;
+	written = 0;
+	if (!inSync)
+	{
+		ok = writeAll(fd, output.data(), output.length(), 0);
+		written = output.length();
+	}
+	else
+	{
+		const vector<FirmwareRange> &changed = patcher.changed();
+		for (size_t x = 0; ok && x < changed.size(); x++)
+		{
+			ok = writeAll(fd, output.data() + changed[x].offset, changed[x].length, changed[x].offset);
+			written += changed[x].length;
+		}
+	}
+	if (ok && output.length() < fileLength)
+	{
+		ok = ftruncate(fd, output.length()) == 0;
+	}
+	ok = (close(fd) == 0) && ok;
+	inSync = ok;
+	return ok;
+}
+
+static bool writeAll(int fd, const char *data, size_t length, size_t offset)
+{
+	while (length > 0)
+	{
+		ssize_t count = pwrite(fd, data, length, offset);
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			return false;
+		}
+		data += count;
+		length -= count;
+		offset += count;
+	}
+	return true;
+}
+#else
+ChimeError runWatch(const FirmwareImage &, const char *, const char *)
+{
+	// Watching needs inotify
+	return CHIME_ERR_WATCH_UNSUPPORTED;
+}
+#endif // __linux__
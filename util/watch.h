@@ -0,0 +1,22 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// By Doug Brown (a.k.a. dougg3)
+// Public domain, do whatever you want with this.
+
+// For tuning a chime: patches a sound file into a firmware file, then watches the sound file
+// (with inotify) and rebuilds the output every time it's saved. The firmware stays verified and
+// decoded in memory the whole time, and each rebuild goes through an IncrementalPatcher, so only
+// the IMA packets that changed are encoded again and only the parts of the output file that
+// changed are written. How long each rebuild took is printed.
+
+#include "chimepatch.h"
+
+// Patches soundFile into image and writes it to outputFile, then keeps outputFile up to date
+// until the process is killed. A sound file that can't be used after a change is reported and
+// the last good output is left alone. Only returns if it couldn't get going (or inotify gives
+// out): a problem with the sound file, CHIME_ERR_OPEN_OUTPUT or CHIME_ERR_WATCH. Anywhere but
+// Linux, it returns CHIME_ERR_WATCH_UNSUPPORTED straight away.
+ChimeError runWatch(const FirmwareImage &image, const char *soundFile, const char *outputFile);
+
+#endif // WATCH_H